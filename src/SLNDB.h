@@ -1,6 +1,7 @@
 // Copyright 2014-2015 Ben Trask
 // MIT licensed (see LICENSE for details)
 
+#include <ctype.h>
 #include <kvstore/kvs_schema.h>
 
 enum {
@@ -16,7 +17,7 @@ enum {
 
 	SLNFileByID = 40,
 	SLNFileIDByInfo = 41,
-//	SLNFileIDByType = 42, // TODO
+	SLNFileIDByType = 42,
 	SLNFileIDAndURI = 43,
 	SLNURIAndFileID = 44,
 
@@ -27,6 +28,7 @@ enum {
 	SLNFieldValueAndMetaFileID = 64,
 	SLNTermMetaFileIDAndPosition = 65,
 	SLNFirstUniqueMetaFileID = 66,
+	SLNFoldedFieldValueAndMetaFileID = 67, // Lowercased copy of 64.
 
 	SLNFileIDAndSessionID = 80, // TODO: Pending deprecation?
 	SLNSessionIDAndHintIDToMetaURIAndTargetURI = 81,
@@ -167,6 +169,11 @@ static void SLNPullByIDValUnpack(KVS_val *const val, KVS_txn *const txn, uint64_
 	kvs_bind_string((val), (type), (txn)); \
 	kvs_bind_uint64((val), (size)); \
 	KVS_VAL_STORAGE_VERIFY(val);
+static void SLNFileByIDValUnpack(KVS_val *const val, KVS_txn *const txn, strarg_t *const internalHash, strarg_t *const type, uint64_t *const size) {
+	*internalHash = kvs_read_string(val, txn);
+	*type = kvs_read_string(val, txn);
+	*size = kvs_read_uint64(val);
+}
 
 #define SLNFileIDByInfoKeyPack(val, txn, internalHash, type) \
 	KVS_VAL_STORAGE(val, KVS_VARINT_MAX * 1 + KVS_INLINE_MAX * 2); \
@@ -179,6 +186,44 @@ static void SLNPullByIDValUnpack(KVS_val *const val, KVS_txn *const txn, uint64_
 	kvs_bind_uint64((val), (fileID)); \
 	KVS_VAL_STORAGE_VERIFY(val);
 
+// Keyed by the bare MIME type (see SLNFileTypeNormalize), so that
+// "text/markdown; charset=utf-8" and "text/markdown" share a range.
+#define SLNFileIDByTypeKeyPack(val, txn, type, fileID) \
+	KVS_VAL_STORAGE(val, KVS_VARINT_MAX * 2 + KVS_INLINE_MAX * 1); \
+	kvs_bind_uint64((val), SLNFileIDByType); \
+	kvs_bind_string((val), (type), (txn)); \
+	kvs_bind_uint64((val), (fileID)); \
+	KVS_VAL_STORAGE_VERIFY(val);
+#define SLNFileIDByTypeRange0(range, txn) \
+	KVS_RANGE_STORAGE(range, KVS_VARINT_MAX); \
+	kvs_bind_uint64((range)->min, SLNFileIDByType); \
+	kvs_range_genmax((range)); \
+	KVS_RANGE_STORAGE_VERIFY(range);
+#define SLNFileIDByTypeRange1(range, txn, type) \
+	KVS_RANGE_STORAGE(range, KVS_VARINT_MAX + KVS_INLINE_MAX); \
+	kvs_bind_uint64((range)->min, SLNFileIDByType); \
+	kvs_bind_string((range)->min, (type), (txn)); \
+	kvs_range_genmax((range)); \
+	KVS_RANGE_STORAGE_VERIFY(range);
+static void SLNFileIDByTypeKeyUnpack(KVS_val *const val, KVS_txn *const txn, strarg_t *const type, uint64_t *const fileID) {
+	uint64_t const table = kvs_read_uint64(val);
+	assert(SLNFileIDByType == table);
+	*type = kvs_read_string(val, txn);
+	*fileID = kvs_read_uint64(val);
+}
+static str_t *SLNFileTypeNormalize(strarg_t const type) {
+	// Strips parameters and lowercases. Returns NULL on OOM.
+	if(!type) return NULL;
+	size_t len = strcspn(type, ";");
+	while(len && isspace((unsigned char)type[len-1])) len--;
+	size_t i = 0;
+	while(i < len && isspace((unsigned char)type[i])) i++;
+	str_t *const out = strndup(type+i, len-i);
+	if(!out) return NULL;
+	for(str_t *x = out; *x; x++) *x = tolower((unsigned char)*x);
+	return out;
+}
+
 #define SLNFileIDAndURIKeyPack(val, txn, fileID, URI) \
 	KVS_VAL_STORAGE(val, KVS_VARINT_MAX * 2 + KVS_INLINE_MAX * 1); \
 	kvs_bind_uint64((val), SLNFileIDAndURI); \
@@ -291,6 +336,12 @@ static void SLNTargetURIAndMetaFileIDKeyUnpack(KVS_val *const val, KVS_txn *cons
 	kvs_bind_string((val), (field), (txn)); \
 	kvs_bind_string((val), (value), (txn)); \
 	KVS_VAL_STORAGE_VERIFY(val);
+#define SLNMetaFileIDFieldAndValueRange1(range, txn, metaFileID) \
+	KVS_RANGE_STORAGE(range, KVS_VARINT_MAX * 2); \
+	kvs_bind_uint64((range)->min, SLNMetaFileIDFieldAndValue); \
+	kvs_bind_uint64((range)->min, (metaFileID)); \
+	kvs_range_genmax((range)); \
+	KVS_RANGE_STORAGE_VERIFY(range);
 #define SLNMetaFileIDFieldAndValueRange2(range, txn, metaFileID, field) \
 	KVS_RANGE_STORAGE(range, KVS_VARINT_MAX * 2 + KVS_INLINE_MAX * 1); \
 	kvs_bind_uint64((range)->min, SLNMetaFileIDFieldAndValue); \
@@ -313,6 +364,12 @@ static void SLNMetaFileIDFieldAndValueKeyUnpack(KVS_val *const val, KVS_txn *con
 	kvs_bind_string((val), value, (txn)); \
 	kvs_bind_uint64((val), (metaFileID)); \
 	KVS_VAL_STORAGE_VERIFY(val);
+#define SLNFieldValueAndMetaFileIDRange1(range, txn, field) \
+	KVS_RANGE_STORAGE(range, KVS_VARINT_MAX * 1 + KVS_INLINE_MAX * 1); \
+	kvs_bind_uint64((range)->min, SLNFieldValueAndMetaFileID); \
+	kvs_bind_string((range)->min, (field), (txn)); \
+	kvs_range_genmax((range)); \
+	KVS_RANGE_STORAGE_VERIFY(range);
 #define SLNFieldValueAndMetaFileIDRange2(range, txn, field, value) \
 	KVS_RANGE_STORAGE(range, KVS_VARINT_MAX * 1 + KVS_INLINE_MAX * 2); \
 	kvs_bind_uint64((range)->min, SLNFieldValueAndMetaFileID); \
@@ -327,6 +384,29 @@ static void SLNFieldValueAndMetaFileIDKeyUnpack(KVS_val *const val, KVS_txn *con
 	*value = kvs_read_string(val, txn);
 	*metaFileID = kvs_read_uint64(val);
 }
+#define SLNFieldValueAndMetaFileIDRange0(range, txn) \
+	KVS_RANGE_STORAGE(range, KVS_VARINT_MAX); \
+	kvs_bind_uint64((range)->min, SLNFieldValueAndMetaFileID); \
+	kvs_range_genmax((range)); \
+	KVS_RANGE_STORAGE_VERIFY(range);
+
+// Field and value are both folded with SLNStringFold.
+#define SLNFoldedFieldValueAndMetaFileIDKeyPack(val, txn, field, value, metaFileID) \
+	KVS_VAL_STORAGE(val, KVS_VARINT_MAX * 2 + KVS_INLINE_MAX * 2); \
+	kvs_bind_uint64((val), SLNFoldedFieldValueAndMetaFileID); \
+	kvs_bind_string((val), field, (txn)); \
+	kvs_bind_string((val), value, (txn)); \
+	kvs_bind_uint64((val), (metaFileID)); \
+	KVS_VAL_STORAGE_VERIFY(val);
+static str_t *SLNStringFold(strarg_t const str, size_t const len) {
+	// ASCII only for now. UTF-8 sequences are left alone.
+	// TODO: Unicode case folding.
+	if(!str) return NULL;
+	str_t *const out = strndup(str, len);
+	if(!out) return NULL;
+	for(str_t *x = out; *x; x++) *x = tolower((unsigned char)*x);
+	return out;
+}
 
 #define SLNTermMetaFileIDAndPositionKeyPack(val, txn, token, metaFileID, position) \
 	KVS_VAL_STORAGE(val, KVS_VARINT_MAX * 3 + KVS_INLINE_MAX * 1); \
@@ -9,6 +9,7 @@
 #define HASHLEN_MEDIUM 24 // Safe against malicious collisions.
 #define HASHLEN_LONG 32 // Longest reasonable, hex form fits 80-char line.
 #define HASHLEN_MAX 128 // Should be enough for anyone.
+#define ALGO_MAX 3 // Checked against algos[] below.
 
 // Note: Support for old/weak algorithms is important for old files
 // that have links using those algorithms. The algorithm we use
@@ -63,17 +64,75 @@ void SLNHasherFree(SLNHasherRef *const hasherptr) {
 	assert_zeroed(hasher, 1);
 	FREE(hasherptr); hasher = NULL;
 }
+
+// Below this size, spawning threads costs more than it saves.
+#define PARALLEL_MIN (1024 * 16)
+
+typedef struct {
+	SLNAlgo const *algo;
+	void *ctx;
+	byte_t const *buf;
+	size_t len;
+	async_sem_t *done;
+	int rc;
+} hash_work;
+
+static void hash_update(void *const arg) {
+	hash_work *const work = arg;
+	async_pool_enter(NULL);
+	work->rc = work->algo->update(work->ctx, work->buf, work->len);
+	async_pool_leave(NULL);
+	async_sem_post(work->done);
+}
 int SLNHasherWrite(SLNHasherRef const hasher, byte_t const *const buf, size_t const len) {
 	if(!hasher) return 0;
 	if(!len) return 0;
 	assert(buf);
-	async_pool_enter(NULL);
+	assert(hasher->count <= algocount);
 	int rc = 0;
+	if(len < PARALLEL_MIN || hasher->count < 2) {
+		async_pool_enter(NULL);
+		for(size_t i = 0; i < hasher->count; i++) {
+			rc = algos[i]->update(hasher->algos[i], buf, len);
+			if(rc < 0) break;
+		}
+		async_pool_leave(NULL);
+		return rc;
+	}
+
+	// Each algorithm only touches its own context, so they can run
+	// side by side. We hash the last one ourselves and wait for the
+	// rest. The final digests are unaffected.
+	async_sem_t done[1];
+	async_sem_init(done, 0, 0);
+	hash_work work[ALGO_MAX];
+	size_t spawned = 0;
 	for(size_t i = 0; i < hasher->count; i++) {
-		rc = algos[i]->update(hasher->algos[i], buf, len);
-		if(rc < 0) break;
+		work[i] = (hash_work){
+			.algo = algos[i],
+			.ctx = hasher->algos[i],
+			.buf = buf,
+			.len = len,
+			.done = done,
+			.rc = 0,
+		};
+		if(i+1 == hasher->count) break;
+		int const x = async_spawn(STACK_DEFAULT, hash_update, &work[i]);
+		if(x < 0) break; // Fall back to doing the rest ourselves.
+		spawned++;
+	}
+	async_pool_enter(NULL);
+	for(size_t i = spawned; i < hasher->count; i++) {
+		work[i].rc = algos[i]->update(hasher->algos[i], buf, len);
 	}
 	async_pool_leave(NULL);
+	for(size_t i = 0; i < spawned; i++) async_sem_wait(done);
+	async_sem_destroy(done);
+
+	for(size_t i = 0; i < hasher->count; i++) {
+		rc = work[i].rc;
+		if(rc < 0) break;
+	}
 	return rc;
 }
 
@@ -243,4 +302,5 @@ static SLNAlgo const *const algos[] = {
 	&sha512,
 };
 static size_t const algocount = numberof(algos);
+typedef char algo_max_check[numberof(algos) <= ALGO_MAX ? 1 : -1];
 
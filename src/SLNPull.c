@@ -175,6 +175,27 @@ static void metareader(void *const arg) {
 	reader(pull, true);
 }
 
+static void committer(SLNPullRef const pull, bool const meta) {
+	int rc = 0;
+	for(;;) {
+		if(!pull->run) break;
+		rc = SLNSyncStoreAwait(pull->sync, meta);
+		if(rc < 0) break;
+	}
+	pull->run = false;
+	if(rc < 0) {
+		alogf("Pull committer error: %s\n", sln_strerror(rc));
+	}
+}
+static void filecommitter(void *const arg) {
+	SLNPullRef const pull = arg;
+	committer(pull, false);
+}
+static void metacommitter(void *const arg) {
+	SLNPullRef const pull = arg;
+	committer(pull, true);
+}
+
 static void worker(void *const arg) {
 	SLNPullRef const pull = arg;
 	HTTPConnectionRef conn = NULL;
@@ -260,6 +281,8 @@ int SLNPullStart(SLNPullRef const pull) {
 
 	async_spawn(STACK_DEFAULT, filereader, pull);
 	async_spawn(STACK_DEFAULT, metareader, pull);
+	async_spawn(STACK_DEFAULT, filecommitter, pull);
+	async_spawn(STACK_DEFAULT, metacommitter, pull);
 
 	for(size_t i = 0; i < WORKER_COUNT; i++) {
 		async_spawn(STACK_DEFAULT, worker, pull);
@@ -1,10 +1,16 @@
 // Copyright 2014-2015 Ben Trask
 // MIT licensed (see LICENSE for details)
 
+#include <yajl/yajl_tree.h>
 #include "StrongLink.h"
 #include "SLNDB.h"
 
 #define CACHE_SIZE 1000
+#define COMMIT_MAX 64 // Max batches folded into one write txn
+#define CONFIG_MAX (1024 * 16)
+#define MAPSIZE_DEFAULT ((size_t)1024 * 1024 * 1024 * 1)
+#define GROW_MAX 8 // Doublings per failed commit
+#define MIGRATE_BATCH 1000 // Entries per commit when building an index
 #define PASS_LEN 16 // Default for auto-generated passwords
 
 
@@ -33,6 +39,27 @@ static char *async_fs_tempnam(char const *dir, char const *prefix) {
 
 
 
+struct commit_req {
+	SLNRepoCommitCB cb;
+	void *ctx;
+	uint64_t sortID;
+	int rc;
+	bool leader;
+	async_sem_t sem[1];
+	struct commit_req *next;
+};
+
+// One fiber in SLNRepoSubmissionWait(), on its own stack.
+struct sub_waiter {
+	SLNRepoSubmissionCheckCB check;
+	void *ctx;
+	uint64_t after; // Everything up to here was checked already.
+	int rc;
+	bool done;
+	async_cond_t cond[1];
+	struct sub_waiter *next;
+};
+
 struct SLNRepo {
 	str_t *dir;
 	str_t *name;
@@ -47,16 +74,30 @@ struct SLNRepo {
 	SLNSessionCacheRef session_cache;
 
 	KVS_env *db;
+	size_t mapsize;
+
+	// The map can only be resized while no txns are open.
+	// Users are open/close pairs, and no txn outlives its pair.
+	async_mutex_t db_mutex[1];
+	async_cond_t db_cond[1];
+	size_t db_users;
+	bool db_growing;
 
 	async_mutex_t sub_mutex[1];
-	async_cond_t sub_cond[1];
 	uint64_t sub_latest;
+	struct sub_waiter *sub_waiters;
+
+	async_mutex_t commit_mutex[1];
+	struct commit_req *commit_head;
+	struct commit_req *commit_tail;
+	bool commit_active;
 
 	SLNPullRef *pulls;
 	size_t pull_count;
 	size_t pull_size;
 };
 
+static int load_config(SLNRepoRef const repo);
 static int connect_db(SLNRepoRef const repo);
 static int add_pull(SLNRepoRef const repo, SLNPullRef *const pull);
 static int load_pulls(SLNRepoRef const repo);
@@ -92,6 +133,14 @@ int SLNRepoCreate(strarg_t const dir, strarg_t const name, SLNRepoRef *const out
 	rc = SLNSessionCacheCreate(repo, CACHE_SIZE, &repo->session_cache);
 	if(rc < 0) goto cleanup;
 
+	async_mutex_init(repo->db_mutex, 0);
+	async_cond_init(repo->db_cond, 0);
+	async_mutex_init(repo->sub_mutex, 0);
+	async_mutex_init(repo->commit_mutex, 0);
+
+	rc = load_config(repo);
+	if(rc < 0) goto cleanup;
+
 	rc = connect_db(repo);
 	if(rc < 0) goto cleanup;
 
@@ -104,9 +153,6 @@ int SLNRepoCreate(strarg_t const dir, strarg_t const name, SLNRepoRef *const out
 		rc = 0; // Soft error.
 	}
 
-	async_mutex_init(repo->sub_mutex, 0);
-	async_cond_init(repo->sub_cond, 0);
-
 	*out = repo; repo = NULL;
 cleanup:
 	SLNRepoFree(&repo);
@@ -130,12 +176,22 @@ void SLNRepoFree(SLNRepoRef *const repoptr) {
 	repo->reg_mode = 0;
 	SLNSessionCacheFree(&repo->session_cache);
 
+	assert(!repo->db_users);
 	kvs_env_close(repo->db); repo->db = NULL;
+	repo->mapsize = 0;
+	async_mutex_destroy(repo->db_mutex);
+	async_cond_destroy(repo->db_cond);
+	repo->db_growing = false;
 
+	assert(!repo->sub_waiters);
 	async_mutex_destroy(repo->sub_mutex);
-	async_cond_destroy(repo->sub_cond);
 	repo->sub_latest = 0;
 
+	assert(!repo->commit_head);
+	assert(!repo->commit_active);
+	async_mutex_destroy(repo->commit_mutex);
+	repo->commit_tail = NULL;
+
 	for(size_t i = 0; i < repo->pull_count; ++i) {
 		SLNPullFree(&repo->pulls[i]);
 	}
@@ -193,9 +249,52 @@ SLNSessionCacheRef SLNRepoGetSessionCache(SLNRepoRef const repo) {
 	return repo->session_cache;
 }
 
+static void db_acquire(SLNRepoRef const repo) {
+	async_mutex_lock(repo->db_mutex);
+	while(repo->db_growing) async_cond_wait(repo->db_cond, repo->db_mutex);
+	repo->db_users++;
+	async_mutex_unlock(repo->db_mutex);
+}
+static void db_release(SLNRepoRef const repo) {
+	async_mutex_lock(repo->db_mutex);
+	assert(repo->db_users);
+	repo->db_users--;
+	if(!repo->db_users) async_cond_broadcast(repo->db_cond);
+	async_mutex_unlock(repo->db_mutex);
+}
+// Doubles the map size, unless someone else already grew it past `seen`.
+static int db_grow(SLNRepoRef const repo, size_t const seen) {
+	int rc = 0;
+	async_mutex_lock(repo->db_mutex);
+	while(repo->db_growing) async_cond_wait(repo->db_cond, repo->db_mutex);
+	if(repo->mapsize > seen) goto cleanup;
+	repo->db_growing = true;
+	while(repo->db_users) {
+		async_cond_wait(repo->db_cond, repo->db_mutex);
+	}
+
+	size_t mapsize = repo->mapsize * 2;
+	async_pool_enter(NULL);
+	rc = kvs_env_set_config(repo->db, KVS_CFG_MAPSIZE, &mapsize);
+	async_pool_leave(NULL);
+	if(rc >= 0) {
+		alogf("Database map size grown to %zu MB\n", mapsize / 1024 / 1024);
+		repo->mapsize = mapsize;
+	} else {
+		alogf("Database map size error (%s)\n", sln_strerror(rc));
+	}
+
+	repo->db_growing = false;
+	async_cond_broadcast(repo->db_cond);
+cleanup:
+	async_mutex_unlock(repo->db_mutex);
+	return rc;
+}
+
 void SLNRepoDBOpenUnsafe(SLNRepoRef const repo, KVS_env **const dbptr) {
 	assert(repo);
 	assert(dbptr);
+	db_acquire(repo);
 	async_pool_enter(NULL);
 	*dbptr = repo->db;
 }
@@ -204,30 +303,219 @@ void SLNRepoDBClose(SLNRepoRef const repo, KVS_env **const dbptr) {
 	assert(repo || !*dbptr);
 	if(!*dbptr) return;
 	async_pool_leave(NULL);
+	db_release(repo);
 	*dbptr = NULL;
 }
 
+// Group commit: callers queue up while another commit is in flight
+// and the next leader stores them all in one txn. So nobody waits
+// longer than one commit, but under load each sync covers many batches.
+static int commit_list(KVS_env *const db, struct commit_req *const list) {
+	KVS_txn *txn = NULL;
+	int rc = kvs_txn_begin(db, NULL, KVS_RDWR, &txn);
+	if(rc >= 0) {
+		for(struct commit_req *req = list; req; req = req->next) {
+			req->sortID = 0;
+			rc = req->cb(req->ctx, txn, &req->sortID);
+			if(rc < 0) break;
+		}
+	}
+	if(rc >= 0) {
+		rc = kvs_txn_commit(txn); txn = NULL;
+	} else {
+		kvs_txn_abort(txn); txn = NULL;
+	}
+	for(struct commit_req *req = list; req; req = req->next) {
+		req->rc = rc;
+	}
+	return rc;
+}
+static void commit_group(SLNRepoRef const repo) {
+	async_mutex_lock(repo->commit_mutex);
+	struct commit_req *const group = repo->commit_head;
+	struct commit_req *last = group;
+	assert(group);
+	assert(group->leader);
+	for(size_t i = 1; i < COMMIT_MAX && last->next; i++) last = last->next;
+	repo->commit_head = last->next;
+	if(!repo->commit_head) repo->commit_tail = NULL;
+	last->next = NULL;
+	async_mutex_unlock(repo->commit_mutex);
+
+	KVS_env *db = NULL;
+	SLNRepoDBOpenUnsafe(repo, &db);
+	size_t mapsize = repo->mapsize;
+	int rc = commit_list(db, group);
+	SLNRepoDBClose(repo, &db);
+	for(size_t i = 0; KVS_MAP_FULL == rc && i < GROW_MAX; i++) {
+		if(db_grow(repo, mapsize) < 0) break;
+		SLNRepoDBOpenUnsafe(repo, &db);
+		mapsize = repo->mapsize;
+		rc = commit_list(db, group);
+		SLNRepoDBClose(repo, &db);
+	}
+	if(rc < 0 && group->next) {
+		// One bad batch shouldn't sink everyone else's.
+		// Retry them separately so each gets its own result.
+		SLNRepoDBOpenUnsafe(repo, &db);
+		for(struct commit_req *req = group; req;) {
+			struct commit_req *const next = req->next;
+			req->next = NULL;
+			(void) commit_list(db, req);
+			req->next = next;
+			req = next;
+		}
+		SLNRepoDBClose(repo, &db);
+	}
+
+	uint64_t sortID = 0;
+	for(struct commit_req *req = group; req; req = req->next) {
+		if(req->rc < 0) continue;
+		sortID = MAX(sortID, req->sortID);
+	}
+	// Commits are serialized by the leader hand-off below,
+	// so emits still happen in commit order.
+	SLNRepoSubmissionEmit(repo, sortID);
+
+	async_mutex_lock(repo->commit_mutex);
+	if(repo->commit_head) {
+		repo->commit_head->leader = true;
+		async_sem_post(repo->commit_head->sem);
+	} else {
+		repo->commit_active = false;
+	}
+	async_mutex_unlock(repo->commit_mutex);
+
+	// Careful: waiters own their requests and may return immediately.
+	for(struct commit_req *req = group->next; req;) {
+		struct commit_req *const next = req->next;
+		req->next = NULL;
+		async_sem_post(req->sem);
+		req = next;
+	}
+	group->next = NULL;
+}
+int SLNRepoCommit(SLNRepoRef const repo, SLNRepoCommitCB const cb, void *const ctx) {
+	assert(repo);
+	assert(cb);
+	struct commit_req req[1] = {{
+		.cb = cb,
+		.ctx = ctx,
+		.sortID = 0,
+		.rc = 0,
+		.leader = false,
+		.next = NULL,
+	}};
+	async_sem_init(req->sem, 0, 0);
+
+	async_mutex_lock(repo->commit_mutex);
+	if(repo->commit_tail) repo->commit_tail->next = req;
+	else repo->commit_head = req;
+	repo->commit_tail = req;
+	if(!repo->commit_active) {
+		repo->commit_active = true;
+		req->leader = true;
+	}
+	async_mutex_unlock(repo->commit_mutex);
+
+	if(!req->leader) async_sem_wait(req->sem);
+	if(req->leader) commit_group(repo);
+	async_sem_destroy(req->sem);
+	return req->rc;
+}
+
+// Waiters that gave us a check only wake up when it passes, so a quiet
+// query doesn't have to open its own txn for every commit. All of the
+// checks share one read txn, and run before anyone is signaled because
+// the txn puts us on the thread pool.
 void SLNRepoSubmissionEmit(SLNRepoRef const repo, uint64_t const sortID) {
 	assert(repo);
 	async_mutex_lock(repo->sub_mutex);
-	if(sortID > repo->sub_latest) {
-		repo->sub_latest = sortID;
-		async_cond_broadcast(repo->sub_cond);
+	if(sortID <= repo->sub_latest) {
+		async_mutex_unlock(repo->sub_mutex);
+		return;
+	}
+	repo->sub_latest = sortID;
+
+	KVS_env *db = NULL;
+	KVS_txn *txn = NULL;
+	int rc = 0;
+	for(struct sub_waiter *w = repo->sub_waiters; w; w = w->next) {
+		if(w->done || !w->check) continue;
+		if(!db) {
+			SLNRepoDBOpenUnsafe(repo, &db);
+			rc = kvs_txn_begin(db, NULL, KVS_RDONLY, &txn);
+		}
+		if(rc < 0) break; // Errors just mean everyone has to look.
+		if(w->check(w->ctx, txn, w->after, sortID)) continue;
+		w->after = sortID;
+	}
+	kvs_txn_abort(txn); txn = NULL;
+	SLNRepoDBClose(repo, &db);
+
+	for(struct sub_waiter *w = repo->sub_waiters; w; w = w->next) {
+		if(w->done || w->after >= sortID) continue;
+		w->done = true;
+		async_cond_signal(w->cond);
 	}
 	async_mutex_unlock(repo->sub_mutex);
 }
-int SLNRepoSubmissionWait(SLNRepoRef const repo, uint64_t *const sortID, uint64_t const future) {
+// Waits until something newer than *sortID is committed and passes
+// check, if given. On return, *sortID is the latest commit.
+int SLNRepoSubmissionWait(SLNRepoRef const repo, uint64_t *const sortID, uint64_t const future, SLNRepoSubmissionCheckCB const check, void *const ctx) {
 	assert(repo);
 	assert(sortID);
-	int rc = 0;
+	struct sub_waiter w[1] = {{
+		.check = check,
+		.ctx = ctx,
+		.after = *sortID,
+		.rc = 0,
+		.done = false,
+		.next = NULL,
+	}};
+	async_cond_init(w->cond, 0);
 	async_mutex_lock(repo->sub_mutex);
-	while(repo->sub_latest <= *sortID) {
-		rc = async_cond_timedwait(repo->sub_cond, repo->sub_mutex, future);
+	if(repo->sub_latest > *sortID) w->done = true;
+	if(!w->done) {
+		w->next = repo->sub_waiters;
+		repo->sub_waiters = w;
+	}
+	while(!w->done) {
+		int const rc = async_cond_timedwait(w->cond, repo->sub_mutex, future);
+		if(rc < 0 && !w->done) w->rc = rc;
 		if(rc < 0) break;
 	}
+	for(struct sub_waiter **x = &repo->sub_waiters; *x; x = &(*x)->next) {
+		if(w != *x) continue;
+		*x = w->next;
+		break;
+	}
 	*sortID = repo->sub_latest;
 	async_mutex_unlock(repo->sub_mutex);
-	return rc;
+	async_cond_destroy(w->cond);
+	return w->rc;
+}
+// Wakes whoever is in SLNRepoSubmissionWait() with this ctx, with
+// UV_ECANCELED, so they can notice that they should stop without
+// waiting for a timeout. Other waiters aren't disturbed.
+void SLNRepoSubmissionCancel(SLNRepoRef const repo, void *const ctx) {
+	assert(repo);
+	assert(ctx);
+	async_mutex_lock(repo->sub_mutex);
+	for(struct sub_waiter *w = repo->sub_waiters; w; w = w->next) {
+		if(w->done || ctx != w->ctx) continue;
+		w->rc = UV_ECANCELED;
+		w->done = true;
+		async_cond_signal(w->cond);
+	}
+	async_mutex_unlock(repo->sub_mutex);
+}
+uint64_t SLNRepoSubmissionLatest(SLNRepoRef const repo) {
+	assert(repo);
+	async_mutex_lock(repo->sub_mutex);
+	uint64_t const latest = repo->sub_latest;
+	async_mutex_unlock(repo->sub_mutex);
+	return latest;
 }
 
 void SLNRepoPullsStart(SLNRepoRef const repo) {
@@ -244,7 +532,29 @@ void SLNRepoPullsStop(SLNRepoRef const repo) {
 }
 
 
-static int create_admin(SLNRepoRef const repo, KVS_txn *const txn) {
+typedef struct {
+	SLNSessionRef root;
+	strarg_t username;
+	strarg_t password;
+	bool created;
+} admin_state;
+static int create_admin_cb(void *const ctx, KVS_txn *const txn, uint64_t *const sortID) {
+	admin_state *const admin = ctx;
+	admin->created = false;
+	KVS_cursor *cursor = NULL;
+	int rc = kvs_txn_cursor(txn, &cursor);
+	if(rc < 0) return rc;
+	KVS_range users[1];
+	SLNUserByIDKeyRange0(users, txn);
+	rc = kvs_cursor_firstr(cursor, users, NULL, NULL, +1);
+	if(rc >= 0) return 0;
+	if(KVS_NOTFOUND != rc) return rc;
+	rc = SLNSessionCreateUserInternal(admin->root, txn, admin->username, admin->password, SLN_ROOT);
+	if(rc < 0) return rc;
+	admin->created = true;
+	return 0;
+}
+static int create_admin(SLNRepoRef const repo) {
 	SLNSessionCacheRef const cache = SLNRepoGetSessionCache(repo);
 	SLNSessionRef root = NULL;
 	int rc = SLNSessionCreateInternal(cache, 0, NULL, NULL, 0, SLN_ROOT, NULL, &root);
@@ -255,24 +565,280 @@ static int create_admin(SLNRepoRef const repo, KVS_txn *const txn) {
 
 	byte_t buf[PASS_LEN/2];
 	rc = async_random(buf, sizeof(buf));
-	if(rc < 0) return rc;
+	if(rc < 0) goto cleanup;
 	char password[PASS_LEN+1];
 	tohex(password, buf, sizeof(buf));
 	password[PASS_LEN] = '\0';
 
-	rc = SLNSessionCreateUserInternal(root, txn, username, password, SLN_ROOT);
-	if(rc < 0) return rc;
+	// The password is picked out here, since the commit might run
+	// our callback more than once.
+	admin_state admin[1] = {{ root, username, password, false }};
+	rc = SLNRepoCommit(repo, create_admin_cb, admin);
+	if(rc < 0) goto cleanup;
+	if(!admin->created) goto cleanup;
 
 	fprintf(stdout, "ACCOUNT CREATED\n");
 	fprintf(stdout, "  Username: %s\n", username);
 	fprintf(stdout, "  Password: %s\n", password);
 	fprintf(stdout, "  Please change your password after logging in\n");
 
+cleanup:
+	SLNSessionRelease(&root);
+	return rc;
+}
+// Indexes added after the fact get built from existing data at startup.
+// That's done as a series of commits of up to MIGRATE_BATCH entries, so
+// a big repo doesn't need one huge txn and the map can grow in between.
+// Each commit picks up after the last key the previous one handled,
+// which we have to copy since it lives in that txn's memory.
+typedef struct {
+	byte_t *key; // NULL before the first batch
+	size_t size;
+	byte_t *next;
+	size_t next_size;
+	bool done;
+} migrate_state;
+
+static int migrate_seek(migrate_state const *const state, KVS_cursor *const cursor, KVS_range *const range, KVS_val *const key, KVS_val *const val) {
+	if(!state->key) return kvs_cursor_firstr(cursor, range, key, val, +1);
+	key->size = state->size;
+	key->data = state->key;
+	int rc = kvs_cursor_seekr(cursor, range, key, val, +1);
+	if(rc < 0) return rc;
+	if(key->size != state->size) return 0;
+	if(0 != memcmp(key->data, state->key, state->size)) return 0;
+	return kvs_cursor_nextr(cursor, range, key, val, +1);
+}
+// The callback can run more than once per commit, so it leaves its
+// resume point in next and migrate() only keeps it once committed.
+static int migrate_save(migrate_state *const state, KVS_val const *const last) {
+	FREE(&state->next);
+	state->next = malloc(last->size);
+	if(!state->next) return KVS_ENOMEM;
+	memcpy(state->next, last->data, last->size);
+	state->next_size = last->size;
 	return 0;
 }
+static int migrate(SLNRepoRef const repo, SLNRepoCommitCB const cb) {
+	migrate_state state[1] = {};
+	int rc = 0;
+	while(!state->done) {
+		rc = SLNRepoCommit(repo, cb, state);
+		if(rc < 0) break;
+		FREE(&state->key);
+		state->key = state->next; state->next = NULL;
+		state->size = state->next_size;
+	}
+	FREE(&state->key);
+	FREE(&state->next);
+	return rc;
+}
+
+// Files are indexed in order, so if the newest one is there, the
+// migration finished (or was never needed).
+static int types_indexed(KVS_txn *const txn, KVS_cursor *const cursor) {
+	KVS_range files[1];
+	KVS_val key[1], val[1];
+	SLNFileByIDRange0(files, txn);
+	int rc = kvs_cursor_firstr(cursor, files, key, val, -1);
+	if(KVS_NOTFOUND == rc) return 0;
+	if(rc < 0) return rc;
+	uint64_t const table = kvs_read_uint64(key);
+	assert(SLNFileByID == table);
+	uint64_t const fileID = kvs_read_uint64(key);
+	strarg_t internalHash, type;
+	uint64_t size;
+	SLNFileByIDValUnpack(val, txn, &internalHash, &type, &size);
+	str_t *t = SLNFileTypeNormalize(type);
+	if(!t) return KVS_ENOMEM;
+	KVS_val type_key[1];
+	SLNFileIDByTypeKeyPack(type_key, txn, t, fileID);
+	rc = kvs_get(txn, type_key, NULL);
+	FREE(&t);
+	return rc;
+}
+static int index_types_cb(void *const ctx, KVS_txn *const txn, uint64_t *const sortID) {
+	// Repos created before SLNFileIDByType was written need it built
+	// once from SLNFileByID. New files are indexed on submission.
+	migrate_state *const state = ctx;
+	KVS_cursor *cursor = NULL;
+	int rc = kvs_txn_cursor(txn, &cursor);
+	if(rc < 0) return rc;
+	state->done = true;
+	if(!state->key) {
+		rc = types_indexed(txn, cursor);
+		if(rc >= 0) return 0;
+		if(KVS_NOTFOUND != rc) return rc;
+	}
+
+	KVS_range files[1];
+	KVS_val key[1], val[1];
+	KVS_val last[1] = {{ 0, NULL }};
+	size_t count = 0;
+	SLNFileByIDRange0(files, txn);
+	rc = migrate_seek(state, cursor, files, key, val);
+	for(; rc >= 0; rc = kvs_cursor_nextr(cursor, files, key, val, +1)) {
+		if(count++ >= MIGRATE_BATCH) {
+			state->done = false;
+			return migrate_save(state, last);
+		}
+		*last = *key;
+		uint64_t const table = kvs_read_uint64(key);
+		assert(SLNFileByID == table);
+		uint64_t const fileID = kvs_read_uint64(key);
+		strarg_t internalHash, type;
+		uint64_t size;
+		SLNFileByIDValUnpack(val, txn, &internalHash, &type, &size);
+		str_t *t = SLNFileTypeNormalize(type);
+		if(!t) return KVS_ENOMEM;
+		KVS_val type_key[1];
+		KVS_val null[1];
+		SLNFileIDByTypeKeyPack(type_key, txn, t, fileID);
+		kvs_nullval(null);
+		rc = kvs_put(txn, type_key, null, 0);
+		FREE(&t);
+		if(rc < 0) return rc;
+	}
+	if(KVS_NOTFOUND != rc) return rc;
+	return 0;
+}
+// Same as types_indexed, in key order. Folded entries are put with the
+// same meta-file ID, so the last one's twin tells us if we finished.
+static int folded_indexed(KVS_txn *const txn, KVS_cursor *const cursor) {
+	KVS_range metadata[1];
+	KVS_val key[1];
+	SLNFieldValueAndMetaFileIDRange0(metadata, txn);
+	int rc = kvs_cursor_firstr(cursor, metadata, key, NULL, -1);
+	if(KVS_NOTFOUND == rc) return 0;
+	if(rc < 0) return rc;
+	strarg_t field, value;
+	uint64_t metaFileID;
+	SLNFieldValueAndMetaFileIDKeyUnpack(key, txn, &field, &value, &metaFileID);
+	str_t *ffield = SLNStringFold(field, strlen(field));
+	str_t *fvalue = SLNStringFold(value, strlen(value));
+	if(ffield && fvalue) {
+		KVS_val fkey[1];
+		SLNFoldedFieldValueAndMetaFileIDKeyPack(fkey, txn, ffield, fvalue, metaFileID);
+		rc = kvs_get(txn, fkey, NULL);
+	} else {
+		rc = KVS_ENOMEM;
+	}
+	FREE(&ffield);
+	FREE(&fvalue);
+	return rc;
+}
+static int index_folded_cb(void *const ctx, KVS_txn *const txn, uint64_t *const sortID) {
+	// Same as above, for case-insensitive metadata.
+	migrate_state *const state = ctx;
+	KVS_cursor *cursor = NULL;
+	int rc = kvs_txn_cursor(txn, &cursor);
+	if(rc < 0) return rc;
+	state->done = true;
+	if(!state->key) {
+		rc = folded_indexed(txn, cursor);
+		if(rc >= 0) return 0;
+		if(KVS_NOTFOUND != rc) return rc;
+	}
+
+	KVS_range metadata[1];
+	KVS_val key[1];
+	KVS_val last[1] = {{ 0, NULL }};
+	size_t count = 0;
+	SLNFieldValueAndMetaFileIDRange0(metadata, txn);
+	rc = migrate_seek(state, cursor, metadata, key, NULL);
+	for(; rc >= 0; rc = kvs_cursor_nextr(cursor, metadata, key, NULL, +1)) {
+		if(count++ >= MIGRATE_BATCH) {
+			state->done = false;
+			return migrate_save(state, last);
+		}
+		*last = *key;
+		strarg_t field, value;
+		uint64_t metaFileID;
+		SLNFieldValueAndMetaFileIDKeyUnpack(key, txn, &field, &value, &metaFileID);
+		str_t *ffield = SLNStringFold(field, strlen(field));
+		str_t *fvalue = SLNStringFold(value, strlen(value));
+		if(ffield && fvalue) {
+			KVS_val fkey[1];
+			KVS_val null[1];
+			SLNFoldedFieldValueAndMetaFileIDKeyPack(fkey, txn, ffield, fvalue, metaFileID);
+			kvs_nullval(null);
+			rc = kvs_put(txn, fkey, null, 0);
+		} else {
+			rc = KVS_ENOMEM;
+		}
+		FREE(&ffield);
+		FREE(&fvalue);
+		if(rc < 0) return rc;
+	}
+	if(KVS_NOTFOUND != rc) return rc;
+	return 0;
+}
+static int verify_schema_cb(void *const ctx, KVS_txn *const txn, uint64_t *const sortID) {
+	return kvs_schema_verify(txn);
+}
+// Optional per-repo settings in <repo>/config.json, e.g.
+// { "mapsize": 4294967296 }
+static int load_config(SLNRepoRef const repo) {
+	assert(repo);
+	repo->mapsize = MAPSIZE_DEFAULT;
+
+	str_t *path = aasprintf("%s/config.json", repo->dir);
+	str_t *str = NULL;
+	yajl_val config = NULL;
+	uv_file file = -1;
+	int rc = 0;
+	if(!path) rc = UV_ENOMEM;
+	if(rc < 0) goto cleanup;
+
+	file = async_fs_open(path, O_RDONLY, 0000);
+	if(UV_ENOENT == file) goto cleanup;
+	if(file < 0) rc = (int)file;
+	if(rc < 0) goto cleanup;
+	uv_fs_t req;
+	rc = async_fs_fstat(file, &req);
+	if(rc < 0) goto cleanup;
+	int64_t const size = req.statbuf.st_size;
+	if(size > CONFIG_MAX) rc = UV_EFBIG;
+	if(rc < 0) goto cleanup;
+	str = malloc((size_t)size+1);
+	if(!str) rc = UV_ENOMEM;
+	if(rc < 0) goto cleanup;
+	uv_buf_t info = uv_buf_init(str, size);
+	ssize_t len = async_fs_readall_simple(file, &info);
+	if(len < 0) rc = (int)len;
+	else if(size != len) rc = UV_EBUSY;
+	if(rc < 0) goto cleanup;
+	str[size] = '\0';
+
+	config = yajl_tree_parse(str, NULL, 0);
+	if(!YAJL_IS_OBJECT(config)) {
+		alogf("Invalid repo config (%s)\n", path);
+		rc = UV_EINVAL;
+		goto cleanup;
+	}
+
+	char const *mapsize_path[] = { "mapsize", NULL };
+	yajl_val const mapsize = yajl_tree_get(config, mapsize_path, yajl_t_number);
+	if(mapsize) {
+		if(!YAJL_IS_INTEGER(mapsize) || YAJL_GET_INTEGER(mapsize) <= 0) {
+			alogf("Invalid repo config mapsize\n");
+			rc = UV_EINVAL;
+			goto cleanup;
+		}
+		repo->mapsize = (size_t)YAJL_GET_INTEGER(mapsize);
+	}
+
+cleanup:
+	if(file >= 0) async_fs_close(file);
+	file = -1;
+	yajl_tree_free(config); config = NULL;
+	FREE(&str);
+	FREE(&path);
+	return rc;
+}
 static int connect_db(SLNRepoRef const repo) {
 	assert(repo);
-	size_t mapsize = 1024 * 1024 * 1024 * 1;
+	size_t mapsize = repo->mapsize;
 	int rc = kvs_env_create(&repo->db);
 	rc = rc < 0 ? rc : kvs_env_set_config(repo->db, KVS_CFG_MAPSIZE, &mapsize);
 	if(rc < 0) {
@@ -285,58 +851,30 @@ static int connect_db(SLNRepoRef const repo) {
 		return rc;
 	}
 
-	KVS_env *db = NULL;
-	SLNRepoDBOpenUnsafe(repo, &db);
-	KVS_txn *txn = NULL;
-	rc = kvs_txn_begin(db, NULL, KVS_RDWR, &txn);
-	if(rc < 0) {
-		SLNRepoDBClose(repo, &db);
-		alogf("Database transaction error (%s)\n", sln_strerror(rc));
-		return rc;
-	}
-
-	rc = kvs_schema_verify(txn);
+	// Everything below writes through SLNRepoCommit(), so a full map
+	// gets grown instead of failing startup.
+	rc = SLNRepoCommit(repo, verify_schema_cb, NULL);
 	if(KVS_VERSION_MISMATCH == rc) {
-		kvs_txn_abort(txn); txn = NULL;
-		SLNRepoDBClose(repo, &db);
 		alogf("Database incompatible with this software version\n");
 		return rc;
 	}
 	if(rc < 0) {
-		kvs_txn_abort(txn); txn = NULL;
-		SLNRepoDBClose(repo, &db);
 		alogf("Database schema layer error (%s)\n", sln_strerror(rc));
 		return rc;
 	}
 
 	// TODO: Application-level schema verification
 
-	KVS_cursor *cursor = NULL;
-	rc = kvs_txn_cursor(txn, &cursor);
-	if(rc < 0) {
-		kvs_txn_abort(txn); txn = NULL;
-		SLNRepoDBClose(repo, &db);
-		alogf("Database cursor error (%s)\n", sln_strerror(rc));
-		return rc;
-	}
-
-	KVS_range users[1];
-	SLNUserByIDKeyRange0(users, txn);
-	rc = kvs_cursor_firstr(cursor, users, NULL, NULL, +1);
-	if(KVS_NOTFOUND == rc) {
-		rc = create_admin(repo, txn);
-	}
+	rc = create_admin(repo);
 	if(rc < 0) {
-		kvs_txn_abort(txn); txn = NULL;
-		SLNRepoDBClose(repo, &db);
 		alogf("Database user error (%s)\n", sln_strerror(rc));
 		return rc;
 	}
 
-	rc = kvs_txn_commit(txn); txn = NULL;
-	SLNRepoDBClose(repo, &db);
+	rc = migrate(repo, index_types_cb);
+	if(rc >= 0) rc = migrate(repo, index_folded_cb);
 	if(rc < 0) {
-		alogf("Database commit error (%s)\n", sln_strerror(rc));
+		alogf("Database index error (%s)\n", sln_strerror(rc));
 		return rc;
 	}
 	return 0;
@@ -10,6 +10,9 @@
 
 #define QUERY_BATCH_SIZE 50
 #define AUTH_FORM_MAX (1023+1)
+#define RANGES_MAX 16 // Past this we just send the whole file.
+#define RANGE_BUF_SIZE (1024 * 64)
+#define ESTIMATE_MAX 10000 // Estimates are capped, counts aren't.
 
 
 // TODO: Some sort of token-based API auth system, like OAuth?
@@ -50,6 +53,193 @@
 	FREE(&cookie);
 	return 0;
 }*/
+// Our content is immutable, so any ETag we gave out is still valid.
+static bool etag_match(strarg_t const header, strarg_t const etag) {
+	if(!header) return false;
+	size_t const len = strlen(etag);
+	strarg_t x = header;
+	for(;;) {
+		while(' ' == x[0] || '\t' == x[0] || ',' == x[0]) x++;
+		if('\0' == x[0]) return false;
+		if('*' == x[0]) return true;
+		if('W' == x[0] && '/' == x[1]) x += 2;
+		if(0 == strncmp(x, etag, len)) {
+			char const c = x[len];
+			if('\0' == c || ',' == c || ' ' == c || '\t' == c) return true;
+		}
+		while('\0' != x[0] && ',' != x[0]) x++;
+	}
+}
+
+typedef struct {
+	uint64_t start;
+	uint64_t len;
+} byterange_t;
+
+// Returns the number of ranges, 0 if the header should be ignored
+// (malformed or too many ranges) or UV_ERANGE if none are satisfiable.
+static int parse_ranges(strarg_t const header, uint64_t const size, byterange_t *const ranges, size_t const max) {
+	if(!header) return 0;
+	if(0 != strncasecmp(header, "bytes=", 6)) return 0;
+	strarg_t x = header+6;
+	size_t count = 0;
+	bool any = false;
+	for(;;) {
+		while(' ' == x[0] || '\t' == x[0]) x++;
+		char *end = NULL;
+		uint64_t first = 0, last = UINT64_MAX;
+		bool suffix = false;
+		if('-' == x[0]) {
+			suffix = true;
+			x++;
+		} else {
+			if(x[0] < '0' || x[0] > '9') return 0;
+			first = strtoull(x, &end, 10);
+			x = end;
+			if('-' != x[0]) return 0;
+			x++;
+		}
+		if(x[0] >= '0' && x[0] <= '9') {
+			last = strtoull(x, &end, 10);
+			x = end;
+		} else if(suffix) {
+			return 0;
+		}
+		if(!suffix && last < first) return 0;
+		any = true;
+
+		if(suffix) {
+			// Last N bytes.
+			if(last > 0 && size > 0) {
+				if(count >= max) return 0;
+				uint64_t const n = MIN(last, size);
+				ranges[count++] = (byterange_t){ size-n, n };
+			}
+		} else if(first < size) {
+			if(count >= max) return 0;
+			uint64_t const end = MIN(last, size-1);
+			ranges[count++] = (byterange_t){ first, end-first+1 };
+		}
+
+		while(' ' == x[0] || '\t' == x[0]) x++;
+		if('\0' == x[0]) break;
+		if(',' != x[0]) return 0;
+		x++;
+	}
+	if(!any) return 0;
+	if(!count) return UV_ERANGE;
+	return count;
+}
+static int write_range(HTTPConnectionRef const conn, uv_file const file, byte_t *const buf, byterange_t const *const range) {
+	uint64_t pos = range->start;
+	uint64_t remaining = range->len;
+	while(remaining) {
+		uv_buf_t read[1] = { uv_buf_init((char *)buf, MIN(remaining, RANGE_BUF_SIZE)) };
+		ssize_t const len = async_fs_read(file, read, 1, pos);
+		if(len < 0) return (int)len;
+		if(0 == len) return UV_EOF; // File shrank?
+		uv_buf_t parts[] = { uv_buf_init((char *)buf, len) };
+		int rc = HTTPConnectionWritev(conn, parts, numberof(parts));
+		if(rc < 0) return rc;
+		pos += len;
+		remaining -= len;
+	}
+	return 0;
+}
+static int send_ranges(HTTPConnectionRef const conn, HTTPMethod const method, uv_file const file, SLNFileInfo const *const info, strarg_t const etag, byterange_t const *const ranges, size_t const count) {
+	assert(count > 0);
+	str_t boundary[16+1];
+	str_t **parts = NULL;
+	byte_t *buf = NULL;
+	int rc = 0;
+
+	uint64_t length = 0;
+	if(count > 1) {
+		byte_t bin[8];
+		rc = async_random(bin, sizeof(bin));
+		if(rc < 0) goto cleanup;
+		tohex(boundary, bin, sizeof(bin));
+		boundary[sizeof(boundary)-1] = '\0';
+
+		parts = calloc(count+1, sizeof(*parts));
+		if(!parts) rc = UV_ENOMEM;
+		if(rc < 0) goto cleanup;
+		for(size_t i = 0; i < count; i++) {
+			parts[i] = aasprintf("\r\n--%s\r\n"
+				"Content-Type: %s\r\n"
+				"Content-Range: bytes %llu-%llu/%llu\r\n"
+				"\r\n",
+				boundary, info->type,
+				(unsigned long long)ranges[i].start,
+				(unsigned long long)(ranges[i].start+ranges[i].len-1),
+				(unsigned long long)info->size);
+			if(!parts[i]) rc = UV_ENOMEM;
+			if(rc < 0) goto cleanup;
+			length += strlen(parts[i]) + ranges[i].len;
+		}
+		parts[count] = aasprintf("\r\n--%s--\r\n", boundary);
+		if(!parts[count]) rc = UV_ENOMEM;
+		if(rc < 0) goto cleanup;
+		length += strlen(parts[count]);
+	} else {
+		length = ranges[0].len;
+	}
+
+	buf = malloc(RANGE_BUF_SIZE);
+	if(!buf) rc = UV_ENOMEM;
+	if(rc < 0) goto cleanup;
+
+	HTTPConnectionWriteResponse(conn, 206, "Partial Content");
+	HTTPConnectionWriteContentLength(conn, length);
+	if(count > 1) {
+		str_t *type = aasprintf("multipart/byteranges; boundary=%s", boundary);
+		if(!type) rc = UV_ENOMEM;
+		if(rc < 0) goto cleanup;
+		HTTPConnectionWriteHeader(conn, "Content-Type", type);
+		FREE(&type);
+	} else {
+		str_t range[64];
+		snprintf(range, sizeof(range), "bytes %llu-%llu/%llu",
+			(unsigned long long)ranges[0].start,
+			(unsigned long long)(ranges[0].start+ranges[0].len-1),
+			(unsigned long long)info->size);
+		HTTPConnectionWriteHeader(conn, "Content-Range", range);
+		HTTPConnectionWriteHeader(conn, "Content-Type", info->type);
+	}
+	HTTPConnectionWriteHeader(conn, "Cache-Control", "max-age=31536000");
+	HTTPConnectionWriteHeader(conn, "ETag", etag);
+	HTTPConnectionWriteHeader(conn, "Accept-Ranges", "bytes");
+	HTTPConnectionWriteHeader(conn, "Content-Security-Policy", "'none'");
+	HTTPConnectionWriteHeader(conn, "X-Content-Type-Options", "nosniff");
+	HTTPConnectionBeginBody(conn);
+	// Like HTTPConnectionWriteFile, once the headers are out there's
+	// no way to report errors except by cutting the connection short.
+	if(HTTP_HEAD != method) {
+		for(size_t i = 0; i < count; i++) {
+			if(parts) {
+				uv_buf_t part[] = { uv_buf_init(parts[i], strlen(parts[i])) };
+				rc = HTTPConnectionWritev(conn, part, numberof(part));
+				if(rc < 0) break;
+			}
+			rc = write_range(conn, file, buf, &ranges[i]);
+			if(rc < 0) break;
+		}
+		if(rc >= 0 && parts) {
+			uv_buf_t part[] = { uv_buf_init(parts[count], strlen(parts[count])) };
+			rc = HTTPConnectionWritev(conn, part, numberof(part));
+		}
+	}
+	if(rc >= 0) HTTPConnectionEnd(conn);
+	if(rc < 0) alogf("Range response error: %s\n", sln_strerror(rc));
+	rc = 0;
+
+cleanup:
+	if(parts) for(size_t i = 0; i < count+1; i++) FREE(&parts[i]);
+	FREE(&parts);
+	FREE(&buf);
+	return rc;
+}
+
 static int GET_file(SLNRepoRef const repo, SLNSessionRef const session, HTTPConnectionRef const conn, HTTPMethod const method, strarg_t const URI, HTTPHeadersRef const headers) {
 	if(HTTP_GET != method && HTTP_HEAD != method) return -1;
 	int len = 0;
@@ -61,8 +251,6 @@ static int GET_file(SLNRepoRef const repo, SLNSessionRef const session, HTTPConn
 	if(!algo[0] || !hash[0]) return -1;
 	if('\0' != URI[len] && '?' != URI[len]) return -1;
 
-	// TODO: Check for conditional get headers and return 304 Not Modified.
-
 	str_t fileURI[SLN_URI_MAX];
 	int rc = snprintf(fileURI, sizeof(fileURI), "hash://%s/%s", algo, hash);
 	if(rc < 0 || rc >= sizeof(fileURI)) return 500;
@@ -73,6 +261,43 @@ static int GET_file(SLNRepoRef const repo, SLNSessionRef const session, HTTPConn
 	if(KVS_NOTFOUND == rc) return 404;
 	if(rc < 0) return 500;
 
+	// The internal hash identifies the content regardless of which
+	// URI was used to request it.
+	str_t etag[SLN_HASH_SIZE+2];
+	rc = snprintf(etag, sizeof(etag), "\"%s\"", info->hash);
+	if(rc < 0 || rc >= sizeof(etag)) {
+		SLNFileInfoCleanup(info);
+		return 500;
+	}
+	if(etag_match(HTTPHeadersGet(headers, "if-none-match"), etag)) {
+		HTTPConnectionWriteResponse(conn, 304, "Not Modified");
+		HTTPConnectionWriteHeader(conn, "Cache-Control", "max-age=31536000");
+		HTTPConnectionWriteHeader(conn, "ETag", etag);
+		HTTPConnectionBeginBody(conn);
+		HTTPConnectionEnd(conn);
+		SLNFileInfoCleanup(info);
+		return 0;
+	}
+
+	byterange_t ranges[RANGES_MAX];
+	int nranges = 0;
+	strarg_t const ifrange = HTTPHeadersGet(headers, "if-range");
+	// If-Range needs a strong match, so no weak tags and no "*".
+	if(!ifrange || 0 == strcmp(ifrange, etag)) {
+		nranges = parse_ranges(HTTPHeadersGet(headers, "range"), info->size, ranges, numberof(ranges));
+	}
+	if(UV_ERANGE == nranges) {
+		str_t range[64];
+		snprintf(range, sizeof(range), "bytes */%llu", (unsigned long long)info->size);
+		HTTPConnectionWriteResponse(conn, 416, "Requested Range Not Satisfiable");
+		HTTPConnectionWriteHeader(conn, "Content-Range", range);
+		HTTPConnectionWriteContentLength(conn, 0);
+		HTTPConnectionBeginBody(conn);
+		HTTPConnectionEnd(conn);
+		SLNFileInfoCleanup(info);
+		return 0;
+	}
+
 	uv_file file = async_fs_open(info->path, O_RDONLY, 0000);
 	if(UV_ENOENT == file) {
 		SLNFileInfoCleanup(info);
@@ -97,17 +322,22 @@ static int GET_file(SLNRepoRef const repo, SLNSessionRef const session, HTTPConn
 	// TODO: Use Content-Disposition to suggest a filename, for file types
 	// that aren't useful to view inline.
 
+	if(nranges > 0) {
+		rc = send_ranges(conn, method, file, info, etag, ranges, nranges);
+		SLNFileInfoCleanup(info);
+		async_fs_close(file);
+		if(rc < 0) return 500;
+		return 0;
+	}
+
 	HTTPConnectionWriteResponse(conn, 200, "OK");
 	HTTPConnectionWriteContentLength(conn, info->size);
 	HTTPConnectionWriteHeader(conn, "Content-Type", info->type);
 	HTTPConnectionWriteHeader(conn, "Cache-Control", "max-age=31536000");
-	HTTPConnectionWriteHeader(conn, "ETag", "1");
-//	HTTPConnectionWriteHeader(conn, "Accept-Ranges", "bytes"); // TODO
+	HTTPConnectionWriteHeader(conn, "ETag", etag);
+	HTTPConnectionWriteHeader(conn, "Accept-Ranges", "bytes");
 	HTTPConnectionWriteHeader(conn, "Content-Security-Policy", "'none'");
 	HTTPConnectionWriteHeader(conn, "X-Content-Type-Options", "nosniff");
-//	HTTPConnectionWriteHeader(conn, "Vary", "Accept, Accept-Ranges");
-	// TODO: Double check Vary header syntax.
-	// Also do we need to change the ETag?
 	HTTPConnectionBeginBody(conn);
 	if(HTTP_HEAD != method) {
 		HTTPConnectionWriteFile(conn, file);
@@ -278,6 +508,43 @@ static void sendURIList(SLNSessionRef const session, SLNFilterRef const filter,
 	HTTPConnectionEnd(conn);
 	SLNFilterPositionCleanup(pos);
 }
+static int sendCount(SLNSessionRef const session, SLNFilterRef const filter, strarg_t const qs, HTTPConnectionRef const conn, HTTPMethod const method) {
+	SLNFilterPosition pos[1] = {{ .dir = +1 }};
+	uint64_t max = UINT64_MAX;
+	SLNFilterParseOptions(qs, pos, &max, NULL, NULL);
+
+	static strarg_t const fields[] = { "estimate" };
+	str_t *values[numberof(fields)] = {};
+	QSValuesParse(qs, values, fields, numberof(fields));
+	bool const estimate = values[0] &&
+		0 != strcmp(values[0], "") &&
+		0 != strcmp(values[0], "0");
+	QSValuesCleanup(values, numberof(values));
+
+	uint64_t count = 0;
+	int rc = estimate ?
+		SLNFilterEstimateURIs(filter, session, pos, MIN(max, ESTIMATE_MAX), &count) :
+		SLNFilterCountURIs(filter, session, pos, max, &count);
+	SLNFilterPositionCleanup(pos);
+	if(KVS_EACCES == rc) return 403;
+	if(rc < 0) return 500;
+
+	str_t str[32];
+	int const len = snprintf(str, sizeof(str), "%llu\r\n", (unsigned long long)count);
+	assert(len > 0 && (size_t)len < sizeof(str));
+	HTTPConnectionWriteResponse(conn, 200, "OK");
+	HTTPConnectionWriteContentLength(conn, len);
+	HTTPConnectionWriteHeader(conn, "Content-Type", "text/plain; charset=utf-8");
+	HTTPConnectionWriteHeader(conn, "Cache-Control", "no-store");
+	if(estimate) HTTPConnectionWriteHeader(conn, "X-Estimate", "1");
+	HTTPConnectionBeginBody(conn);
+	if(HTTP_HEAD != method) {
+		uv_buf_t parts[] = { uv_buf_init(str, len) };
+		HTTPConnectionWritev(conn, parts, numberof(parts));
+	}
+	HTTPConnectionEnd(conn);
+	return 0;
+}
 static int parseFilter(SLNSessionRef const session, HTTPConnectionRef const conn, HTTPMethod const method, HTTPHeadersRef const headers, SLNFilterRef *const out) {
 	assert(HTTP_POST == method);
 	// TODO: Check Content-Type header for JSON.
@@ -334,6 +601,40 @@ static int POST_query(SLNRepoRef const repo, SLNSessionRef const session, HTTPCo
 	SLNFilterFree(&filter);
 	return 0;
 }
+static int GET_count(SLNRepoRef const repo, SLNSessionRef const session, HTTPConnectionRef const conn, HTTPMethod const method, strarg_t const URI, HTTPHeadersRef const headers) {
+	if(HTTP_GET != method && HTTP_HEAD != method) return -1;
+	strarg_t qs;
+	if(0 != uripathcmp("/sln/count", URI, &qs)) return -1;
+
+	SLNFilterRef filter = NULL;
+	int rc;
+
+	static strarg_t const fields[] = { "q" };
+	str_t *values[numberof(fields)] = {};
+	QSValuesParse(qs, values, fields, numberof(fields));
+	rc = SLNUserFilterParse(session, values[0], &filter);
+	QSValuesCleanup(values, numberof(values));
+	if(KVS_EINVAL == rc) rc = SLNFilterCreate(session, SLNVisibleFilterType, &filter);
+	if(KVS_EACCES == rc) return 403;
+	if(rc < 0) return 500;
+
+	rc = sendCount(session, filter, qs, conn, method);
+	SLNFilterFree(&filter);
+	return rc;
+}
+static int POST_count(SLNRepoRef const repo, SLNSessionRef const session, HTTPConnectionRef const conn, HTTPMethod const method, strarg_t const URI, HTTPHeadersRef const headers) {
+	if(HTTP_POST != method) return -1;
+	strarg_t qs;
+	if(0 != uripathcmp("/sln/count", URI, &qs)) return -1;
+
+	SLNFilterRef filter;
+	int rc = parseFilter(session, conn, method, headers, &filter);
+	if(KVS_EACCES == rc) return 403;
+	if(rc < 0) return 500;
+	rc = sendCount(session, filter, qs, conn, method);
+	SLNFilterFree(&filter);
+	return rc;
+}
 static int GET_metafiles(SLNRepoRef const repo, SLNSessionRef const session, HTTPConnectionRef const conn, HTTPMethod const method, strarg_t const URI, HTTPHeadersRef const headers) {
 	if(HTTP_GET != method && HTTP_HEAD != method) return -1;
 	strarg_t qs;
@@ -372,6 +673,8 @@ int SLNServerDispatch(SLNRepoRef const repo, SLNSessionRef const session, HTTPCo
 	rc = rc >= 0 ? rc : PUT_file(repo, session, conn, method, URI, headers);
 	rc = rc >= 0 ? rc : GET_query(repo, session, conn, method, URI, headers);
 	rc = rc >= 0 ? rc : POST_query(repo, session, conn, method, URI, headers);
+	rc = rc >= 0 ? rc : GET_count(repo, session, conn, method, URI, headers);
+	rc = rc >= 0 ? rc : POST_count(repo, session, conn, method, URI, headers);
 	rc = rc >= 0 ? rc : GET_metafiles(repo, session, conn, method, URI, headers);
 	rc = rc >= 0 ? rc : GET_all(repo, session, conn, method, URI, headers);
 	if(rc >= 0) return rc;
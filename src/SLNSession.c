@@ -17,6 +17,7 @@ struct SLNSession {
 	uint64_t sessionID;
 	byte_t *sessionKeyRaw;
 	byte_t *sessionKeyEnc;
+	byte_t *sessionKeyMemo; // atomic; raw key already checked against enc
 	uint64_t userID;
 	SLNMode mode;
 	str_t *username;
@@ -67,14 +68,14 @@ cleanup:
 SLNSessionRef SLNSessionRetain(SLNSessionRef const session) {
 	if(!session) return NULL;
 	assert(session->refcount);
-	session->refcount++;
+	__atomic_add_fetch(&session->refcount, 1, __ATOMIC_RELAXED);
 	return session;
 }
 void SLNSessionRelease(SLNSessionRef *const sessionptr) {
 	SLNSessionRef session = *sessionptr;
 	if(!session) return;
 	assert(session->refcount);
-	if(--session->refcount) {
+	if(__atomic_sub_fetch(&session->refcount, 1, __ATOMIC_ACQ_REL)) {
 		*sessionptr = NULL;
 		return;
 	}
@@ -82,6 +83,7 @@ void SLNSessionRelease(SLNSessionRef *const sessionptr) {
 	session->sessionID = 0;
 	FREE(&session->sessionKeyRaw);
 	FREE(&session->sessionKeyEnc);
+	FREE(&session->sessionKeyMemo);
 	session->userID = 0;
 	session->mode = 0;
 	FREE(&session->username);
@@ -111,10 +113,47 @@ int SLNSessionKeyValid(SLNSessionRef const session, byte_t const *const enc) {
 	if(0 != memcmp(enc, session->sessionKeyEnc, SESSION_KEY_LEN)) return UV_EACCES;
 	return 0;
 }
+static bool key_equal(byte_t const *const a, byte_t const *const b) {
+	// Raw keys are secret, so unlike hashes they need constant-time comparison.
+	byte_t x = 0;
+	for(size_t i = 0; i < SESSION_KEY_LEN; i++) x |= a[i] ^ b[i];
+	return 0 == x;
+}
+int SLNSessionKeyValidRaw(SLNSessionRef const session, byte_t const *const raw) {
+	if(!session) return UV_EINVAL;
+	if(!raw) return UV_EINVAL;
+	if(session->sessionKeyRaw) {
+		if(!key_equal(raw, session->sessionKeyRaw)) return UV_EACCES;
+		return 0;
+	}
+	byte_t const *const memo = __atomic_load_n(&session->sessionKeyMemo, __ATOMIC_ACQUIRE);
+	if(memo && key_equal(raw, memo)) return 0;
+
+	byte_t enc[SHA256_DIGEST_LENGTH];
+	SHA256(raw, SESSION_KEY_LEN, enc);
+	int rc = SLNSessionKeyValid(session, enc);
+	if(rc < 0) return rc;
+
+	// Remember the first raw key that verifies. It lives and dies with
+	// this session object, so it goes away when the cache drops the entry.
+	if(memo) return 0;
+	byte_t *copy = malloc(SESSION_KEY_LEN);
+	if(!copy) return 0;
+	memcpy(copy, raw, SESSION_KEY_LEN);
+	byte_t *expected = NULL;
+	if(!__atomic_compare_exchange_n(&session->sessionKeyMemo, &expected, copy, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+		FREE(&copy);
+	}
+	return 0;
+}
 uint64_t SLNSessionGetUserID(SLNSessionRef const session) {
 	if(!session) return -1;
 	return session->userID;
 }
+SLNMode SLNSessionGetMode(SLNSessionRef const session) {
+	if(!session) return 0;
+	return session->mode;
+}
 bool SLNSessionHasPermission(SLNSessionRef const session, SLNMode const mask) {
 	if(!session) return false;
 	return (mask & session->mode) == mask;
@@ -184,16 +223,28 @@ int SLNSessionCreateUserInternal(SLNSessionRef const session, KVS_txn *const txn
 
 	return 0;
 }
+typedef struct {
+	uint64_t userID;
+	strarg_t key_str;
+	uint64_t sessionID;
+} session_commit;
+static int create_session_cb(void *const ctx, KVS_txn *const txn, uint64_t *const sortID) {
+	session_commit *const s = ctx;
+	s->sessionID = kvs_next_id(SLNSessionByID, txn);
+	KVS_val key[1], val[1];
+	SLNSessionByIDKeyPack(key, txn, s->sessionID);
+	SLNSessionByIDValPack(val, txn, s->userID, s->key_str);
+	return kvs_put(txn, key, val, KVS_NOOVERWRITE_FAST);
+}
 int SLNSessionCreateSession(SLNSessionRef const session, SLNSessionRef *const out) {
 	assert(out);
 	if(!session) return KVS_EACCES;
+	if(!SLNSessionHasPermission(session, SLN_RDWR)) return KVS_EACCES; // TODO: Custom permission?
 
 	SLNSessionCacheRef const cache = session->cache;
 	uint64_t const userID = session->userID;
 	SLNMode const mode = session->mode;
 	strarg_t const username = session->username;
-	KVS_env *db = NULL;
-	KVS_txn *txn = NULL;
 	SLNSessionRef alt = NULL;
 
 	byte_t key_raw[SESSION_KEY_LEN];
@@ -207,30 +258,16 @@ int SLNSessionCreateSession(SLNSessionRef const session, SLNSessionRef *const ou
 	tohex(key_str, key_enc, SESSION_KEY_LEN);
 	key_str[SESSION_KEY_HEX] = '\0';
 
-	rc = SLNSessionDBOpen(session, SLN_RDWR, &db); // TODO: Custom permission?
-	if(rc < 0) goto cleanup;
-	rc = kvs_txn_begin(db, NULL, KVS_RDWR, &txn);
+	session_commit commit[1] = {{ userID, key_str, 0 }};
+	rc = SLNRepoCommit(SLNSessionGetRepo(session), create_session_cb, commit);
 	if(rc < 0) goto cleanup;
 
-	uint64_t const sessionID = kvs_next_id(SLNSessionByID, txn);
-	KVS_val key[1], val[1];
-	SLNSessionByIDKeyPack(key, txn, sessionID);
-	SLNSessionByIDValPack(val, txn, userID, key_str);
-	rc = kvs_put(txn, key, val, KVS_NOOVERWRITE_FAST);
-	if(rc < 0) goto cleanup;
-
-	rc = kvs_txn_commit(txn); txn = NULL;
-	SLNSessionDBClose(session, &db);
-	if(rc < 0) goto cleanup;
-
-	rc = SLNSessionCreateInternal(cache, sessionID, key_raw, key_enc, userID, mode, username, &alt);
+	rc = SLNSessionCreateInternal(cache, commit->sessionID, key_raw, key_enc, userID, mode, username, &alt);
 	if(rc < 0) goto cleanup;
 
 	*out = alt; alt = NULL;
 
 cleanup:
-	kvs_txn_abort(txn); txn = NULL;
-	SLNSessionDBClose(session, &db);
 	SLNSessionRelease(&alt);
 	return rc;
 }
@@ -238,29 +275,30 @@ cleanup:
 int SLNSessionGetFileInfo(SLNSessionRef const session, strarg_t const URI, SLNFileInfo *const info) {
 	KVS_env *db = NULL;
 	KVS_txn *txn = NULL;
-	KVS_cursor *cursor = NULL;
 	int rc;
 
 	rc = SLNSessionDBOpen(session, SLN_RDONLY, &db);
 	if(rc < 0) goto cleanup;
 	rc = kvs_txn_begin(db, NULL, KVS_RDONLY, &txn);
 	if(rc < 0) goto cleanup;
-	rc = kvs_txn_cursor(txn, &cursor);
-	if(rc < 0) goto cleanup;
+	rc = SLNSessionGetFileInfoTxn(session, txn, URI, info);
 
+cleanup:
+	kvs_txn_abort(txn); txn = NULL;
+	SLNSessionDBClose(session, &db);
+	return rc;
+}
+int SLNSessionGetFileInfoTxn(SLNSessionRef const session, KVS_txn *const txn, strarg_t const URI, SLNFileInfo *const info) {
 	uint64_t fileID = 0;
 	KVS_val file_val[1];
-	rc = SLNURIGetFileID(URI, txn, &fileID);
-	if(rc < 0) goto cleanup;
-	if(!info) {
-		rc = 0;
-		goto cleanup;
-	}
+	int rc = SLNURIGetFileID(URI, txn, &fileID);
+	if(rc < 0) return rc;
+	if(!info) return 0;
 
 	KVS_val fileID_key[1];
 	SLNFileByIDKeyPack(fileID_key, txn, fileID);
 	rc = kvs_get(txn, fileID_key, file_val);
-	if(rc < 0) goto cleanup;
+	if(rc < 0) return rc;
 	strarg_t const internalHash = kvs_read_string(file_val, txn);
 	strarg_t const type = kvs_read_string(file_val, txn);
 	uint64_t const size = kvs_read_uint64(file_val);
@@ -273,15 +311,9 @@ int SLNSessionGetFileInfo(SLNSessionRef const session, strarg_t const URI, SLNFi
 	info->size = size;
 	if(!info->hash || !info->path || !info->type) {
 		SLNFileInfoCleanup(info);
-		rc = KVS_ENOMEM;
-		goto cleanup;
+		return KVS_ENOMEM;
 	}
-
-cleanup:
-	cursor = NULL; // txn-cursor doesn't need to be closed.
-	kvs_txn_abort(txn); txn = NULL;
-	SLNSessionDBClose(session, &db);
-	return rc;
+	return 0;
 }
 void SLNFileInfoCleanup(SLNFileInfo *const info) {
 	if(!info) return;
@@ -334,4 +366,47 @@ done:
 	kvs_cursor_close(metafiles); metafiles = NULL;
 	return rc;
 }
+int SLNSessionGetFieldsForFile(SLNSessionRef const session, KVS_txn *const txn, strarg_t const fileURI, SLNFieldValueCB const cb, void *const ctx) {
+	// Visits every field/value of every meta-file for fileURI in a single
+	// pass, in meta-file order. Empty values are skipped.
+	int rc = 0;
+	KVS_cursor *metafiles = NULL;
+	KVS_cursor *values = NULL;
+
+	rc = kvs_cursor_open(txn, &metafiles);
+	if(rc < 0) goto done;
+	rc = kvs_cursor_open(txn, &values);
+	if(rc < 0) goto done;
+
+	KVS_range metaFileIDs[1];
+	SLNTargetURIAndMetaFileIDRange1(metaFileIDs, txn, fileURI);
+	KVS_val metaFileID_key[1];
+	rc = kvs_cursor_firstr(metafiles, metaFileIDs, metaFileID_key, NULL, +1);
+	for(; rc >= 0; rc = kvs_cursor_nextr(metafiles, metaFileIDs, metaFileID_key, NULL, +1)) {
+		strarg_t u;
+		uint64_t metaFileID;
+		SLNTargetURIAndMetaFileIDKeyUnpack(metaFileID_key, txn, &u, &metaFileID);
+		assert(0 == strcmp(fileURI, u));
+		KVS_range vrange[1];
+		SLNMetaFileIDFieldAndValueRange1(vrange, txn, metaFileID);
+		KVS_val value_val[1];
+		rc = kvs_cursor_firstr(values, vrange, value_val, NULL, +1);
+		for(; rc >= 0; rc = kvs_cursor_nextr(values, vrange, value_val, NULL, +1)) {
+			uint64_t m;
+			strarg_t f, v;
+			SLNMetaFileIDFieldAndValueKeyUnpack(value_val, txn, &m, &f, &v);
+			assert(metaFileID == m);
+			if(!f || !v || '\0' == v[0]) continue;
+			rc = cb(ctx, f, v);
+			if(rc < 0) goto done;
+		}
+		if(KVS_NOTFOUND != rc) goto done;
+	}
+	if(KVS_NOTFOUND == rc) rc = 0;
+
+done:
+	kvs_cursor_close(values); values = NULL;
+	kvs_cursor_close(metafiles); metafiles = NULL;
+	return rc;
+}
 
@@ -2,6 +2,7 @@
 // MIT licensed (see LICENSE for details)
 
 #include <assert.h>
+#include <sched.h>
 #include <openssl/sha.h>
 #include "../deps/smhasher/MurmurHash3.h"
 #include "util/pass.h"
@@ -15,21 +16,24 @@
 
 uint32_t SLNSeed = 0;
 
+// Slots are published with atomic pointer swaps so lookups never take a
+// lock. A lookup pins its slot while it loads and retains the session,
+// and whoever swaps a session out waits for the pins to drain before
+// releasing it. The ids array is only a hint for probing; the session's
+// own ID is always re-checked once we hold a reference.
 struct SLNSessionCache {
 	SLNRepoRef repo;
 	SLNSessionRef public;
 
-	async_mutex_t lock[1];
 	uint16_t size;
-	uint16_t pos;
 	uint64_t *ids;
 	SLNSessionRef *sessions;
-	uv_timer_t timer[1];
+	uint32_t *pins;
 	uint64_t *timeouts;
-	uint16_t *active;
+	uv_timer_t timer[1];
 };
 
-
+static void sweep(uv_timer_t *const timer);
 
 int SLNSessionCacheCreate(SLNRepoRef const repo, uint16_t const size, SLNSessionCacheRef *const out) {
 	if(!repo) return UV_EINVAL;
@@ -46,20 +50,18 @@ int SLNSessionCacheCreate(SLNRepoRef const repo, uint16_t const size, SLNSession
 		if(rc < 0) goto cleanup;
 	}
 
-	async_mutex_init(cache->lock, 0);
 	cache->size = size;
-	cache->ids = calloc(size, sizeof(uint64_t));
+	cache->ids = calloc(size, sizeof(*cache->ids));
 	cache->sessions = calloc(size, sizeof(*cache->sessions));
-	if(!cache->ids || !cache->sessions) rc = UV_ENOMEM;
+	cache->pins = calloc(size, sizeof(*cache->pins));
+	cache->timeouts = calloc(size, sizeof(*cache->timeouts));
+	if(!cache->ids || !cache->sessions || !cache->pins || !cache->timeouts) rc = UV_ENOMEM;
 	if(rc < 0) goto cleanup;
 
 	cache->timer->data = cache;
 	uv_timer_init(async_loop, cache->timer);
-	cache->timeouts = calloc(size, sizeof(*cache->timeouts));
-	cache->active = calloc(size, sizeof(*cache->active));
-	cache->pos = 0;
-	if(!cache->timeouts || !cache->active) rc = UV_ENOMEM;
-	if(rc < 0) goto cleanup;
+	uv_timer_start(cache->timer, sweep, SWEEP_DELAY, SWEEP_DELAY);
+	uv_unref((uv_handle_t *)cache->timer);
 
 	*out = cache; cache = NULL;
 cleanup:
@@ -73,20 +75,25 @@ void SLNSessionCacheFree(SLNSessionCacheRef *const cacheptr) {
 	cache->repo = NULL;
 	SLNSessionRelease(&cache->public);
 
-	async_mutex_destroy(cache->lock);
-	FREE(&cache->ids);
-	for(uint16_t i = 0; i < cache->size; i++) {
-		SLNSessionRelease(&cache->sessions[i]);
+	if(cache->timer->data) {
+		uv_timer_stop(cache->timer);
+		async_close((uv_handle_t *)cache->timer);
+		cache->timer->data = NULL;
 	}
-	assert_zeroed(cache->sessions, cache->size);
-	FREE(&cache->sessions);
-	cache->size = 0;
 
-	async_close((uv_handle_t *)cache->timer);
+	if(cache->sessions) {
+		for(uint16_t i = 0; i < cache->size; i++) {
+			SLNSessionRelease(&cache->sessions[i]);
+		}
+		assert_zeroed(cache->sessions, cache->size);
+		FREE(&cache->sessions);
+	}
+	FREE(&cache->ids);
+	FREE(&cache->pins);
 	FREE(&cache->timeouts);
-	FREE(&cache->active);
-	cache->pos = 0;
+	cache->size = 0;
 
+	memset(cache->timer, 0, sizeof(cache->timer));
 	assert_zeroed(cache, 1);
 	FREE(cacheptr); cache = NULL;
 }
@@ -101,23 +108,77 @@ static uint16_t session_pos(SLNSessionCacheRef const cache, uint64_t const sessi
 	MurmurHash3_x86_32(&sessionID, sizeof(sessionID), SLNSeed, &hash);
 	return hash % cache->size;
 }
+
+// Returns our own reference to whatever is in the slot, if anything.
+// The slot stays filled, so concurrent lookups for the same ID all hit.
+// The pin and the pointer are both sequentially consistent, so either
+// slot_swap() sees our pin or we see what it swapped in.
+static SLNSessionRef slot_retain(SLNSessionCacheRef const cache, uint16_t const x) {
+	__atomic_add_fetch(&cache->pins[x], 1, __ATOMIC_SEQ_CST);
+	SLNSessionRef const session = __atomic_load_n(&cache->sessions[x], __ATOMIC_SEQ_CST);
+	SLNSessionRef const ref = SLNSessionRetain(session);
+	__atomic_sub_fetch(&cache->pins[x], 1, __ATOMIC_RELEASE);
+	return ref;
+}
+// Puts session (which may be NULL) in the slot and releases the old one
+// once no lookup could still be about to retain it. Pins only last for
+// a few instructions, so spinning is fine.
+static void slot_swap(SLNSessionCacheRef const cache, uint16_t const x, SLNSessionRef const session) {
+	SLNSessionRef old = __atomic_exchange_n(&cache->sessions[x], session, __ATOMIC_SEQ_CST);
+	if(!old) return;
+	while(__atomic_load_n(&cache->pins[x], __ATOMIC_SEQ_CST)) sched_yield();
+	SLNSessionRelease(&old);
+}
+static void slot_touch(SLNSessionCacheRef const cache, uint16_t const x) {
+	uint64_t const timeout = uv_now(async_loop) + EXPIRE_TIMEOUT;
+	__atomic_store_n(&cache->timeouts[x], timeout, __ATOMIC_RELAXED);
+}
+
 static void session_cache(SLNSessionCacheRef const cache, SLNSessionRef const session) {
 	uint64_t const id = SLNSessionGetID(session);
+	if(!id) return;
 	uint16_t const pos = session_pos(cache, id);
-	uint16_t i = pos;
-//	for(; i < pos+SEARCH_DIST; i++) {
+	uint16_t victim = pos;
+	uint64_t oldest = UINT64_MAX;
+	for(unsigned i = pos; i < pos+SEARCH_DIST; i++) {
 		uint16_t const x = i % cache->size;
-		if(id == cache->ids[x]) return;
-//		if(0 != cache->ids[x]) continue; // TODO: Hack to work without session expiration.
-		cache->ids[x] = id;
-		SLNSessionRelease(&cache->sessions[x]);
-		cache->sessions[x] = SLNSessionRetain(session);
-		cache->active[cache->pos] = x;
-		cache->timeouts[cache->pos] = uv_now(async_loop) + EXPIRE_TIMEOUT;
-//		cache->pos++; // TODO: Is this a ring buffer?
-		// TODO: Start timer if necessary.
-		return;
-//	}
+		if(id == __atomic_load_n(&cache->ids[x], __ATOMIC_ACQUIRE) &&
+			__atomic_load_n(&cache->sessions[x], __ATOMIC_ACQUIRE))
+		{
+			slot_touch(cache, x);
+			return;
+		}
+	}
+
+	SLNSessionRef ref = SLNSessionRetain(session);
+	for(unsigned i = pos; i < pos+SEARCH_DIST; i++) {
+		uint16_t const x = i % cache->size;
+		SLNSessionRef expected = NULL;
+		if(__atomic_compare_exchange_n(&cache->sessions[x], &expected, ref, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+			__atomic_store_n(&cache->ids[x], id, __ATOMIC_RELEASE);
+			slot_touch(cache, x);
+			return;
+		}
+		uint64_t const t = __atomic_load_n(&cache->timeouts[x], __ATOMIC_RELAXED);
+		if(t < oldest) {
+			oldest = t;
+			victim = x;
+		}
+	}
+
+	// Every slot in range is taken; evict the one closest to expiring.
+	slot_swap(cache, victim, ref);
+	__atomic_store_n(&cache->ids[victim], id, __ATOMIC_RELEASE);
+	slot_touch(cache, victim);
+}
+static void sweep(uv_timer_t *const timer) {
+	SLNSessionCacheRef const cache = timer->data;
+	uint64_t const now = uv_now(async_loop);
+	for(uint16_t x = 0; x < cache->size; x++) {
+		if(!__atomic_load_n(&cache->sessions[x], __ATOMIC_ACQUIRE)) continue;
+		if(__atomic_load_n(&cache->timeouts[x], __ATOMIC_RELAXED) > now) continue;
+		slot_swap(cache, x, NULL);
+	}
 }
 
 int SLNSessionCacheCreateSession(SLNSessionCacheRef const cache, strarg_t const username, strarg_t const password, SLNSessionRef *const out) {
@@ -181,7 +242,7 @@ cleanup:
 
 
 
-static int cookie_parse(strarg_t const cookie, uint64_t *const sessionID, byte_t sessionKey[SESSION_KEY_LEN]) {
+static int cookie_parse(strarg_t const cookie, uint64_t *const sessionID, byte_t key_raw[SESSION_KEY_LEN]) {
 	unsigned long long id = 0;
 	str_t key_str[SESSION_KEY_HEX+1];
 	key_str[0] = '\0';
@@ -189,24 +250,29 @@ static int cookie_parse(strarg_t const cookie, uint64_t *const sessionID, byte_t
 	if(0 == id) return KVS_EINVAL;
 	if(strlen(key_str) != SESSION_KEY_HEX) return KVS_EINVAL;
 	*sessionID = (uint64_t)id;
-	byte_t key_raw[SESSION_KEY_LEN];
 	tobin(key_raw, key_str, SESSION_KEY_HEX);
-	byte_t key_enc[SHA256_DIGEST_LENGTH];
-	SHA256(key_raw, SESSION_KEY_LEN, key_enc);
-	memcpy(sessionKey, key_enc, SESSION_KEY_LEN);
 	return 0;
 }
-static int session_lookup(SLNSessionCacheRef const cache, uint64_t const id, byte_t const key[SESSION_KEY_LEN], SLNSessionRef *const out) {
+static int session_lookup(SLNSessionCacheRef const cache, uint64_t const id, byte_t const key_raw[SESSION_KEY_LEN], SLNSessionRef *const out) {
 	uint16_t const pos = session_pos(cache, id);
-	// TODO: Locking (not really necessary but just good practice).
-	for(uint16_t i = pos; i < pos+SEARCH_DIST; i++) {
+	for(unsigned i = pos; i < pos+SEARCH_DIST; i++) {
 		uint16_t const x = i % cache->size;
-		if(id != cache->ids[x]) continue;
-		SLNSessionRef const s = cache->sessions[x];
-		int rc = SLNSessionKeyValid(s, key);
-		if(rc < 0) return rc;
-		*out = SLNSessionRetain(s);
-		return 0;
+		if(id != __atomic_load_n(&cache->ids[x], __ATOMIC_ACQUIRE)) continue;
+		SLNSessionRef s = slot_retain(cache, x);
+		if(!s) continue;
+		if(id != SLNSessionGetID(s)) {
+			// Torn hint: the slot was reused between our two loads.
+			SLNSessionRelease(&s);
+			continue;
+		}
+		// Repeat requests with the same cookie skip hashing the key.
+		int rc = SLNSessionKeyValidRaw(s, key_raw);
+		if(rc >= 0) {
+			*out = s; s = NULL;
+			slot_touch(cache, x);
+		}
+		SLNSessionRelease(&s);
+		return rc;
 	}
 	return KVS_NOTFOUND;
 }
@@ -295,15 +361,15 @@ int SLNSessionCacheCopyActiveSession(SLNSessionCacheRef const cache, strarg_t co
 	}
 
 	uint64_t sessionID;
-	byte_t sessionKey[SESSION_KEY_LEN];
-	int rc = cookie_parse(cookie, &sessionID, sessionKey);
+	byte_t key_raw[SESSION_KEY_LEN];
+	int rc = cookie_parse(cookie, &sessionID, key_raw);
 	if(rc < 0) {
 		*out = SLNSessionRetain(cache->public);
 		return 0;
 	}
 
 	SLNSessionRef session = NULL;
-	rc = session_lookup(cache, sessionID, sessionKey, &session);
+	rc = session_lookup(cache, sessionID, key_raw, &session);
 	if(rc >= 0) {
 		*out = session; session = NULL;
 		return 0;
@@ -317,7 +383,9 @@ int SLNSessionCacheCopyActiveSession(SLNSessionCacheRef const cache, strarg_t co
 		return rc;
 	}
 
-	rc = SLNSessionCacheLoadSession(cache, sessionID, sessionKey, &session);
+	byte_t key_enc[SHA256_DIGEST_LENGTH];
+	SHA256(key_raw, SESSION_KEY_LEN, key_enc);
+	rc = SLNSessionCacheLoadSession(cache, sessionID, key_enc, &session);
 	if(rc >= 0) {
 		*out = session; session = NULL;
 		return 0;
@@ -145,21 +145,62 @@ uint64_t SLNSubmissionGetFileID(SLNSubmissionRef const sub) {
 	return sub->fileID;
 }
 
+
+// Small writes (e.g. from the meta-file generator) aren't worth a fiber.
+#define PIPELINE_MIN (1024 * 16)
+
+typedef struct {
+	uv_file file;
+	byte_t const *buf;
+	size_t len;
+	async_sem_t *done;
+	int rc;
+} write_work;
+
+static void write_chunk(void *const arg) {
+	write_work *const work = arg;
+	uv_buf_t parts[] = { uv_buf_init((char *)work->buf, work->len) };
+	work->rc = async_fs_writeall(work->file, parts, numberof(parts), -1);
+	async_sem_post(work->done);
+}
+// Must be called from a fiber on the loop, not from inside
+// async_pool_enter(), since both the write and the hasher spawn fibers.
 int SLNSubmissionWrite(SLNSubmissionRef const sub, byte_t const *const buf, size_t const len) {
 	if(!sub) return 0;
 	assert(sub->tmpfile >= 0);
 	assert(sub->type);
 	assert(sub->hasher);
 
-	uv_buf_t parts[] = { uv_buf_init((char *)buf, len) };
-	int rc = async_fs_writeall(sub->tmpfile, parts, numberof(parts), -1);
+	// The hasher never modifies the buffer, so the disk write and the
+	// hashing can share it. Both have to finish before we return since
+	// the caller owns the buffer after that.
+	async_sem_t done[1];
+	async_sem_init(done, 0, 0);
+	write_work work = {
+		.file = sub->tmpfile,
+		.buf = buf,
+		.len = len,
+		.done = done,
+		.rc = 0,
+	};
+	int rc = len < PIPELINE_MIN ? -1 : async_spawn(STACK_DEFAULT, write_chunk, &work);
+	if(rc < 0) {
+		write_chunk(&work);
+		async_sem_wait(done);
+		rc = work.rc;
+		if(rc >= 0) rc = SLNHasherWrite(sub->hasher, buf, len);
+	} else {
+		rc = SLNHasherWrite(sub->hasher, buf, len);
+		async_sem_wait(done);
+		rc = work.rc < 0 ? work.rc : rc;
+	}
+	async_sem_destroy(done);
 	if(rc < 0) {
 		alogf("SLNSubmission write error: %s\n", sln_strerror(rc));
 		return rc;
 	}
 
 	sub->size += len;
-	SLNHasherWrite(sub->hasher, buf, len);
 	return 0;
 }
 static int verify(SLNSubmissionRef const sub) {
@@ -286,6 +327,16 @@ int SLNSubmissionStore(SLNSubmissionRef const sub, KVS_txn *const txn) {
 		SLNFileByIDValPack(file_val, txn, sub->internalHash, sub->type, sub->size);
 		rc = kvs_put(txn, fileID_key, file_val, KVS_NOOVERWRITE_FAST);
 		if(rc < 0) return rc;
+
+		str_t *type = SLNFileTypeNormalize(sub->type);
+		if(!type) return KVS_ENOMEM;
+		KVS_val type_key[1];
+		KVS_val null[1];
+		SLNFileIDByTypeKeyPack(type_key, txn, type, fileID);
+		kvs_nullval(null);
+		rc = kvs_put(txn, type_key, null, KVS_NOOVERWRITE_FAST);
+		FREE(&type);
+		if(rc < 0) return rc;
 	} else if(KVS_KEYEXIST == rc) {
 		fileID = kvs_read_uint64(dupFileID_val);
 	} else return rc;
@@ -327,36 +378,34 @@ int SLNSubmissionStore(SLNSubmissionRef const sub, KVS_txn *const txn) {
 
 	return 0;
 }
+typedef struct {
+	SLNSubmissionRef const *list;
+	size_t count;
+} store_batch;
+
+static int store_batch_cb(void *const ctx, KVS_txn *const txn, uint64_t *const sortID) {
+	store_batch const *const batch = ctx;
+	int rc = 0; // A batch of nothing but NULLs is fine.
+	for(size_t i = 0; i < batch->count; i++) {
+		if(!batch->list[i]) continue;
+		rc = SLNSubmissionStore(batch->list[i], txn);
+		if(rc < 0) break;
+		*sortID = MAX(*sortID, SLNSubmissionGetFileID(batch->list[i]));
+	}
+	return rc;
+}
 int SLNSubmissionStoreBatch(SLNSubmissionRef const *const list, size_t const count) {
 	if(!count) return 0;
 
 	SLNSessionRef const session = list[0]->session;
 	SLNRepoRef const repo = SLNSessionGetRepo(session);
-	KVS_env *db = NULL;
-	int rc = SLNSessionDBOpen(session, SLN_WRONLY, &db);
-	if(rc < 0) return rc;
-	KVS_txn *txn = NULL;
-	rc = kvs_txn_begin(db, NULL, KVS_RDWR, &txn);
-	if(rc < 0) {
-		SLNSessionDBClose(session, &db);
-		return rc;
-	}
-	uint64_t sortID = 0;
-	rc = KVS_NOTFOUND;
+	if(!SLNSessionHasPermission(session, SLN_WRONLY)) return KVS_EACCES;
 	for(size_t i = 0; i < count; i++) {
 		if(!list[i]) continue;
 		assert(repo == SLNSessionGetRepo(list[i]->session));
-		rc = SLNSubmissionStore(list[i], txn);
-		if(rc < 0) break;
-		sortID = MAX(sortID, SLNSubmissionGetFileID(list[i]));
-	}
-	if(rc >= 0) {
-		rc = kvs_txn_commit(txn); txn = NULL;
-	} else {
-		kvs_txn_abort(txn); txn = NULL;
 	}
-	SLNSessionDBClose(session, &db);
-	if(rc >= 0) SLNRepoSubmissionEmit(repo, sortID);
-	return rc;
+	// Concurrent batches get folded into a shared commit.
+	store_batch batch[1] = {{ list, count }};
+	return SLNRepoCommit(repo, store_batch_cb, batch);
 }
 
@@ -18,14 +18,16 @@ typedef struct {
 	strarg_t targetURI;
 	str_t *fields[DEPTH_MAX];
 	int depth;
+	uint64_t termpos; // Next full-text position.
+	int rc; // Set when a callback fails for a reason besides bad JSON.
 } parser_t;
 
 static yajl_callbacks const callbacks;
 
 // TODO: Error handling.
 static int add_metafile(KVS_txn *const txn, uint64_t const metaFileID, strarg_t const targetURI);
-static void add_metadata(KVS_txn *const txn, uint64_t const metaFileID, strarg_t const field, strarg_t const value);
-static void add_fulltext(KVS_txn *const txn, uint64_t const metaFileID, strarg_t const str, size_t const len);
+static int add_metadata(KVS_txn *const txn, uint64_t const metaFileID, strarg_t const field, strarg_t const value);
+static void add_fulltext(KVS_txn *const txn, uint64_t const metaFileID, strarg_t const str, size_t const len, uint64_t *const termpos);
 
 
 int SLNSubmissionParseMetaFile(SLNSubmissionRef const sub, uint64_t const fileID, KVS_txn *const txn, uint64_t *const out) {
@@ -141,7 +143,7 @@ int SLNSubmissionParseMetaFile(SLNSubmissionRef const sub, uint64_t const fileID
 			FREE(&ctx->fields[i]);
 		}
 		ctx->depth = -1;
-		rc = KVS_EIO;
+		rc = ctx->rc < 0 ? ctx->rc : KVS_EIO;
 		goto cleanup;
 	}
 
@@ -170,12 +172,16 @@ static int yajl_map_key(parser_t *const ctx, strarg_t const key, size_t const le
 		strarg_t const field = ctx->fields[ctx->depth-1];
 		assert(field);
 		if(0 == strcmp("fulltext", field)) {
-			add_fulltext(ctx->txn, ctx->metaFileID, key, len);
+			add_fulltext(ctx->txn, ctx->metaFileID, key, len, &ctx->termpos);
 		} else {
 			str_t *x = strndup(key, len);
-			if(!x) return false;
-			add_metadata(ctx->txn, ctx->metaFileID, field, x);
+			int rc = x ? 0 : KVS_ENOMEM;
+			if(rc >= 0) rc = add_metadata(ctx->txn, ctx->metaFileID, field, x);
 			FREE(&x);
+			if(rc < 0) {
+				ctx->rc = rc;
+				return false;
+			}
 		}
 	}
 	if(ctx->depth < DEPTH_MAX) {
@@ -278,11 +284,11 @@ static int add_metafile(KVS_txn *const txn, uint64_t const metaFileID, strarg_t
 
 	return 0;
 }
-static void add_metadata(KVS_txn *const txn, uint64_t const metaFileID, strarg_t const field, strarg_t const value) {
+static int add_metadata(KVS_txn *const txn, uint64_t const metaFileID, strarg_t const field, strarg_t const value) {
 	assert(metaFileID);
 	assert(field);
 	assert(value);
-	if('\0' == value[0]) return;
+	if('\0' == value[0]) return 0;
 
 	KVS_val null = { 0, NULL };
 	int rc;
@@ -296,9 +302,25 @@ static void add_metadata(KVS_txn *const txn, uint64_t const metaFileID, strarg_t
 	SLNFieldValueAndMetaFileIDKeyPack(rev, txn, field, value, metaFileID);
 	rc = kvs_put(txn, rev, &null, KVS_NOOVERWRITE_FAST);
 	assertf(rc >= 0 || KVS_KEYEXIST == rc, "Database error %s", sln_strerror(rc));
+
+	str_t *ffield = SLNStringFold(field, strlen(field));
+	str_t *fvalue = SLNStringFold(value, strlen(value));
+	if(!ffield || !fvalue) {
+		FREE(&ffield);
+		FREE(&fvalue);
+		return KVS_ENOMEM;
+	}
+	KVS_val folded[1];
+	SLNFoldedFieldValueAndMetaFileIDKeyPack(folded, txn, ffield, fvalue, metaFileID);
+	rc = kvs_put(txn, folded, &null, KVS_NOOVERWRITE_FAST);
+	assertf(rc >= 0 || KVS_KEYEXIST == rc, "Database error %s", sln_strerror(rc));
+	FREE(&ffield);
+	FREE(&fvalue);
+	return 0;
 }
-static void add_fulltext(KVS_txn *const txn, uint64_t const metaFileID, strarg_t const str, size_t const len) {
+static void add_fulltext(KVS_txn *const txn, uint64_t const metaFileID, strarg_t const str, size_t const len, uint64_t *const termpos) {
 	assert(metaFileID);
+	assert(termpos);
 
 	if(0 == len) return;
 	assert(str);
@@ -317,22 +339,27 @@ static void add_fulltext(KVS_txn *const txn, uint64_t const metaFileID, strarg_t
 	rc = kvs_cursor_open(txn, &cursor);
 	assert(rc >= 0);
 
+	// Positions are per meta-file rather than per string, so that
+	// several fulltext strings in one meta-file don't overlap.
+	uint64_t const base = *termpos;
 	for(;;) {
 		strarg_t token;
 		int tlen;
-		int tpos; // TODO
+		int tpos;
 		int ignored1, ignored2;
 		rc = fts->xNext(tcur, &token, &tlen, &ignored1, &ignored2, &tpos);
 		if(SQLITE_OK != rc) break;
+		assert(tpos >= 0);
 
 		assert('\0' == token[tlen]); // Assumption
 		KVS_val token_val[1];
-		SLNTermMetaFileIDAndPositionKeyPack(token_val, txn, token, metaFileID, 0);
-		// TODO: Record tpos. Requires changes to SLNFulltextFilter so that each document only gets returned once, no matter how many times the token appears within it.
+		SLNTermMetaFileIDAndPositionKeyPack(token_val, txn, token, metaFileID, base+tpos);
 		KVS_val null = { 0, NULL };
 		rc = kvs_cursor_put(cursor, token_val, &null, KVS_NOOVERWRITE_FAST);
 		assert(rc >= 0 || KVS_KEYEXIST == rc);
+		*termpos = MAX(*termpos, base+tpos+1);
 	}
+	*termpos += 1; // Leave a gap so phrases can't span strings.
 
 	kvs_cursor_close(cursor); cursor = NULL;
 
@@ -5,8 +5,17 @@
 #include "StrongLink.h"
 #include "SLNDB.h"
 
+#define QUEUE_SIZE 64 // Max submissions in flight per queue.
+
+// Submissions are downloaded out of order by the workers, but stored
+// strictly in the order they were queued, as many as are ready at a
+// time. The head is the oldest submission that hasn't been stored.
 typedef struct {
-	SLNSubmissionRef sub;
+	SLNSubmissionRef subs[QUEUE_SIZE];
+	bool done[QUEUE_SIZE];
+	uint64_t head; // Next to store
+	uint64_t work; // Next to hand to a worker
+	uint64_t tail; // Next free slot
 	async_sem_t ingest_sem[1];
 	async_sem_t work_sem[1];
 	async_sem_t done_sem[1];
@@ -16,52 +25,102 @@ struct SLNSync {
 	SLNSessionRef session;
 	sync_queue fileq[1];
 	sync_queue metaq[1];
+	sync_queue depq[1]; // Meta-files waiting on hints, see below.
 	async_sem_t shared_sem[1];
 };
 
-static void queue_init(SLNSyncRef const sync, sync_queue *const queue) {
-	queue->sub = NULL;
-	async_sem_init(queue->ingest_sem, 1, 0);
+static int store_batch(SLNSyncRef const sync, SLNSubmissionRef const *const list, size_t const count);
+
+static void queue_init(SLNSyncRef const sync, sync_queue *const queue, unsigned const size) {
+	assert(size <= QUEUE_SIZE);
+	memset(queue, 0, sizeof(*queue));
+	async_sem_init(queue->ingest_sem, size, 0);
 	async_sem_init(queue->work_sem, 0, 0);
 	async_sem_init(queue->done_sem, 0, 0);
 }
 static void queue_destroy(SLNSyncRef const sync, sync_queue *const queue) {
-	queue->sub = NULL;
+	for(; queue->head < queue->tail; queue->head++) {
+		size_t const x = queue->head % QUEUE_SIZE;
+		SLNSubmissionFree(&queue->subs[x]);
+		queue->done[x] = false;
+	}
+	assert_zeroed(queue->subs, QUEUE_SIZE);
+	queue->head = 0;
+	queue->work = 0;
+	queue->tail = 0;
 	async_sem_destroy(queue->ingest_sem);
 	async_sem_destroy(queue->work_sem);
 	async_sem_destroy(queue->done_sem);
 }
-static int queue_submission(SLNSyncRef const sync, sync_queue *const queue, SLNSubmissionRef const sub) {
-	int rc = async_sem_wait(queue->ingest_sem);
-	if(rc < 0) return rc;
-
-	assert(!queue->sub);
-	queue->sub = sub; //sub = NULL;
+static void queue_append(SLNSyncRef const sync, sync_queue *const queue, SLNSubmissionRef *const subptr) {
+	size_t const x = queue->tail++ % QUEUE_SIZE;
+	assert(!queue->subs[x]);
+	queue->subs[x] = *subptr; *subptr = NULL;
+	queue->done[x] = false;
 	async_sem_post(queue->work_sem);
 	async_sem_post(sync->shared_sem);
-
-	rc = async_sem_wait(queue->done_sem);
-	assert(rc >= 0); // TODO: Clarify ownership
-
-	//sub = queue->sub;
-	queue->sub = NULL;
-	async_sem_post(queue->ingest_sem);
-
-	return rc;
 }
-static int queue_ingest(SLNSyncRef const sync, sync_queue *const queue, strarg_t const URI, strarg_t const targetURI) {
-	SLNSubmissionRef sub = NULL;
-	int rc = SLNSubmissionCreate(sync->session, URI, targetURI, &sub);
+static int queue_push(SLNSyncRef const sync, sync_queue *const queue, SLNSubmissionRef *const subptr) {
+	int rc = async_sem_wait(queue->ingest_sem);
 	if(rc < 0) return rc;
-
-	rc = queue_submission(sync, queue, sub);
+	queue_append(sync, queue, subptr);
+	return 0;
+}
+static bool queue_ready(sync_queue *const queue) {
+	if(queue->head >= queue->work) return false;
+	return queue->done[queue->head % QUEUE_SIZE];
+}
+static int queue_wait(sync_queue *const queue) {
+	while(!queue_ready(queue)) {
+		int rc = async_sem_wait(queue->done_sem);
+		if(rc < 0) return rc;
+	}
+	return 0;
+}
+static void queue_release(sync_queue *const queue, size_t const count) {
+	for(size_t i = 0; i < count; i++) {
+		assert(queue_ready(queue));
+		size_t const x = queue->head++ % QUEUE_SIZE;
+		SLNSubmissionFree(&queue->subs[x]);
+		queue->done[x] = false;
+		async_sem_post(queue->ingest_sem);
+	}
+}
+// Whether the URI is already waiting to be downloaded or stored. Those
+// aren't in the database yet, so SLNSyncFileAvailable() can't tell us.
+static bool queue_has(sync_queue const *const queue, strarg_t const URI) {
+	for(uint64_t i = queue->head; i < queue->tail; i++) {
+		strarg_t const x = SLNSubmissionGetKnownURI(queue->subs[i % QUEUE_SIZE]);
+		if(x && 0 == strcmp(x, URI)) return true;
+	}
+	return false;
+}
+static bool queued(SLNSyncRef const sync, strarg_t const URI) {
+	if(queue_has(sync->fileq, URI)) return true;
+	if(queue_has(sync->metaq, URI)) return true;
+	if(queue_has(sync->depq, URI)) return true;
+	return false;
+}
+static int queue_ingest(SLNSyncRef const sync, sync_queue *const queue, strarg_t const URI, strarg_t const targetURI) {
+	// Doesn't wait for the download unless the queue is full.
+	int rc = async_sem_wait(queue->ingest_sem);
 	if(rc < 0) return rc;
 
-	rc = SLNSyncStoreSubmission(sync, sub);
-	SLNSubmissionFree(&sub);
-	if(rc < 0) return rc;
+	// Check again, since the other reader might have queued it while
+	// we were waiting.
+	if(queued(sync, URI)) {
+		async_sem_post(queue->ingest_sem);
+		return 0;
+	}
 
-	return rc;
+	SLNSubmissionRef sub = NULL;
+	rc = SLNSubmissionCreate(sync->session, URI, targetURI, &sub);
+	if(rc < 0) {
+		async_sem_post(queue->ingest_sem);
+		return rc;
+	}
+	queue_append(sync, queue, &sub);
+	return 0;
 }
 
 static int record_last(SLNSyncRef const sync, KVS_txn *const txn, strarg_t const URI, bool const isMeta) {
@@ -142,8 +201,9 @@ int SLNSyncCreate(SLNSessionRef const session, SLNSyncRef *const out) {
 	SLNSyncRef sync = calloc(1, sizeof(struct SLNSync));
 	if(!sync) return KVS_ENOMEM;
 	sync->session = session;
-	queue_init(sync, sync->fileq);
-	queue_init(sync, sync->metaq);
+	queue_init(sync, sync->fileq, QUEUE_SIZE);
+	queue_init(sync, sync->metaq, QUEUE_SIZE);
+	queue_init(sync, sync->depq, 1);
 	async_sem_init(sync->shared_sem, 0, 0);
 	*out = sync;
 	return 0;
@@ -155,10 +215,54 @@ void SLNSyncFree(SLNSyncRef *const syncptr) {
 	sync->session = NULL;
 	queue_destroy(sync, sync->fileq);
 	queue_destroy(sync, sync->metaq);
+	queue_destroy(sync, sync->depq);
 	async_sem_destroy(sync->shared_sem);
 	assert_zeroed(sync, 1);
 	FREE(syncptr); sync = NULL;
 }
+static int file_available(SLNSyncRef const sync, KVS_txn *const txn, strarg_t const URI, strarg_t const targetURI) {
+	uint64_t fileID = 0;
+	int rc = SLNURIGetFileID(URI, txn, &fileID);
+	if(rc >= 0) {
+		// We have the (meta-)file. We're OK.
+		// TODO: Verify target URI if set.
+		return 0;
+	}
+	if(KVS_NOTFOUND != rc) return rc;
+	if(!targetURI) {
+		// Ordinary file, needs adding as usual.
+		return KVS_NOTFOUND;
+	}
+	// Meta-file, need to decide whether to add or queue.
+	// Needs to be atomic with the below add_hint.
+	rc = get_hints_synced(sync, txn, targetURI);
+	if(rc >= 0) {
+		// We have the previous hints,
+		// meaning we're ready to add.
+		return KVS_NOTFOUND;
+	}
+	if(KVS_NOTFOUND != rc) return rc;
+	// We don't have the previous hints,
+	// meaning we should queue ours.
+	rc = add_hint(sync, txn, URI, targetURI);
+	if(KVS_NOTFOUND == rc) rc = KVS_PANIC;
+	if(rc < 0) return rc;
+	// Can't do anything until later.
+	return 0;
+}
+typedef struct {
+	SLNSyncRef sync;
+	strarg_t URI;
+	strarg_t targetURI;
+	int rc;
+} sync_available;
+static int available_cb(void *const ctx, KVS_txn *const txn, uint64_t *const sortID) {
+	sync_available *const a = ctx;
+	a->rc = file_available(a->sync, txn, a->URI, a->targetURI);
+	if(KVS_NOTFOUND == a->rc) return 0; // Nothing written.
+	return a->rc;
+}
+
 int SLNSyncFileAvailable(SLNSyncRef const sync, strarg_t const URI, strarg_t const targetURI) {
 	if(!URI) return KVS_EINVAL;
 	KVS_env *db = NULL;
@@ -170,47 +274,19 @@ int SLNSyncFileAvailable(SLNSyncRef const sync, strarg_t const URI, strarg_t con
 	// ideal to use read-only transactions for them too. However, we need
 	// to check whether the target has "synced" its hints, and if not
 	// immediately (atomically) add our own hint to the queue.
-	bool const isMeta = !!targetURI;
-	unsigned const mode = isMeta ? KVS_RDWR : KVS_RDONLY;
+	if(targetURI) {
+		if(!SLNSessionHasPermission(sync->session, SLN_RDWR)) return KVS_EACCES;
+		sync_available a[1] = {{ sync, URI, targetURI, 0 }};
+		rc = SLNRepoCommit(SLNSessionGetRepo(sync->session), available_cb, a);
+		if(rc < 0) return rc;
+		return a->rc;
+	}
 
 	rc = SLNSessionDBOpen(sync->session, SLN_RDWR, &db);
 	if(rc < 0) goto cleanup;
-	rc = kvs_txn_begin(db, NULL, mode, &txn);
+	rc = kvs_txn_begin(db, NULL, KVS_RDONLY, &txn);
 	if(rc < 0) goto cleanup;
-
-	uint64_t fileID = 0;
-	rc = SLNURIGetFileID(URI, txn, &fileID);
-	if(rc >= 0) {
-		// We have the (meta-)file. We're OK.
-		// TODO: Verify target URI if set.
-		rc = 0;
-	} else if(KVS_NOTFOUND == rc) {
-		if(!targetURI) {
-			// Ordinary file, needs adding as usual.
-			rc = KVS_NOTFOUND;
-		} else {
-			// Meta-file, need to decide whether to add or queue.
-			// Needs to be atomic with the below add_hint.
-			rc = get_hints_synced(sync, txn, targetURI);
-			if(rc >= 0) {
-				// We have the previous hints,
-				// meaning we're ready to add.
-				rc = KVS_NOTFOUND;
-			} else if(KVS_NOTFOUND == rc) {
-				// We don't have the previous hints,
-				// meaning we should queue ours.
-				rc = add_hint(sync, txn, URI, targetURI);
-				if(KVS_NOTFOUND == rc) rc = KVS_PANIC;
-				if(rc < 0) goto cleanup;
-				rc = kvs_txn_commit(txn); txn = NULL;
-				if(rc < 0) goto cleanup;
-
-				// Can't do anything until later.
-				rc = 0;
-			}
-		}
-	}
-
+	rc = file_available(sync, txn, URI, NULL);
 cleanup:
 	kvs_txn_abort(txn); txn = NULL;
 	SLNSessionDBClose(sync->session, &db);
@@ -221,6 +297,7 @@ int SLNSyncIngestFileURI(SLNSyncRef const sync, strarg_t const fileURI) {
 	if(!sync) return KVS_EINVAL;
 	if(!fileURI) return KVS_EINVAL;
 	alogf("file: %s\n", fileURI);
+	if(queued(sync, fileURI)) return 0;
 	int rc = SLNSyncFileAvailable(sync, fileURI, NULL);
 	if(rc >= 0) return rc;
 	if(KVS_NOTFOUND != rc) return rc;
@@ -231,6 +308,7 @@ int SLNSyncIngestMetaURI(SLNSyncRef const sync, strarg_t const metaURI, strarg_t
 	if(!metaURI) return KVS_EINVAL;
 	if(!targetURI) return KVS_EINVAL;
 	alogf("meta: %s -> %s\n", metaURI, targetURI);
+	if(queued(sync, metaURI)) return 0;
 	int rc = SLNSyncFileAvailable(sync, metaURI, targetURI);
 	if(rc >= 0) return rc;
 	if(KVS_NOTFOUND != rc) return rc;
@@ -241,15 +319,14 @@ int SLNSyncWorkAwait(SLNSyncRef const sync, SLNSubmissionRef *const out) {
 	int rc = async_sem_wait(sync->shared_sem);
 	if(rc < 0) return rc;
 
-	// TODO: Pretty hacky...
-	rc = async_sem_trywait(sync->fileq->work_sem);
-	if(rc >= 0) {
-		*out = sync->fileq->sub;
-		return 0;
-	}
-	rc = async_sem_trywait(sync->metaq->work_sem);
-	if(rc >= 0) {
-		*out = sync->metaq->sub;
+	// Dependencies go first because the file queue is blocked on them.
+	sync_queue *const queues[] = { sync->depq, sync->fileq, sync->metaq };
+	for(size_t i = 0; i < numberof(queues); i++) {
+		sync_queue *const queue = queues[i];
+		rc = async_sem_trywait(queue->work_sem);
+		if(rc < 0) continue;
+		assert(queue->work < queue->tail);
+		*out = queue->subs[queue->work++ % QUEUE_SIZE];
 		return 0;
 	}
 	assert(!"sync scheduling");
@@ -257,17 +334,50 @@ int SLNSyncWorkAwait(SLNSyncRef const sync, SLNSubmissionRef *const out) {
 }
 int SLNSyncWorkDone(SLNSyncRef const sync, SLNSubmissionRef const sub) {
 	if(!sync) return KVS_EINVAL;
-	// TODO: Copy and paste...
-	if(sub == sync->fileq->sub) {
-		async_sem_post(sync->fileq->done_sem);
-		return 0;
-	}
-	if(sub == sync->metaq->sub) {
-		async_sem_post(sync->metaq->done_sem);
-		return 0;
+	sync_queue *const queues[] = { sync->depq, sync->fileq, sync->metaq };
+	for(size_t i = 0; i < numberof(queues); i++) {
+		sync_queue *const queue = queues[i];
+		for(uint64_t j = queue->head; j < queue->work; j++) {
+			size_t const x = j % QUEUE_SIZE;
+			if(sub != queue->subs[x]) continue;
+			assert(!queue->done[x]);
+			queue->done[x] = true;
+			async_sem_post(queue->done_sem);
+			return 0;
+		}
 	}
 	return KVS_EINVAL;
 }
+int SLNSyncStoreAwait(SLNSyncRef const sync, bool const meta) {
+	if(!sync) return KVS_EINVAL;
+	sync_queue *const queue = meta ? sync->metaq : sync->fileq;
+	int rc = queue_wait(queue);
+	if(rc < 0) return rc;
+
+	// Store everything that's ready, in order, in one transaction.
+	SLNSubmissionRef batch[QUEUE_SIZE];
+	size_t count = 0;
+	for(; count < numberof(batch); count++) {
+		uint64_t const i = queue->head + count;
+		if(i >= queue->work) break;
+		size_t const x = i % QUEUE_SIZE;
+		if(!queue->done[x]) break;
+		batch[count] = queue->subs[x];
+	}
+	assert(count > 0);
+	rc = store_batch(sync, batch, count);
+	if(rc < 0) {
+		// Leave the batch at the head of the queue, so the next
+		// call retries it instead of it getting lost.
+		for(size_t i = 0; i < count; i++) {
+			alogf("Sync store error (%s): %s\n", sln_strerror(rc),
+				SLNSubmissionGetKnownURI(batch[i]));
+		}
+		return rc;
+	}
+	queue_release(queue, count);
+	return 0;
+}
 
 int SLNSyncNextHintID(SLNSyncRef const sync, KVS_txn *const txn, strarg_t const targetURI, uint64_t *const hintID) {
 	assert(hintID);
@@ -325,98 +435,143 @@ cleanup:
 int SLNSyncStoreSubmission(SLNSyncRef const sync, SLNSubmissionRef const sub) {
 	if(!sync) return KVS_EINVAL;
 	if(!sub) return KVS_EINVAL;
+	return store_batch(sync, &sub, 1);
+}
+// Progress through a batch. The commit callback can run more than
+// once (group commits get retried), so it only reads the state as of
+// the last commit and leaves its own progress in the next_* fields.
+typedef struct {
+	SLNSyncRef sync;
+	SLNSubmissionRef const *list;
+	size_t count;
+	SLNSubmissionRef dep; // Downloaded dependency, stored first.
+	size_t pos;
+	uint64_t hintID;
+	bool stored;
+	size_t next_pos;
+	uint64_t next_hintID;
+	bool next_stored;
+	str_t metaURI[SLN_URI_MAX]; // Missing dependency, or empty.
+} sync_batch;
+
+static int store_batch_cb(void *const ctx, KVS_txn *const txn, uint64_t *const sortID) {
+	sync_batch *const batch = ctx;
+	SLNSyncRef const sync = batch->sync;
 	uint64_t const sessionID = SLNSessionGetID(sync->session);
-	SLNSubmissionRef dep = NULL;
-	KVS_env *db = NULL;
-	KVS_txn *txn = NULL;
-	uint64_t maxFileID = 0;
+	size_t i = batch->pos;
+	uint64_t hintID = batch->hintID;
+	bool stored = batch->stored;
 	int rc = 0;
+	batch->metaURI[0] = '\0';
 
-	rc = SLNSessionDBOpen(sync->session, SLN_RDWR, &db);
-	if(rc < 0) goto cleanup;
-	rc = kvs_txn_begin(db, NULL, KVS_RDWR, &txn);
-	if(rc < 0) goto cleanup;
+	if(batch->dep) {
+		rc = SLNSubmissionStore(batch->dep, txn);
+		if(rc < 0) return rc;
+		*sortID = MAX(*sortID, SLNSubmissionGetFileID(batch->dep));
+	}
 
-	rc = SLNSubmissionStore(sub, txn);
-	if(rc < 0) goto cleanup;
-	maxFileID = MAX(maxFileID, SLNSubmissionGetFileID(sub));
-
-	strarg_t const URI = SLNSubmissionGetPrimaryURI(sub);
-
-	// TODO: SLNSubmissionIsMetafile() ?
-	bool const isMeta = !!SLNSubmissionGetKnownTarget(sub);
-	if(!isMeta) {
-		// Keeping this in the same function makes sense
-		// because we need to manipulate the outer txn.
-		uint64_t hintID = 0;
-		for(;;) {
-			rc = SLNSyncNextHintID(sync, txn, URI, &hintID);
-			if(KVS_NOTFOUND == rc) break;
-			if(rc < 0) goto cleanup;
-
-			KVS_val hintkey[1], hintval[1];
-			SLNSessionIDAndHintIDToMetaURIAndTargetURIKeyPack(hintkey, txn, sessionID, hintID);
-			rc = kvs_get(txn, hintkey, hintval);
-			if(rc < 0) goto cleanup;
-			strarg_t u, t;
-			SLNSessionIDAndHintIDToMetaURIAndTargetURIValUnpack(hintval, txn, &u, &t);
-			assert(0 == strcmp(URI, t));
-			str_t metaURI[SLN_URI_MAX];
-			strlcpy(metaURI, u, sizeof(metaURI));
-
-			KVS_cursor *cursor = NULL;
-			rc = kvs_txn_cursor(txn, &cursor);
-			if(rc < 0) goto cleanup;
-			KVS_range exists[1];
-			SLNURIAndFileIDRange1(exists, txn, metaURI);
-			rc = kvs_cursor_firstr(cursor, exists, NULL, NULL, +1);
-			if(rc >= 0) continue;
-			if(KVS_NOTFOUND != rc) goto cleanup;
-
-			rc = kvs_txn_commit(txn); txn = NULL;
-			if(rc < 0) goto cleanup;
-			SLNSessionDBClose(sync->session, &db);
-
-
-			rc = SLNSubmissionCreate(sync->session, metaURI, URI, &dep);
-			if(rc < 0) goto cleanup;
-
-			// This skips any checks about whether we have
-			// the meta-file or target.
-			// It'd be nice to jump the queue in this case.
-			// Just as an optimization.
-			rc = queue_submission(sync, sync->metaq, dep);
-			if(rc < 0) goto cleanup;
-
-
-			rc = SLNSessionDBOpen(sync->session, SLN_RDWR, &db);
-			if(rc < 0) goto cleanup;
-			rc = kvs_txn_begin(db, NULL, KVS_RDWR, &txn);
-			if(rc < 0) goto cleanup;
-
-			rc = SLNSubmissionStore(dep, txn);
-			maxFileID = MAX(maxFileID, SLNSubmissionGetFileID(dep));
-			SLNSubmissionFree(&dep);
-			if(rc < 0) goto cleanup;
+	for(; i < batch->count; i++, hintID = 0, stored = false) {
+		SLNSubmissionRef const sub = batch->list[i];
+		if(!stored) {
+			rc = SLNSubmissionStore(sub, txn);
+			if(rc < 0) return rc;
+			*sortID = MAX(*sortID, SLNSubmissionGetFileID(sub));
+			stored = true;
 		}
 
-		// It's critical that this happens in the same transaction
-		// as the previous call to SLNSessionNextHintID()!
-		rc = set_hints_synced(sync, txn, URI);
-		if(rc < 0) goto cleanup;
+		strarg_t const URI = SLNSubmissionGetPrimaryURI(sub);
+
+		// TODO: SLNSubmissionIsMetafile() ?
+		bool const isMeta = !!SLNSubmissionGetKnownTarget(sub);
+		if(!isMeta) {
+			for(;;) {
+				rc = SLNSyncNextHintID(sync, txn, URI, &hintID);
+				if(KVS_NOTFOUND == rc) break;
+				if(rc < 0) return rc;
+
+				KVS_val hintkey[1], hintval[1];
+				SLNSessionIDAndHintIDToMetaURIAndTargetURIKeyPack(hintkey, txn, sessionID, hintID);
+				rc = kvs_get(txn, hintkey, hintval);
+				if(rc < 0) return rc;
+				strarg_t u, t;
+				SLNSessionIDAndHintIDToMetaURIAndTargetURIValUnpack(hintval, txn, &u, &t);
+				assert(0 == strcmp(URI, t));
+
+				KVS_cursor *cursor = NULL;
+				rc = kvs_txn_cursor(txn, &cursor);
+				if(rc < 0) return rc;
+				KVS_range exists[1];
+				SLNURIAndFileIDRange1(exists, txn, u);
+				rc = kvs_cursor_firstr(cursor, exists, NULL, NULL, +1);
+				if(rc >= 0) continue;
+				if(KVS_NOTFOUND != rc) return rc;
+
+				// Commit the batch up to here and come back
+				// once the meta-file is downloaded. That's
+				// fine since the batch is stored in order.
+				strlcpy(batch->metaURI, u, sizeof(batch->metaURI));
+				goto pause;
+			}
+
+			// It's critical that this happens in the same transaction
+			// as the previous call to SLNSessionNextHintID()!
+			rc = set_hints_synced(sync, txn, URI);
+			if(rc < 0) return rc;
+		}
+
+		// It's critical that this happens after set_hints_synced,
+		// so we restart the hints e.g. in the event of a crash.
+		rc = record_last(sync, txn, URI, isMeta);
+		if(rc < 0) return rc;
 	}
 
-	// It's critical that this happens after set_hints_synced,
-	// so we restart the hints e.g. in the event of a crash.
-	rc = record_last(sync, txn, URI, isMeta);
-	if(rc < 0) goto cleanup;
+pause:
+	batch->next_pos = i;
+	batch->next_hintID = hintID;
+	batch->next_stored = stored;
+	return 0;
+}
+static int store_batch(SLNSyncRef const sync, SLNSubmissionRef const *const list, size_t const count) {
+	assert(list);
+	if(!SLNSessionHasPermission(sync->session, SLN_RDWR)) return KVS_EACCES;
+	SLNRepoRef const repo = SLNSessionGetRepo(sync->session);
+	sync_batch batch[1] = {{
+		.sync = sync,
+		.list = list,
+		.count = count,
+	}};
+	int rc = 0;
 
-	rc = kvs_txn_commit(txn); txn = NULL;
-cleanup:
-	kvs_txn_abort(txn); txn = NULL;
-	SLNSessionDBClose(sync->session, &db);
-	SLNSubmissionFree(&dep);
-	if(rc >= 0) SLNRepoSubmissionEmit(SLNSessionGetRepo(sync->session), maxFileID);
+	// Goes through SLNRepoCommit() like local submissions, so pulls
+	// share group commits and get the map growth retry.
+	for(;;) {
+		rc = SLNRepoCommit(repo, store_batch_cb, batch);
+		SLNSubmissionFree(&batch->dep);
+		if(rc < 0) break;
+		batch->pos = batch->next_pos;
+		batch->hintID = batch->next_hintID;
+		batch->stored = batch->next_stored;
+		if('\0' == batch->metaURI[0]) break;
+
+		strarg_t const URI = SLNSubmissionGetPrimaryURI(list[batch->pos]);
+		SLNSubmissionRef dep = NULL;
+		rc = SLNSubmissionCreate(sync->session, batch->metaURI, URI, &dep);
+		if(rc < 0) break;
+
+		// This skips any checks about whether we have
+		// the meta-file or target.
+		// The dependency queue jumps ahead of the
+		// others, so we aren't stuck behind a full batch.
+		rc = queue_push(sync, sync->depq, &dep);
+		SLNSubmissionFree(&dep);
+		if(rc < 0) break;
+		rc = queue_wait(sync->depq);
+		if(rc < 0) break;
+		size_t const x = sync->depq->head % QUEUE_SIZE;
+		batch->dep = sync->depq->subs[x]; sync->depq->subs[x] = NULL;
+		queue_release(sync->depq, 1);
+	}
+	SLNSubmissionFree(&batch->dep);
 	return rc;
 }
 int SLNSyncCopyLastSubmissionURIs(SLNSyncRef const sync, str_t *const outFileURI, str_t *const outMetaURI) {
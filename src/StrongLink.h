@@ -63,8 +63,13 @@ SLNMode SLNRepoGetRegistrationMode(SLNRepoRef const repo);
 SLNSessionCacheRef SLNRepoGetSessionCache(SLNRepoRef const repo);
 void SLNRepoDBOpenUnsafe(SLNRepoRef const repo, KVS_env **const dbptr);
 void SLNRepoDBClose(SLNRepoRef const repo, KVS_env **const dbptr);
+typedef int (*SLNRepoCommitCB)(void *const ctx, KVS_txn *const txn, uint64_t *const sortID);
+int SLNRepoCommit(SLNRepoRef const repo, SLNRepoCommitCB const cb, void *const ctx);
 void SLNRepoSubmissionEmit(SLNRepoRef const repo, uint64_t const sortID);
-int SLNRepoSubmissionWait(SLNRepoRef const repo, uint64_t *const sortID, uint64_t const future);
+typedef bool (*SLNRepoSubmissionCheckCB)(void *const ctx, KVS_txn *const txn, uint64_t const after, uint64_t const latest);
+int SLNRepoSubmissionWait(SLNRepoRef const repo, uint64_t *const sortID, uint64_t const future, SLNRepoSubmissionCheckCB const check, void *const ctx);
+void SLNRepoSubmissionCancel(SLNRepoRef const repo, void *const ctx);
+uint64_t SLNRepoSubmissionLatest(SLNRepoRef const repo);
 void SLNRepoPullsStart(SLNRepoRef const repo);
 void SLNRepoPullsStop(SLNRepoRef const repo);
 
@@ -98,7 +103,9 @@ SLNSessionCacheRef SLNSessionGetCache(SLNSessionRef const session);
 SLNRepoRef SLNSessionGetRepo(SLNSessionRef const session);
 uint64_t SLNSessionGetID(SLNSessionRef const session);
 int SLNSessionKeyValid(SLNSessionRef const session, byte_t const *const enc);
+int SLNSessionKeyValidRaw(SLNSessionRef const session, byte_t const *const raw);
 uint64_t SLNSessionGetUserID(SLNSessionRef const session);
+SLNMode SLNSessionGetMode(SLNSessionRef const session);
 bool SLNSessionHasPermission(SLNSessionRef const session, SLNMode const mask) __attribute__((warn_unused_result));
 strarg_t SLNSessionGetUsername(SLNSessionRef const session);
 str_t *SLNSessionCopyCookie(SLNSessionRef const session);
@@ -108,8 +115,11 @@ int SLNSessionCreateUser(SLNSessionRef const session, KVS_txn *const txn, strarg
 int SLNSessionCreateUserInternal(SLNSessionRef const session, KVS_txn *const txn, strarg_t const username, strarg_t const password, SLNMode const mode_unsafe);
 int SLNSessionCreateSession(SLNSessionRef const session, SLNSessionRef *const out);
 int SLNSessionGetFileInfo(SLNSessionRef const session, strarg_t const URI, SLNFileInfo *const info);
+int SLNSessionGetFileInfoTxn(SLNSessionRef const session, KVS_txn *const txn, strarg_t const URI, SLNFileInfo *const info);
 void SLNFileInfoCleanup(SLNFileInfo *const info);
 int SLNSessionGetValueForField(SLNSessionRef const session, KVS_txn *const txn, strarg_t const fileURI, strarg_t const field, str_t *out, size_t const max);
+typedef int (*SLNFieldValueCB)(void *const ctx, strarg_t const field, strarg_t const value);
+int SLNSessionGetFieldsForFile(SLNSessionRef const session, KVS_txn *const txn, strarg_t const fileURI, SLNFieldValueCB const cb, void *const ctx);
 
 int SLNSubmissionCreate(SLNSessionRef const session, strarg_t const knownURI, strarg_t const knownTarget, SLNSubmissionRef *const out);
 int SLNSubmissionCreateQuick(SLNSessionRef const session, strarg_t const knownURI, strarg_t const knownTarget, strarg_t const type, ssize_t (*read)(void *, byte_t const **), void *const context, SLNSubmissionRef *const out);
@@ -155,7 +165,7 @@ enum {
 	// All files that are targeted by at least one meta-file
 	SLNVisibleFilterType = 3,
 	// Files with a given MIME type
-//	SLNFileTypeFilterType = 4, // TODO
+	SLNFileTypeFilterType = 4,
 	// AND operation
 	SLNIntersectionFilterType = 5,
 	// OR operation
@@ -166,14 +176,20 @@ enum {
 	SLNURIFilterType = 8,
 	// Meta-files with a given target
 	SLNTargetURIFilterType = 9,
-	// Full-text search // TODO: Phrase search
+	// Full-text search (all tokens, or a phrase if quoted)
 	SLNFulltextFilterType = 10,
-	// Exact meta-data field and value // TODO: Case-insensitivity
+	// Exact meta-data field and value
 	SLNMetadataFilterType = 11,
 	// Backlinks (everything linking to a file with the given URI)
 	SLNLinksToFilterType = 12,
 	// Forward links (everything linked from a file with the given URI)
-//	SLNLinkedFromFilterType = 13, // TODO
+	SLNLinkedFromFilterType = 13,
+	// Meta-data field and value, ignoring case (ASCII only for now)
+	SLNFoldedMetadataFilterType = 14,
+	// Meta-data field with a value starting with the given prefix
+	SLNMetadataPrefixFilterType = 15,
+	// Meta-data field with a value in a lexical range (low inclusive, high exclusive)
+	SLNMetadataRangeFilterType = 16,
 };
 
 typedef struct {
@@ -198,6 +214,8 @@ void SLNFilterCurrent(SLNFilterRef const filter, int const dir, uint64_t *const
 void SLNFilterStep(SLNFilterRef const filter, int const dir);
 SLNAgeRange SLNFilterFullAge(SLNFilterRef const filter, uint64_t const fileID);
 uint64_t SLNFilterFastAge(SLNFilterRef const filter, uint64_t const fileID, uint64_t const sortID);
+uint64_t SLNFilterEstimate(SLNFilterRef const filter, int const dir, uint64_t const sortID, uint64_t const fileID, uint64_t const max);
+bool SLNFilterMightMatch(SLNFilterRef const filter, KVS_txn *const txn, uint64_t const after, uint64_t const latest);
 
 
 typedef struct {
@@ -219,6 +237,8 @@ int SLNFilterGetPosition(SLNFilterRef const filter, SLNFilterPosition *const pos
 int SLNFilterCopyNextURI(SLNFilterRef const filter, int const dir, bool const meta, KVS_txn *const txn, str_t **const out);
 
 ssize_t SLNFilterCopyURIs(SLNFilterRef const filter, SLNSessionRef const session, SLNFilterPosition *const pos, int const dir, bool const meta, str_t *URIs[], size_t const max);
+int SLNFilterCountURIs(SLNFilterRef const filter, SLNSessionRef const session, SLNFilterPosition *const pos, uint64_t const max, uint64_t *const out);
+int SLNFilterEstimateURIs(SLNFilterRef const filter, SLNSessionRef const session, SLNFilterPosition const *const pos, uint64_t const max, uint64_t *const out);
 ssize_t SLNFilterWriteURIBatch(SLNFilterRef const filter, SLNSessionRef const session, SLNFilterPosition *const pos, bool const meta, uint64_t const max, SLNFilterWriteCB const writecb, void *ctx);
 int SLNFilterWriteURIs(SLNFilterRef const filter, SLNSessionRef const session, SLNFilterPosition *const pos, bool const meta, uint64_t const max, bool const wait, SLNFilterWriteCB const writecb, SLNFilterFlushCB const flushcb, void *ctx);
 
@@ -240,6 +260,7 @@ int SLNSyncIngestFileURI(SLNSyncRef const sync, strarg_t const fileURI);
 int SLNSyncIngestMetaURI(SLNSyncRef const sync, strarg_t const metaURI, strarg_t const targetURI);
 int SLNSyncWorkAwait(SLNSyncRef const sync, SLNSubmissionRef *const out);
 int SLNSyncWorkDone(SLNSyncRef const sync, SLNSubmissionRef const sub);
+int SLNSyncStoreAwait(SLNSyncRef const sync, bool const meta);
 int SLNSyncNextHintID(SLNSyncRef const sync, KVS_txn *const txn, strarg_t const targetURI, uint64_t *const hintID);
 int SLNSyncStoreSubmission(SLNSyncRef const sync, SLNSubmissionRef const sub);
 int SLNSyncCopyLastSubmissionURIs(SLNSyncRef const sync, str_t *const outFileURI, str_t *const outMetaURI);
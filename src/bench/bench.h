@@ -0,0 +1,84 @@
+// Copyright 2014-2015 Ben Trask
+// MIT licensed (see LICENSE for details)
+
+// Shared scaffolding for the standalone benchmarks built by `make bench`.
+// Each benchmark gets a throwaway repo directory as its only argument.
+
+#include <stdio.h>
+#include "../StrongLink.h"
+
+static strarg_t bench_path = NULL;
+static int bench_rc = 0;
+
+static uint64_t bench_now(void) {
+	return uv_hrtime();
+}
+static void bench_report(strarg_t const name, uint64_t const count, uint64_t const bytes, uint64_t const ns) {
+	double const sec = ns / 1e9;
+	if(bytes) {
+		fprintf(stdout, "%-24s %10llu ops %8.3f s %12.0f ops/s %10.1f MB/s\n",
+			name, (unsigned long long)count, sec, count / sec,
+			bytes / sec / (1024.0 * 1024.0));
+	} else {
+		fprintf(stdout, "%-24s %10llu ops %8.3f s %12.0f ops/s %10.0f ns/op\n",
+			name, (unsigned long long)count, sec, count / sec,
+			(double)ns / count);
+	}
+}
+static void bench_fail(strarg_t const what, int const rc) {
+	fprintf(stderr, "%s: %s\n", what, sln_strerror(rc));
+	if(bench_rc >= 0) bench_rc = rc < 0 ? rc : -1;
+}
+
+// Opens the repo and a root session that bypasses the user tables.
+static int bench_open(SLNRepoRef *const repo, SLNSessionRef *const session) {
+	int rc = SLNRepoCreate(bench_path, "bench", repo);
+	if(rc < 0) return rc;
+	SLNSessionCacheRef const cache = SLNRepoGetSessionCache(*repo);
+	rc = SLNSessionCreateInternal(cache, 0, NULL, NULL, 1, SLN_ROOT, "bench", session);
+	if(rc < 0) SLNRepoFree(repo);
+	return rc;
+}
+static void bench_close(SLNRepoRef *const repo, SLNSessionRef *const session) {
+	SLNSessionRelease(session);
+	SLNRepoFree(repo);
+}
+
+// Creates and ends a submission from a memory buffer.
+static int bench_submission(SLNSessionRef const session, strarg_t const target, strarg_t const type, byte_t const *const buf, size_t const len, SLNSubmissionRef *const out) {
+	SLNSubmissionRef sub = NULL;
+	int rc = SLNSubmissionCreate(session, NULL, target, &sub);
+	if(rc < 0) goto cleanup;
+	rc = SLNSubmissionSetType(sub, type);
+	if(rc < 0) goto cleanup;
+	rc = SLNSubmissionWrite(sub, buf, len);
+	if(rc < 0) goto cleanup;
+	rc = SLNSubmissionEnd(sub);
+	if(rc < 0) goto cleanup;
+	*out = sub; sub = NULL;
+cleanup:
+	SLNSubmissionFree(&sub);
+	return rc;
+}
+
+static int bench_main(int const argc, char const *const *const argv, void (*const fn)(void *)) {
+	int rc = async_process_init();
+	if(rc < 0) {
+		fprintf(stderr, "Initialization error: %s\n", uv_strerror(rc));
+		return 1;
+	}
+	if(2 != argc || '-' == argv[1][0]) {
+		fprintf(stderr, "Usage:\n\t" "%s tmpdir\n", argv[0]);
+		return 1;
+	}
+	bench_path = argv[1];
+	rc = async_random((byte_t *)&SLNSeed, sizeof(SLNSeed));
+	if(rc < 0) {
+		fprintf(stderr, "Random seed error\n");
+		return 1;
+	}
+
+	async_spawn(STACK_DEFAULT, fn, NULL);
+	uv_run(async_loop, UV_RUN_DEFAULT);
+	return bench_rc < 0 ? 1 : 0;
+}
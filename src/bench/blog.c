@@ -0,0 +1,111 @@
+// Copyright 2015 Ben Trask
+// MIT licensed (see LICENSE for details)
+
+#include <errno.h>
+#include <limits.h>
+#include <stdlib.h>
+#include "bench.h"
+#include "../blog/Blog.h"
+
+#define FILES 8
+#define TIMEOUT (1000 * 30)
+
+// Relative to the top of the tree, where `make bench` runs.
+#define TEMPLATES "res/blog"
+
+static uint64_t other_latest = 0;
+static int other_rc = 1; // Still waiting.
+
+// Someone else waiting on the repo, who BlogStop() shouldn't disturb.
+static void other_waiter(void *const arg) {
+	SLNRepoRef const repo = arg;
+	other_rc = SLNRepoSubmissionWait(repo, &other_latest, uv_now(async_loop)+TIMEOUT, NULL, NULL);
+}
+
+static bool exists(strarg_t const path) {
+	uv_file const file = async_fs_open(path, O_RDONLY, 0000);
+	if(file < 0) return false;
+	async_fs_close(file);
+	return true;
+}
+
+static void bench(void *const arg) {
+	SLNRepoRef repo = NULL;
+	SLNSessionRef session = NULL;
+	BlogRef blog = NULL;
+	str_t *dir = NULL;
+	SLNSubmissionRef subs[FILES] = {};
+	str_t *paths[FILES] = {};
+	str_t templates[PATH_MAX];
+	str_t buf[URI_MAX * 2];
+	int rc = bench_open(&repo, &session);
+	if(rc < 0) goto cleanup;
+
+	// Use the templates from the tree instead of the installed ones.
+	dir = aasprintf("%s/blog", SLNRepoGetDir(repo));
+	if(!dir) rc = UV_ENOMEM;
+	if(rc < 0) goto cleanup;
+	if(!realpath(TEMPLATES, templates)) rc = -errno;
+	if(rc < 0) goto cleanup;
+	rc = async_fs_symlink(templates, dir, 0);
+	if(rc < 0) goto cleanup;
+	blog = BlogCreate(repo);
+	if(!blog) rc = -1; // BlogCreate() logs why.
+	if(rc < 0) goto cleanup;
+
+	for(size_t i = 0; i < FILES; i++) {
+		int const len = snprintf(buf, sizeof(buf), "blog file %zu\n", i);
+		rc = bench_submission(session, NULL, "text/plain; charset=utf-8", (byte_t const *)buf, len, &subs[i]);
+		if(rc < 0) goto cleanup;
+		str_t algo[SLN_ALGO_SIZE];
+		str_t hash[SLN_HASH_SIZE];
+		SLNParseURI(SLNSubmissionGetPrimaryURI(subs[i]), algo, hash);
+		paths[i] = aasprintf("%s/blog/%.2s/%s", SLNRepoGetCacheDir(repo), hash, hash);
+		if(!paths[i]) rc = UV_ENOMEM;
+		if(rc < 0) goto cleanup;
+	}
+
+	// Nobody asks for these pages, so the previews can only come from
+	// the worker reacting to the commit.
+	uint64_t const start = bench_now();
+	rc = SLNSubmissionStoreBatch(subs, FILES);
+	if(rc < 0) goto cleanup;
+	for(size_t i = 0; i < FILES; i++) {
+		uint64_t const future = uv_now(async_loop)+TIMEOUT;
+		while(!exists(paths[i]) && uv_now(async_loop) < future) async_sleep(10);
+		if(!exists(paths[i])) {
+			fprintf(stderr, "blog/pregen: no preview at %s\n", paths[i]);
+			rc = UV_ETIMEDOUT;
+			goto cleanup;
+		}
+	}
+	bench_report("blog/pregen", FILES, 0, bench_now() - start);
+
+	other_latest = SLNRepoSubmissionLatest(repo);
+	rc = async_spawn(STACK_DEFAULT, other_waiter, repo);
+	if(rc < 0) goto cleanup;
+	async_yield();
+	BlogFree(&blog);
+	if(1 != other_rc) {
+		fprintf(stderr, "blog/stop: other waiter woke up (%s)\n", sln_strerror(other_rc));
+		rc = -1;
+		goto cleanup;
+	}
+	SLNRepoSubmissionEmit(repo, other_latest+1);
+	while(1 == other_rc) async_yield();
+	rc = other_rc;
+
+cleanup:
+	if(rc < 0) bench_fail("blog", rc);
+	BlogFree(&blog);
+	FREE(&dir);
+	for(size_t i = 0; i < FILES; i++) {
+		SLNSubmissionFree(&subs[i]);
+		FREE(&paths[i]);
+	}
+	bench_close(&repo, &session);
+}
+
+int main(int const argc, char const *const *const argv) {
+	return bench_main(argc, argv, bench);
+}
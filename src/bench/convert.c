@@ -0,0 +1,185 @@
+// Copyright 2014-2015 Ben Trask
+// MIT licensed (see LICENSE for details)
+
+#include <yajl/yajl_gen.h>
+#include "bench.h"
+
+// Short posts, where per-document setup outweighs the actual conversion.
+#define DOCS (1000 * 10)
+
+// Each corpus entry is NAME.md plus the NAME.html and NAME.json that the
+// original converter produced for it, before the rewrites were folded into
+// a single walk. Relative to the top of the tree, where `make bench` runs.
+#define CORPUS "src/bench/convert"
+#define CORPUS_MAX (1024 * 1024 * 1)
+
+int blog_convert_markdown(
+	uv_file const html,
+	yajl_gen const json,
+	char const *const buf,
+	size_t const size,
+	char const *const type);
+int blog_convert_plaintext(
+	uv_file const html,
+	yajl_gen const json,
+	char const *const buf,
+	size_t const size,
+	char const *const type);
+
+static char const post[] =
+	"A short post with a link to http://example.com/page and\n"
+	"a [hash link](hash://sha256/0123456789abcdef), plus *emphasis*.\n";
+
+static strarg_t const corpus[] = {
+	"html",
+	"links",
+	"prose",
+	"syntax",
+};
+
+static int read_file(strarg_t const path, str_t **const out, size_t *const outlen) {
+	str_t *str = NULL;
+	int rc = 0;
+	uv_file file = async_fs_open(path, O_RDONLY, 0000);
+	if(file < 0) rc = (int)file;
+	if(rc < 0) goto cleanup;
+	uv_fs_t req;
+	rc = async_fs_fstat(file, &req);
+	if(rc < 0) goto cleanup;
+	int64_t const size = req.statbuf.st_size;
+	if(size > CORPUS_MAX) rc = UV_EFBIG;
+	if(rc < 0) goto cleanup;
+	str = malloc((size_t)size+1);
+	if(!str) rc = UV_ENOMEM;
+	if(rc < 0) goto cleanup;
+	uv_buf_t info = uv_buf_init(str, size);
+	ssize_t len = async_fs_readall_simple(file, &info);
+	if(len < 0) rc = (int)len;
+	else if(size != len) rc = UV_EBUSY;
+	if(rc < 0) goto cleanup;
+	str[size] = '\0';
+	*out = str; str = NULL;
+	*outlen = (size_t)size;
+cleanup:
+	if(file >= 0) async_fs_close(file);
+	file = -1;
+	FREE(&str);
+	return rc;
+}
+static int compare(strarg_t const name, strarg_t const ext, char const *const a, size_t const alen, char const *const b, size_t const blen) {
+	size_t i = 0;
+	while(i < alen && i < blen && a[i] == b[i]) i++;
+	if(i == alen && i == blen) return 0;
+	fprintf(stderr, "convert/%s.%s: differs at byte %zu\n", name, ext, i);
+	return -1;
+}
+static int check_corpus(strarg_t const name) {
+	str_t *path = NULL;
+	str_t *md = NULL, *html = NULL, *expected = NULL;
+	size_t mdlen = 0, htmllen = 0, expectedlen = 0;
+	uv_file file = -1;
+	yajl_gen json = NULL;
+	int rc = 0;
+
+	path = aasprintf("%s/%s.md", CORPUS, name);
+	if(!path) rc = UV_ENOMEM;
+	if(rc < 0) goto cleanup;
+	rc = read_file(path, &md, &mdlen);
+	if(rc < 0) goto cleanup;
+	FREE(&path);
+
+	path = aasprintf("%s/%s.html", bench_path, name);
+	if(!path) rc = UV_ENOMEM;
+	if(rc < 0) goto cleanup;
+	file = async_fs_open(path, O_CREAT | O_TRUNC | O_WRONLY, 0600);
+	if(file < 0) rc = (int)file;
+	if(rc < 0) goto cleanup;
+	json = yajl_gen_alloc(NULL);
+	if(!json) rc = UV_ENOMEM;
+	if(rc < 0) goto cleanup;
+	yajl_gen_map_open(json);
+	rc = blog_convert_markdown(file, json, md, mdlen, "text/markdown");
+	yajl_gen_map_close(json);
+	async_fs_close(file); file = -1;
+	if(rc < 0) goto cleanup;
+	rc = read_file(path, &html, &htmllen);
+	if(rc < 0) goto cleanup;
+	FREE(&path);
+
+	path = aasprintf("%s/%s.html", CORPUS, name);
+	if(!path) rc = UV_ENOMEM;
+	if(rc < 0) goto cleanup;
+	rc = read_file(path, &expected, &expectedlen);
+	if(rc < 0) goto cleanup;
+	FREE(&path);
+	rc = compare(name, "html", html, htmllen, expected, expectedlen);
+	if(rc < 0) goto cleanup;
+	FREE(&expected);
+
+	path = aasprintf("%s/%s.json", CORPUS, name);
+	if(!path) rc = UV_ENOMEM;
+	if(rc < 0) goto cleanup;
+	rc = read_file(path, &expected, &expectedlen);
+	if(rc < 0) goto cleanup;
+	unsigned char const *buf = NULL;
+	size_t len = 0;
+	yajl_gen_get_buf(json, &buf, &len);
+	rc = compare(name, "json", (char const *)buf, len, expected, expectedlen);
+	if(rc < 0) goto cleanup;
+
+cleanup:
+	if(file >= 0) async_fs_close(file);
+	file = -1;
+	if(json) yajl_gen_free(json);
+	json = NULL;
+	FREE(&path);
+	FREE(&md);
+	FREE(&html);
+	FREE(&expected);
+	if(rc < 0) bench_fail(name, rc);
+	return rc;
+}
+
+static void run(strarg_t const name, uv_file const html, int (*const converter)(uv_file const, yajl_gen const, char const *const, size_t const, char const *const), strarg_t const type) {
+	uint64_t const start = bench_now();
+	for(size_t i = 0; i < DOCS; i++) {
+		yajl_gen json = yajl_gen_alloc(NULL);
+		if(!json) {
+			bench_fail(name, UV_ENOMEM);
+			return;
+		}
+		yajl_gen_map_open(json);
+		int rc = converter(html, json, post, sizeof(post)-1, type);
+		yajl_gen_map_close(json);
+		yajl_gen_free(json); json = NULL;
+		if(rc < 0) {
+			bench_fail(name, rc);
+			return;
+		}
+	}
+	bench_report(name, DOCS, DOCS * (sizeof(post)-1), bench_now() - start);
+}
+
+static void bench(void *const unused) {
+	str_t *path = aasprintf("%s/convert.html", bench_path);
+	if(!path) {
+		bench_fail("convert", UV_ENOMEM);
+		return;
+	}
+	uv_file html = async_fs_open(path, O_CREAT | O_TRUNC | O_WRONLY, 0600);
+	FREE(&path);
+	if(html < 0) {
+		bench_fail("convert", html);
+		return;
+	}
+	for(size_t i = 0; i < numberof(corpus); i++) {
+		check_corpus(corpus[i]);
+	}
+	run("convert/markdown", html, blog_convert_markdown, "text/markdown");
+	run("convert/plaintext", html, blog_convert_plaintext, "text/plain");
+	async_fs_close(html); html = -1;
+}
+
+int main(int const argc, char const *const *const argv) {
+	return bench_main(argc, argv, bench);
+}
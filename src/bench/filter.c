@@ -0,0 +1,384 @@
+// Copyright 2014-2015 Ben Trask
+// MIT licensed (see LICENSE for details)
+
+#include "bench.h"
+
+#define FILES 2048
+#define BATCH_SIZE 64
+#define PAGE 50
+#define ROUNDS 200
+#define RECENT 16
+
+// Each file gets one meta-file with a title, a tag and a link, so the
+// metadata, full-text and backlink indexes all have something in them.
+// The newest RECENT files are also marked recent, as a rare term.
+static int populate(SLNSessionRef const session) {
+	SLNSubmissionRef subs[BATCH_SIZE * 2] = {};
+	str_t buf[URI_MAX * 2];
+	int rc = 0;
+	for(size_t i = 0; i < FILES / BATCH_SIZE; i++) {
+		for(size_t j = 0; j < BATCH_SIZE; j++) {
+			size_t const n = i * BATCH_SIZE + j;
+			int len = snprintf(buf, sizeof(buf), "bench file %zu\n", n);
+			rc = bench_submission(session, NULL, "text/plain; charset=utf-8", (byte_t const *)buf, len, &subs[j*2+0]);
+			if(rc < 0) goto cleanup;
+			strarg_t const URI = SLNSubmissionGetPrimaryURI(subs[j*2+0]);
+			len = snprintf(buf, sizeof(buf),
+				"%s\n\n"
+				"{\"title\": \"bench title %zu\", \"tag\": \"%s\", \"link\": \"hash://bench/%zu\"%s}",
+				URI, n, n % 2 ? "odd" : "even", n % 16,
+				n >= FILES - RECENT ? ", \"recent\": \"yes\"" : "");
+			rc = bench_submission(session, URI, SLN_META_TYPE, (byte_t const *)buf, len, &subs[j*2+1]);
+			if(rc < 0) goto cleanup;
+		}
+		rc = SLNSubmissionStoreBatch(subs, BATCH_SIZE * 2);
+		if(rc < 0) goto cleanup;
+		for(size_t j = 0; j < BATCH_SIZE * 2; j++) SLNSubmissionFree(&subs[j]);
+	}
+cleanup:
+	for(size_t j = 0; j < BATCH_SIZE * 2; j++) SLNSubmissionFree(&subs[j]);
+	return rc;
+}
+
+static int run(SLNSessionRef const session, strarg_t const name, strarg_t const query, size_t const max, size_t const rounds) {
+	SLNFilterRef filter = NULL;
+	str_t **URIs = calloc(max, sizeof(*URIs));
+	uint64_t total = 0;
+	int rc = 0;
+	if(!URIs) rc = UV_ENOMEM;
+	if(rc < 0) goto cleanup;
+	rc = SLNUserFilterParse(session, query, &filter);
+	if(rc < 0) goto cleanup;
+
+	uint64_t const start = bench_now();
+	for(size_t i = 0; i < rounds; i++) {
+		SLNFilterPosition pos[1];
+		SLNFilterPositionInit(pos, -1);
+		ssize_t const count = SLNFilterCopyURIs(filter, session, pos, +1, false, URIs, max);
+		SLNFilterPositionCleanup(pos);
+		if(count < 0) rc = (int)count;
+		if(rc < 0) goto cleanup;
+		for(size_t j = 0; j < count; j++) FREE(&URIs[j]);
+		total += count;
+	}
+	bench_report(name, total, 0, bench_now() - start);
+
+cleanup:
+	SLNFilterFree(&filter);
+	FREE(&URIs);
+	if(rc < 0) bench_fail(name, rc);
+	return rc;
+}
+
+// Raw positions from walking a filter in one direction.
+typedef struct {
+	uint64_t sortID;
+	uint64_t fileID;
+} position;
+typedef struct {
+	position *items;
+	size_t count;
+	size_t size;
+} positions;
+
+static int pos_cmp(void const *const a, void const *const b) {
+	position const *const x = a, *const y = b;
+	if(x->sortID != y->sortID) return x->sortID < y->sortID ? -1 : 1;
+	if(x->fileID != y->fileID) return x->fileID < y->fileID ? -1 : 1;
+	return 0;
+}
+static int walk(SLNFilterRef const filter, KVS_txn *const txn, int const dir, positions *const out) {
+	int rc = SLNFilterPrepare(filter, txn);
+	if(rc < 0) return rc;
+	uint64_t const start = dir > 0 ? 0 : UINT64_MAX;
+	SLNFilterSeek(filter, dir, start, start);
+	for(;;) {
+		uint64_t sortID, fileID;
+		SLNFilterCurrent(filter, dir, &sortID, &fileID);
+		if(0 == sortID || UINT64_MAX == sortID) break;
+		if(out->count+1 > out->size) {
+			size_t const size = MAX(64, out->size * 2);
+			position *const x = reallocarray(out->items, size, sizeof(*x));
+			if(!x) { rc = UV_ENOMEM; break; }
+			out->items = x;
+			out->size = size;
+		}
+		out->items[out->count++] = (position){ sortID, fileID };
+		SLNFilterStep(filter, dir);
+	}
+	SLNFilterReset(filter);
+	return rc;
+}
+
+// A union walks its children through a heap. Its raw output must be
+// exactly what sorting and de-duplicating the children's output gives,
+// in both directions.
+static strarg_t const terms[] = {
+	"tag=even",
+	"title",
+	"link=hash://bench/3",
+	"link=hash://bench/5",
+};
+static int check_union(SLNSessionRef const session) {
+	KVS_env *db = NULL;
+	KVS_txn *txn = NULL;
+	SLNFilterRef filter = NULL;
+	positions expected[1] = {}, actual[1] = {};
+	int rc = SLNSessionDBOpen(session, SLN_RDONLY, &db);
+	if(rc < 0) goto cleanup;
+	rc = kvs_txn_begin(db, NULL, KVS_RDONLY, &txn);
+	if(rc < 0) goto cleanup;
+
+	rc = SLNFilterCreate(session, SLNUnionFilterType, &filter);
+	if(rc < 0) goto cleanup;
+	for(size_t i = 0; i < numberof(terms); i++) {
+		SLNFilterRef sub = NULL;
+		rc = SLNUserFilterParse(session, terms[i], &sub);
+		if(rc >= 0) rc = walk(sub, txn, +1, expected);
+		if(rc >= 0) rc = SLNFilterAddFilterArg(filter, &sub);
+		SLNFilterFree(&sub);
+		if(rc < 0) goto cleanup;
+	}
+	qsort(expected->items, expected->count, sizeof(*expected->items), pos_cmp);
+	size_t n = 0;
+	for(size_t i = 0; i < expected->count; i++) {
+		if(n && 0 == pos_cmp(&expected->items[n-1], &expected->items[i])) continue;
+		expected->items[n++] = expected->items[i];
+	}
+	expected->count = n;
+
+	for(int dir = +1; dir >= -1; dir -= 2) {
+		actual->count = 0;
+		rc = walk(filter, txn, dir, actual);
+		if(rc < 0) goto cleanup;
+		bool same = actual->count == expected->count;
+		for(size_t i = 0; same && i < n; i++) {
+			size_t const j = dir > 0 ? i : n-1-i;
+			same = 0 == pos_cmp(&actual->items[i], &expected->items[j]);
+		}
+		if(!same) {
+			fprintf(stderr, "filter/check: union order differs (dir %d, %zu vs %zu results)\n", dir, actual->count, n);
+			rc = -1;
+			goto cleanup;
+		}
+	}
+
+cleanup:
+	SLNFilterFree(&filter);
+	kvs_txn_abort(txn); txn = NULL;
+	SLNSessionDBClose(session, &db);
+	FREE(&expected->items);
+	FREE(&actual->items);
+	if(rc < 0) bench_fail("filter/check", rc);
+	return rc;
+}
+
+// Range filters merge per-value cursors when there are only a few values
+// and sort otherwise. Both have to agree with plain metadata filters.
+static int check_same(SLNSessionRef const session, strarg_t const a, strarg_t const b) {
+	KVS_env *db = NULL;
+	KVS_txn *txn = NULL;
+	SLNFilterRef fa = NULL, fb = NULL;
+	positions pa[1] = {}, pb[1] = {};
+	int rc = SLNSessionDBOpen(session, SLN_RDONLY, &db);
+	if(rc < 0) goto cleanup;
+	rc = kvs_txn_begin(db, NULL, KVS_RDONLY, &txn);
+	if(rc < 0) goto cleanup;
+	rc = SLNUserFilterParse(session, a, &fa);
+	if(rc < 0) goto cleanup;
+	rc = SLNUserFilterParse(session, b, &fb);
+	if(rc < 0) goto cleanup;
+	for(int dir = +1; dir >= -1; dir -= 2) {
+		pa->count = 0;
+		pb->count = 0;
+		rc = walk(fa, txn, dir, pa);
+		if(rc < 0) goto cleanup;
+		rc = walk(fb, txn, dir, pb);
+		if(rc < 0) goto cleanup;
+		bool same = pa->count == pb->count;
+		for(size_t i = 0; same && i < pa->count; i++) {
+			same = pa->items[i].fileID == pb->items[i].fileID;
+		}
+		if(!same) {
+			fprintf(stderr, "filter/check: \"%s\" and \"%s\" differ (dir %d, %zu vs %zu results)\n", a, b, dir, pa->count, pb->count);
+			rc = -1;
+			goto cleanup;
+		}
+	}
+
+cleanup:
+	SLNFilterFree(&fa);
+	SLNFilterFree(&fb);
+	kvs_txn_abort(txn); txn = NULL;
+	SLNSessionDBClose(session, &db);
+	FREE(&pa->items);
+	FREE(&pb->items);
+	if(rc < 0) bench_fail("filter/check", rc);
+	return rc;
+}
+
+// Exact match counts in both directions. Going backward, intersections
+// stop as soon as a sub-filter that lists its matches runs dry.
+static int check_count(SLNSessionRef const session, strarg_t const query, uint64_t const expected) {
+	SLNFilterRef filter = NULL;
+	int rc = SLNUserFilterParse(session, query, &filter);
+	if(rc < 0) goto cleanup;
+	for(int dir = +1; dir >= -1; dir -= 2) {
+		SLNFilterPosition pos[1];
+		SLNFilterPositionInit(pos, dir);
+		uint64_t n = 0;
+		rc = SLNFilterCountURIs(filter, session, pos, FILES * 4, &n);
+		SLNFilterPositionCleanup(pos);
+		if(rc < 0) goto cleanup;
+		if(n != expected) {
+			fprintf(stderr, "filter/check: \"%s\" counted %llu, expected %llu (dir %d)\n", query,
+				(unsigned long long)n, (unsigned long long)expected, dir);
+			rc = -1;
+			goto cleanup;
+		}
+	}
+cleanup:
+	SLNFilterFree(&filter);
+	if(rc < 0) bench_fail("filter/check", rc);
+	return rc;
+}
+
+// Estimates are upper bounds on the exact count after start, up to max.
+static int check_estimate(SLNSessionRef const session, strarg_t const query, uint64_t const start, uint64_t const max, uint64_t *const out) {
+	SLNFilterRef filter = NULL;
+	SLNFilterPosition pos[1];
+	SLNFilterPositionInit(pos, +1);
+	if(start) pos->sortID = start;
+	uint64_t exact = 0, estimate = 0;
+	int rc = SLNUserFilterParse(session, query, &filter);
+	if(rc < 0) goto cleanup;
+	rc = SLNFilterEstimateURIs(filter, session, pos, max, &estimate);
+	if(rc < 0) goto cleanup;
+	rc = SLNFilterCountURIs(filter, session, pos, max, &exact);
+	if(rc < 0) goto cleanup;
+	if(estimate < exact || estimate > max) {
+		fprintf(stderr, "filter/check: \"%s\" from %llu estimated %llu, counted %llu (max %llu)\n", query,
+			(unsigned long long)start, (unsigned long long)estimate,
+			(unsigned long long)exact, (unsigned long long)max);
+		rc = -1;
+	}
+	if(out) *out = estimate;
+cleanup:
+	SLNFilterPositionCleanup(pos);
+	SLNFilterFree(&filter);
+	if(rc < 0) bench_fail("filter/check", rc);
+	return rc;
+}
+// Starting halfway through has to leave entries out of the estimate.
+static int check_estimate_start(SLNSessionRef const session, strarg_t const query) {
+	uint64_t all = 0, half = 0;
+	int rc = check_estimate(session, query, 0, FILES * 4, &all);
+	if(rc < 0) return rc;
+	rc = check_estimate(session, query, FILES, FILES * 4, &half);
+	if(rc < 0) return rc;
+	if(half >= all) {
+		fprintf(stderr, "filter/check: \"%s\" estimated %llu from the middle, %llu in all\n", query,
+			(unsigned long long)half, (unsigned long long)all);
+		bench_fail("filter/check", -1);
+		return -1;
+	}
+	return 0;
+}
+
+// What a waiting query sees after one more commit. Only the filters
+// that the new file could match should want to wake up.
+static int might_match(SLNSessionRef const session, KVS_txn *const txn, strarg_t const query, uint64_t const after, uint64_t const latest, bool const expected) {
+	SLNFilterRef filter = NULL;
+	int rc = SLNUserFilterParse(session, query, &filter);
+	if(rc < 0) return rc;
+	bool const match = SLNFilterMightMatch(filter, txn, after, latest);
+	SLNFilterFree(&filter);
+	if(match == expected) return 0;
+	fprintf(stderr, "filter/check: \"%s\" might match %s, expected %s\n", query,
+		match ? "yes" : "no", expected ? "yes" : "no");
+	return -1;
+}
+static int check_might_match(SLNRepoRef const repo, SLNSessionRef const session) {
+	SLNSubmissionRef subs[2] = {};
+	KVS_env *db = NULL;
+	KVS_txn *txn = NULL;
+	str_t buf[URI_MAX * 2];
+	uint64_t const after = SLNRepoSubmissionLatest(repo);
+	int len = snprintf(buf, sizeof(buf), "late file\n");
+	int rc = bench_submission(session, NULL, "text/plain; charset=utf-8", (byte_t const *)buf, len, &subs[0]);
+	if(rc < 0) goto cleanup;
+	strarg_t const URI = SLNSubmissionGetPrimaryURI(subs[0]);
+	len = snprintf(buf, sizeof(buf), "%s\n\n{\"tag\": \"late\", \"link\": \"hash://bench/late\"}", URI);
+	rc = bench_submission(session, URI, SLN_META_TYPE, (byte_t const *)buf, len, &subs[1]);
+	if(rc < 0) goto cleanup;
+	rc = SLNSubmissionStoreBatch(subs, numberof(subs));
+	if(rc < 0) goto cleanup;
+	uint64_t const latest = SLNRepoSubmissionLatest(repo);
+
+	rc = SLNSessionDBOpen(session, SLN_RDONLY, &db);
+	if(rc < 0) goto cleanup;
+	rc = kvs_txn_begin(db, NULL, KVS_RDONLY, &txn);
+	if(rc < 0) goto cleanup;
+	rc = might_match(session, txn, "tag=late", after, latest, true);
+	rc = rc < 0 ? rc : might_match(session, txn, "tag=even", after, latest, false);
+	rc = rc < 0 ? rc : might_match(session, txn, "tag..=la..lb", after, latest, true);
+	rc = rc < 0 ? rc : might_match(session, txn, "tag..=a..b", after, latest, false);
+	rc = rc < 0 ? rc : might_match(session, txn, "tag^=la", after, latest, true);
+	rc = rc < 0 ? rc : might_match(session, txn, "tag^=od", after, latest, false);
+	rc = rc < 0 ? rc : might_match(session, txn, "linked-from=hash://bench/none", after, latest, false);
+	rc = rc < 0 ? rc : might_match(session, txn, "tag=late", latest, latest, false);
+	if(rc < 0) goto cleanup;
+	snprintf(buf, sizeof(buf), "linked-from=%s", URI);
+	rc = might_match(session, txn, buf, after, latest, true);
+
+cleanup:
+	kvs_txn_abort(txn); txn = NULL;
+	SLNSessionDBClose(session, &db);
+	for(size_t i = 0; i < numberof(subs); i++) SLNSubmissionFree(&subs[i]);
+	if(rc < 0) bench_fail("filter/check", rc);
+	return rc;
+}
+
+static void bench(void *const unused) {
+	SLNRepoRef repo = NULL;
+	SLNSessionRef session = NULL;
+	int rc = bench_open(&repo, &session);
+	if(rc < 0) goto cleanup;
+	rc = populate(session);
+	if(rc < 0) goto cleanup;
+
+	check_union(session);
+	check_estimate(session, "*", 0, FILES * 4, NULL);
+	check_estimate(session, "*", 0, PAGE, NULL);
+	check_estimate(session, "tag=even", 0, FILES * 4, NULL);
+	check_estimate(session, "tag=odd title", 0, FILES * 4, NULL);
+	check_estimate(session, "tag=even or link=hash://bench/3", 0, FILES * 4, NULL);
+	check_estimate(session, "link=hash://bench/3", 0, FILES * 4, NULL);
+	check_estimate_start(session, "*");
+	check_estimate_start(session, "tag=even");
+	check_estimate_start(session, "link=hash://bench/3");
+	check_same(session, "tag..=even..odd", "tag=even");
+	check_same(session, "tag..=a..", "tag=even or tag=odd");
+	check_same(session, "title..=\"bench title\"..\"bench titlf\"", "tag=even or tag=odd");
+	check_same(session, "title^=\"bench title 1\"", "title..=\"bench title 1\"..\"bench title 2\"");
+	check_count(session, "recent=yes", RECENT);
+	check_count(session, "recent=yes title", RECENT);
+	check_count(session, "title (-tag=odd -link=hash://bench/3)", FILES / 2);
+	check_might_match(repo, session);
+	run(session, "filter/all/page", "*", PAGE, ROUNDS);
+	run(session, "filter/all/full", "*", FILES, ROUNDS / 20);
+	run(session, "filter/meta/page", "tag=even", PAGE, ROUNDS);
+	run(session, "filter/fulltext/page", "title", PAGE, ROUNDS);
+	run(session, "filter/and/page", "tag=odd title", PAGE, ROUNDS);
+	run(session, "filter/rare-and-common/page", "recent=yes title", PAGE, ROUNDS);
+	run(session, "filter/common/page", "title", PAGE, ROUNDS);
+	run(session, "filter/links/full", "link=hash://bench/3", FILES, ROUNDS / 20);
+
+cleanup:
+	if(rc < 0) bench_fail("filter", rc);
+	bench_close(&repo, &session);
+}
+
+int main(int const argc, char const *const *const argv) {
+	return bench_main(argc, argv, bench);
+}
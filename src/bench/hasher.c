@@ -0,0 +1,95 @@
+// Copyright 2014-2015 Ben Trask
+// MIT licensed (see LICENSE for details)
+
+#include "bench.h"
+
+#define TOTAL (1024 * 1024 * 256)
+
+static void run(strarg_t const name, byte_t const *const buf, size_t const len) {
+	SLNHasherRef hasher = SLNHasherCreate("application/octet-stream");
+	if(!hasher) {
+		bench_fail(name, UV_ENOMEM);
+		return;
+	}
+	uint64_t const count = TOTAL / len;
+	uint64_t const start = bench_now();
+	for(uint64_t i = 0; i < count; i++) {
+		int rc = SLNHasherWrite(hasher, buf, len);
+		if(rc < 0) {
+			bench_fail(name, rc);
+			goto cleanup;
+		}
+	}
+	str_t **URIs = SLNHasherEnd(hasher);
+	uint64_t const end = bench_now();
+	if(!URIs) {
+		bench_fail(name, UV_ENOMEM);
+		goto cleanup;
+	}
+	for(size_t i = 0; URIs[i]; i++) FREE(&URIs[i]);
+	FREE(&URIs);
+	bench_report(name, count, count * len, end - start);
+cleanup:
+	SLNHasherFree(&hasher);
+}
+
+static str_t **hash(byte_t const *const buf, size_t const len, size_t const step) {
+	SLNHasherRef hasher = SLNHasherCreate("application/octet-stream");
+	if(!hasher) return NULL;
+	str_t **URIs = NULL;
+	for(size_t i = 0; i < len; i += step) {
+		if(SLNHasherWrite(hasher, buf+i, MIN(step, len-i)) < 0) goto cleanup;
+	}
+	URIs = SLNHasherEnd(hasher);
+cleanup:
+	SLNHasherFree(&hasher);
+	return URIs;
+}
+// Large writes hash each algorithm on its own thread and small ones
+// don't, so both paths must produce exactly the same URIs.
+static void check(byte_t const *const buf, size_t const len) {
+	str_t **serial = hash(buf, len, 1024 * 4);
+	str_t **parallel = hash(buf, len, len);
+	if(!serial || !parallel) {
+		bench_fail("hasher/check", UV_ENOMEM);
+		goto cleanup;
+	}
+	size_t i = 0;
+	for(; serial[i] && parallel[i]; i++) {
+		if(0 != strcmp(serial[i], parallel[i])) break;
+	}
+	if(serial[i] || parallel[i]) {
+		fprintf(stderr, "hasher/check: %s != %s\n",
+			serial[i] ? serial[i] : "(none)",
+			parallel[i] ? parallel[i] : "(none)");
+		bench_fail("hasher/check", -1);
+	}
+cleanup:
+	if(serial) for(size_t i = 0; serial[i]; i++) FREE(&serial[i]);
+	if(parallel) for(size_t i = 0; parallel[i]; i++) FREE(&parallel[i]);
+	FREE(&serial);
+	FREE(&parallel);
+}
+
+static void bench(void *const unused) {
+	size_t const len = 1024 * 1024;
+	byte_t *buf = malloc(len);
+	if(!buf) {
+		bench_fail("hasher", UV_ENOMEM);
+		return;
+	}
+	for(size_t i = 0; i < len; i++) buf[i] = (byte_t)(i * 2654435761u >> 24);
+
+	check(buf, len);
+
+	// Small writes take the serial path, large ones hash in parallel.
+	run("hasher/4KB", buf, 1024 * 4);
+	run("hasher/64KB", buf, 1024 * 64);
+	run("hasher/1MB", buf, len);
+
+	FREE(&buf);
+}
+
+int main(int const argc, char const *const *const argv) {
+	return bench_main(argc, argv, bench);
+}
@@ -0,0 +1,222 @@
+// Copyright 2014-2015 Ben Trask
+// MIT licensed (see LICENSE for details)
+
+#include <unistd.h>
+#include <async/http/HTTPServer.h>
+#include "bench.h"
+
+// Checks conditional and range requests for /sln/file against a local
+// server. Not really a benchmark, but it needs the same scaffolding.
+
+#define PORT_FIRST 20000
+#define PORT_TRIES 100
+#define TYPE "text/plain; charset=utf-8"
+#define BODY "0123456789abcdefghijklmnopqrstuvwxyz"
+#define BODY_MAX 1024 // Room for multipart replies.
+
+int SLNServerDispatch(SLNRepoRef const repo, SLNSessionRef const session, HTTPConnectionRef const conn, HTTPMethod const method, strarg_t const URI, HTTPHeadersRef const headers);
+
+static SLNRepoRef repo = NULL;
+static SLNSessionRef session = NULL;
+static str_t host[32];
+
+static void listener(void *ctx, HTTPServerRef const server, HTTPConnectionRef const conn) {
+	HTTPMethod method = 99; // 0 is HTTP_DELETE...
+	str_t URI[URI_MAX]; URI[0] = '\0';
+	HTTPHeadersRef headers = NULL;
+	int rc = 0;
+	ssize_t const len = HTTPConnectionReadRequest(conn, &method, URI, sizeof(URI));
+	if(len < 0) rc = (int)len;
+	if(rc < 0) goto cleanup;
+	rc = HTTPHeadersCreateFromConnection(conn, &headers);
+	if(rc < 0) goto cleanup;
+	rc = SLNServerDispatch(repo, session, conn, method, URI, headers);
+	if(rc < 0) rc = 404;
+	if(rc > 0) HTTPConnectionSendStatus(conn, rc);
+cleanup:
+	HTTPHeadersFree(&headers);
+}
+
+typedef struct {
+	strarg_t name;
+	strarg_t range;
+	strarg_t ifrange; // "=" means our own ETag
+	strarg_t ifnonematch;
+	int status;
+	strarg_t body; // NULL for multipart/byteranges
+	size_t count;
+	struct { unsigned first, last; } parts[2];
+} request;
+
+// Our ETag is the quoted internal hash.
+static request const requests[] = {
+	{ "plain", NULL, NULL, NULL, 200, BODY },
+	{ "if-none-match", NULL, NULL, "=", 304, "" },
+	{ "if-none-match/other", NULL, NULL, "\"other\"", 200, BODY },
+	{ "range", "bytes=2-5", NULL, NULL, 206, "2345" },
+	{ "range/suffix", "bytes=-3", NULL, NULL, 206, "xyz" },
+	{ "range/unsatisfiable", "bytes=100-", NULL, NULL, 416, "" },
+	{ "range/malformed", "bytes=5-2", NULL, NULL, 200, BODY },
+	{ "range/multi", "bytes=2-5,10-12", NULL, NULL, 206, NULL, 2, {{ 2, 5 }, { 10, 12 }} },
+	{ "range/multi-suffix", "bytes=0-0,-3", NULL, NULL, 206, NULL, 2, {{ 0, 0 }, { 33, 35 }} },
+	{ "range/multi-partial", "bytes=2-5,100-", NULL, NULL, 206, "2345" },
+	{ "if-range", "bytes=2-5", "=", NULL, 206, "2345" },
+	{ "if-range/other", "bytes=2-5", "\"other\"", NULL, 200, BODY },
+	{ "if-range/weak", "bytes=2-5", "W/=", NULL, 200, BODY },
+	{ "if-range/star", "bytes=2-5", "*", NULL, 200, BODY },
+};
+
+static strarg_t header_value(strarg_t const value, strarg_t const etag, str_t *const buf, size_t const size) {
+	if(!value) return NULL;
+	if(0 == strcmp(value, "=")) return etag;
+	if(0 == strcmp(value, "W/=")) {
+		snprintf(buf, size, "W/%s", etag);
+		return buf;
+	}
+	return value;
+}
+// The boundary is random, so we can only build the expected reply
+// once we have the Content-Type.
+static int multipart_body(request const *const req, strarg_t const type, str_t *const out, size_t const size) {
+	strarg_t const boundary = type ? strstr(type, "boundary=") : NULL;
+	if(!boundary || 0 != strncmp(type, "multipart/byteranges;", 21)) {
+		snprintf(out, size, "(Content-Type %s)", type ? type : "missing");
+		return 0;
+	}
+	strarg_t const b = boundary+9;
+	size_t len = 0;
+	for(size_t i = 0; i < req->count; i++) {
+		unsigned const first = req->parts[i].first;
+		unsigned const last = req->parts[i].last;
+		len += snprintf(out+len, size-len, "\r\n--%s\r\n"
+			"Content-Type: %s\r\n"
+			"Content-Range: bytes %u-%u/%u\r\n"
+			"\r\n"
+			"%.*s",
+			b, TYPE, first, last, (unsigned)sizeof(BODY)-1,
+			(int)(last-first+1), BODY+first);
+		if(len >= size) return UV_EMSGSIZE;
+	}
+	len += snprintf(out+len, size-len, "\r\n--%s--\r\n", b);
+	if(len >= size) return UV_EMSGSIZE;
+	return 0;
+}
+static int check(strarg_t const path, strarg_t const etag, request const *const req) {
+	HTTPConnectionRef conn = NULL;
+	HTTPHeadersRef headers = NULL;
+	str_t buf[SLN_HASH_SIZE+4];
+	str_t body[BODY_MAX];
+	str_t multipart[BODY_MAX];
+	size_t len = 0;
+	int status = 0;
+	int rc = HTTPConnectionConnect(host, NULL, false, 0, &conn);
+	if(rc < 0) goto cleanup;
+
+	strarg_t const ifrange = header_value(req->ifrange, etag, buf, sizeof(buf));
+	strarg_t const ifnonematch = header_value(req->ifnonematch, etag, buf, sizeof(buf));
+	rc = rc < 0 ? rc : HTTPConnectionWriteRequest(conn, HTTP_GET, path, host);
+	if(req->range) rc = rc < 0 ? rc : HTTPConnectionWriteHeader(conn, "Range", req->range);
+	if(ifrange) rc = rc < 0 ? rc : HTTPConnectionWriteHeader(conn, "If-Range", ifrange);
+	if(ifnonematch) rc = rc < 0 ? rc : HTTPConnectionWriteHeader(conn, "If-None-Match", ifnonematch);
+	rc = rc < 0 ? rc : HTTPConnectionBeginBody(conn);
+	rc = rc < 0 ? rc : HTTPConnectionEnd(conn);
+	if(rc < 0) goto cleanup;
+
+	rc = HTTPConnectionReadResponseStatus(conn, &status);
+	if(rc < 0) goto cleanup;
+	rc = HTTPHeadersCreateFromConnection(conn, &headers);
+	if(rc < 0) goto cleanup;
+	for(;;) {
+		uv_buf_t read[1];
+		rc = HTTPConnectionReadBody(conn, read);
+		if(rc < 0) goto cleanup;
+		if(0 == read->len) break;
+		if(len + read->len >= sizeof(body)) rc = UV_EMSGSIZE;
+		if(rc < 0) goto cleanup;
+		memcpy(body+len, read->base, read->len);
+		len += read->len;
+	}
+	body[len] = '\0';
+
+	strarg_t expected = req->body;
+	if(!expected) {
+		strarg_t const type = HTTPHeadersGet(headers, "content-type");
+		rc = multipart_body(req, type, multipart, sizeof(multipart));
+		if(rc < 0) goto cleanup;
+		expected = multipart;
+	}
+	if(status != req->status || 0 != strcmp(body, expected)) {
+		fprintf(stderr, "http/%s: got %d \"%s\", expected %d \"%s\"\n",
+			req->name, status, body, req->status, expected);
+		rc = -1;
+	}
+
+cleanup:
+	HTTPHeadersFree(&headers);
+	HTTPConnectionFree(&conn);
+	if(rc < 0) bench_fail(req->name, rc);
+	return rc;
+}
+
+// Fixed ports collide with anything else on the machine (including
+// another run of this), so start from one that depends on our pid and
+// move on while they're taken.
+static int listen_any(HTTPServerRef *const server) {
+	int const first = PORT_FIRST + getpid() % 10000;
+	int rc = 0;
+	for(int port = first; port < first + PORT_TRIES; port++) {
+		rc = HTTPServerCreate((HTTPListener)listener, NULL, server);
+		if(rc < 0) return rc;
+		rc = HTTPServerListen(*server, "localhost", port);
+		if(rc >= 0) {
+			snprintf(host, sizeof(host), "localhost:%d", port);
+			return 0;
+		}
+		HTTPServerFree(server);
+		if(UV_EADDRINUSE != rc) return rc;
+	}
+	return rc;
+}
+
+static void bench(void *const unused) {
+	HTTPServerRef server = NULL;
+	SLNSubmissionRef sub = NULL;
+	int rc = bench_open(&repo, &session);
+	if(rc < 0) goto cleanup;
+
+	rc = bench_submission(session, NULL, TYPE, (byte_t const *)BODY, sizeof(BODY)-1, &sub);
+	if(rc < 0) goto cleanup;
+	rc = SLNSubmissionStoreBatch(&sub, 1);
+	if(rc < 0) goto cleanup;
+
+	str_t algo[SLN_ALGO_SIZE];
+	str_t hash[SLN_HASH_SIZE];
+	SLNParseURI(SLNSubmissionGetPrimaryURI(sub), algo, hash);
+	str_t path[URI_MAX];
+	snprintf(path, sizeof(path), "/sln/file/%s/%s", algo, hash);
+
+	// GET_file uses the internal hash, whatever URI we asked for.
+	SLNFileInfo info[1];
+	rc = SLNSessionGetFileInfo(session, SLNSubmissionGetPrimaryURI(sub), info);
+	if(rc < 0) goto cleanup;
+	str_t etag[SLN_HASH_SIZE+2];
+	snprintf(etag, sizeof(etag), "\"%s\"", info->hash);
+	SLNFileInfoCleanup(info);
+
+	rc = listen_any(&server);
+	if(rc < 0) goto cleanup;
+
+	for(size_t i = 0; i < numberof(requests); i++) {
+		check(path, etag, &requests[i]);
+	}
+
+cleanup:
+	if(rc < 0) bench_fail("http", rc);
+	HTTPServerFree(&server);
+	SLNSubmissionFree(&sub);
+	bench_close(&repo, &session);
+}
+
+int main(int const argc, char const *const *const argv) {
+	return bench_main(argc, argv, bench);
+}
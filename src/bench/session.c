@@ -0,0 +1,146 @@
+// Copyright 2014-2015 Ben Trask
+// MIT licensed (see LICENSE for details)
+
+#include "bench.h"
+
+#define LOOKUPS (1000 * 100)
+
+typedef struct {
+	SLNSessionRef session;
+	strarg_t username;
+	strarg_t password;
+} user_commit;
+static int create_user_cb(void *const ctx, KVS_txn *const txn, uint64_t *const sortID) {
+	user_commit const *const u = ctx;
+	return SLNSessionCreateUserInternal(u->session, txn, u->username, u->password, SLN_RDWR);
+}
+static int create_user(SLNSessionRef const session, strarg_t const username, strarg_t const password) {
+	user_commit u[1] = {{ session, username, password }};
+	return SLNRepoCommit(SLNSessionGetRepo(session), create_user_cb, u);
+}
+
+// Fibers on pool threads looking up more sessions than a small cache can
+// hold, so lookups, evictions and reloads from the database race each
+// other on several threads at once. Every lookup must come back with the
+// session its cookie names.
+#define STRESS_SESSIONS 32
+#define STRESS_CACHE 16
+#define STRESS_FIBERS 8
+#define STRESS_LOOKUPS (1000 * 5)
+
+typedef struct {
+	SLNSessionCacheRef cache;
+	str_t **cookies;
+	uint64_t *ids;
+	uint32_t seed;
+	async_sem_t *done;
+	int rc;
+} stress_fiber;
+
+static void stress(void *const arg) {
+	stress_fiber *const f = arg;
+	uint32_t x = f->seed;
+	async_pool_enter(NULL);
+	for(size_t i = 0; i < STRESS_LOOKUPS; i++) {
+		x ^= x << 13; x ^= x >> 17; x ^= x << 5; // xorshift32
+		size_t const n = x % STRESS_SESSIONS;
+		SLNSessionRef s = NULL;
+		int rc = SLNSessionCacheCopyActiveSession(f->cache, f->cookies[n], &s);
+		if(rc >= 0 && SLNSessionGetID(s) != f->ids[n]) rc = UV_EACCES;
+		SLNSessionRelease(&s);
+		if(rc < 0) {
+			f->rc = rc;
+			break;
+		}
+	}
+	async_pool_leave(NULL);
+	async_sem_post(f->done);
+}
+static int stress_cache(SLNRepoRef const repo) {
+	SLNSessionCacheRef cache = NULL;
+	str_t *cookies[STRESS_SESSIONS] = {};
+	uint64_t ids[STRESS_SESSIONS] = {};
+	stress_fiber fibers[STRESS_FIBERS];
+	async_sem_t done[1];
+	async_sem_init(done, 0, 0);
+	int rc = SLNSessionCacheCreate(repo, STRESS_CACHE, &cache);
+	if(rc < 0) goto cleanup;
+	for(size_t i = 0; i < STRESS_SESSIONS; i++) {
+		SLNSessionRef s = NULL;
+		rc = SLNSessionCacheCreateSession(cache, "benchuser", "benchpass", &s);
+		if(rc < 0) goto cleanup;
+		ids[i] = SLNSessionGetID(s);
+		cookies[i] = SLNSessionCopyCookie(s);
+		SLNSessionRelease(&s);
+		if(!cookies[i]) rc = UV_ENOMEM;
+		if(rc < 0) goto cleanup;
+	}
+
+	uint64_t const start = bench_now();
+	size_t spawned = 0;
+	for(; spawned < STRESS_FIBERS; spawned++) {
+		fibers[spawned] = (stress_fiber){
+			.cache = cache,
+			.cookies = cookies,
+			.ids = ids,
+			.seed = 2463534242 + spawned,
+			.done = done,
+			.rc = 0,
+		};
+		rc = async_spawn(STACK_DEFAULT, stress, &fibers[spawned]);
+		if(rc < 0) break;
+	}
+	for(size_t i = 0; i < spawned; i++) async_sem_wait(done);
+	for(size_t i = 0; i < spawned; i++) {
+		if(fibers[i].rc < 0) rc = fibers[i].rc;
+	}
+	if(rc < 0) goto cleanup;
+	bench_report("session/cache-stress", spawned * STRESS_LOOKUPS, 0, bench_now() - start);
+
+cleanup:
+	if(rc < 0) bench_fail("session/cache-stress", rc);
+	for(size_t i = 0; i < STRESS_SESSIONS; i++) FREE(&cookies[i]);
+	SLNSessionCacheFree(&cache);
+	async_sem_destroy(done);
+	return rc;
+}
+
+static void bench(void *const unused) {
+	SLNRepoRef repo = NULL;
+	SLNSessionRef session = NULL;
+	SLNSessionRef user = NULL;
+	str_t *cookie = NULL;
+	int rc = bench_open(&repo, &session);
+	if(rc < 0) goto cleanup;
+	SLNSessionCacheRef const cache = SLNRepoGetSessionCache(repo);
+
+	rc = create_user(session, "benchuser", "benchpass");
+	if(rc < 0) goto cleanup;
+	rc = SLNSessionCacheCreateSession(cache, "benchuser", "benchpass", &user);
+	if(rc < 0) goto cleanup;
+	cookie = SLNSessionCopyCookie(user);
+	if(!cookie) rc = UV_ENOMEM;
+	if(rc < 0) goto cleanup;
+
+	uint64_t const start = bench_now();
+	for(size_t i = 0; i < LOOKUPS; i++) {
+		SLNSessionRef s = NULL;
+		rc = SLNSessionCacheCopyActiveSession(cache, cookie, &s);
+		if(rc >= 0 && SLNSessionGetID(s) != SLNSessionGetID(user)) rc = UV_EACCES;
+		SLNSessionRelease(&s);
+		if(rc < 0) goto cleanup;
+	}
+	bench_report("session/cache-hit", LOOKUPS, 0, bench_now() - start);
+
+	stress_cache(repo);
+
+cleanup:
+	if(rc < 0) bench_fail("session", rc);
+	FREE(&cookie);
+	SLNSessionRelease(&user);
+	bench_close(&repo, &session);
+}
+
+int main(int const argc, char const *const *const argv) {
+	return bench_main(argc, argv, bench);
+}
@@ -0,0 +1,166 @@
+// Copyright 2014-2015 Ben Trask
+// MIT licensed (see LICENSE for details)
+
+#include "bench.h"
+
+#define BATCHES 64
+#define BATCH_SIZE 64
+#define FILE_SIZE 1024
+#define CHECK_SIZE (1024 * 64) // Well above PIPELINE_MIN.
+#define CHECK_STEP (1024 * 4) // Well below it.
+
+// Writes buf in pieces of `step`. Ending fails if knownURI isn't one
+// of the URIs we hashed.
+static int submit(SLNSessionRef const session, strarg_t const knownURI, byte_t const *const buf, size_t const len, size_t const step, SLNSubmissionRef *const out) {
+	SLNSubmissionRef sub = NULL;
+	int rc = SLNSubmissionCreate(session, knownURI, NULL, &sub);
+	if(rc < 0) goto cleanup;
+	rc = SLNSubmissionSetType(sub, "application/octet-stream");
+	if(rc < 0) goto cleanup;
+	for(size_t i = 0; i < len; i += step) {
+		rc = SLNSubmissionWrite(sub, buf+i, MIN(step, len-i));
+		if(rc < 0) goto cleanup;
+	}
+	rc = SLNSubmissionEnd(sub);
+	if(rc < 0) goto cleanup;
+	*out = sub; sub = NULL;
+cleanup:
+	SLNSubmissionFree(&sub);
+	return rc;
+}
+static int check_contents(SLNSubmissionRef const sub, byte_t const *const buf, size_t const len) {
+	SLNFileInfo info[1];
+	byte_t *stored = NULL;
+	uv_file file = -1;
+	int rc = SLNSubmissionGetFileInfo(sub, info);
+	if(rc < 0) return rc;
+	stored = malloc(len+1);
+	if(!stored) rc = UV_ENOMEM;
+	if(rc < 0) goto cleanup;
+	file = async_fs_open(info->path, O_RDONLY, 0000);
+	if(file < 0) rc = (int)file;
+	if(rc < 0) goto cleanup;
+	uv_buf_t parts[] = { uv_buf_init((char *)stored, len+1) };
+	ssize_t const n = async_fs_readall_simple(file, parts);
+	if(n < 0) rc = (int)n;
+	if(rc < 0) goto cleanup;
+	if(len != (size_t)n || 0 != memcmp(buf, stored, len)) {
+		fprintf(stderr, "store/check: %s differs from what we wrote\n", info->path);
+		rc = -1;
+	}
+cleanup:
+	if(file >= 0) async_fs_close(file);
+	file = -1;
+	FREE(&stored);
+	SLNFileInfoCleanup(info);
+	return rc;
+}
+static int copy_synonyms(SLNSessionRef const session, strarg_t const URI, str_t ***const out) {
+	KVS_env *db = NULL;
+	KVS_txn *txn = NULL;
+	int rc = SLNSessionDBOpen(session, SLN_RDONLY, &db);
+	if(rc < 0) goto cleanup;
+	rc = kvs_txn_begin(db, NULL, KVS_RDONLY, &txn);
+	if(rc < 0) goto cleanup;
+	rc = SLNFilterCopyURISynonyms(txn, URI, out);
+cleanup:
+	kvs_txn_abort(txn); txn = NULL;
+	SLNSessionDBClose(session, &db);
+	return rc;
+}
+// Large writes go to disk on their own fiber while we hash, and small
+// ones don't. Both must store the same bytes under the same URIs.
+static void check(SLNSessionRef const session) {
+	SLNSubmissionRef pipelined = NULL;
+	SLNSubmissionRef serial = NULL;
+	SLNSubmissionRef known = NULL;
+	str_t **URIs = NULL;
+	byte_t *buf = malloc(CHECK_SIZE);
+	int rc = buf ? 0 : UV_ENOMEM;
+	if(rc < 0) goto cleanup;
+	rc = async_random(buf, CHECK_SIZE);
+	if(rc < 0) goto cleanup;
+
+	// The first one stored is the copy that stays on disk.
+	rc = submit(session, NULL, buf, CHECK_SIZE, CHECK_SIZE, &pipelined);
+	if(rc < 0) goto cleanup;
+	rc = SLNSubmissionStoreBatch(&pipelined, 1);
+	if(rc < 0) goto cleanup;
+	rc = check_contents(pipelined, buf, CHECK_SIZE);
+	if(rc < 0) goto cleanup;
+
+	rc = submit(session, NULL, buf, CHECK_SIZE, CHECK_STEP, &serial);
+	if(rc < 0) goto cleanup;
+	rc = SLNSubmissionStoreBatch(&serial, 1);
+	if(rc < 0) goto cleanup;
+	if(SLNSubmissionGetFileID(pipelined) != SLNSubmissionGetFileID(serial)) {
+		fprintf(stderr, "store/check: %s != %s\n",
+			SLNSubmissionGetPrimaryURI(pipelined),
+			SLNSubmissionGetPrimaryURI(serial));
+		rc = -1;
+		goto cleanup;
+	}
+
+	// Every URI either path recorded has to come out of both.
+	rc = copy_synonyms(session, SLNSubmissionGetPrimaryURI(serial), &URIs);
+	if(rc < 0) goto cleanup;
+	static size_t const steps[] = { CHECK_STEP, CHECK_SIZE };
+	for(size_t i = 0; URIs[i]; i++) {
+		for(size_t j = 0; j < numberof(steps); j++) {
+			rc = submit(session, URIs[i], buf, CHECK_SIZE, steps[j], &known);
+			SLNSubmissionFree(&known);
+			if(SLN_HASHMISMATCH == rc) {
+				fprintf(stderr, "store/check: %s missing with %zu byte writes\n", URIs[i], steps[j]);
+			}
+			if(rc < 0) goto cleanup;
+		}
+	}
+
+cleanup:
+	if(rc < 0) bench_fail("store/check", rc);
+	if(URIs) for(size_t i = 0; URIs[i]; i++) FREE(&URIs[i]);
+	FREE(&URIs);
+	SLNSubmissionFree(&pipelined);
+	SLNSubmissionFree(&serial);
+	FREE(&buf);
+}
+
+static void bench(void *const unused) {
+	SLNRepoRef repo = NULL;
+	SLNSessionRef session = NULL;
+	SLNSubmissionRef subs[BATCH_SIZE] = {};
+	byte_t buf[FILE_SIZE];
+	uint64_t total = 0;
+	uint64_t elapsed = 0;
+	int rc = bench_open(&repo, &session);
+	if(rc < 0) goto cleanup;
+
+	check(session);
+
+	memset(buf, 'x', sizeof(buf));
+	for(size_t i = 0; i < BATCHES; i++) {
+		for(size_t j = 0; j < BATCH_SIZE; j++) {
+			// Unique content so every submission is a new file.
+			uint64_t const n = i * BATCH_SIZE + j;
+			memcpy(buf, &n, sizeof(n));
+			rc = bench_submission(session, NULL, "text/plain; charset=utf-8", buf, sizeof(buf), &subs[j]);
+			if(rc < 0) goto cleanup;
+		}
+		uint64_t const start = bench_now();
+		rc = SLNSubmissionStoreBatch(subs, BATCH_SIZE);
+		elapsed += bench_now() - start;
+		if(rc < 0) goto cleanup;
+		for(size_t j = 0; j < BATCH_SIZE; j++) SLNSubmissionFree(&subs[j]);
+		total += BATCH_SIZE;
+	}
+	bench_report("store/batch64", total, 0, elapsed);
+
+cleanup:
+	if(rc < 0) bench_fail("store", rc);
+	for(size_t j = 0; j < BATCH_SIZE; j++) SLNSubmissionFree(&subs[j]);
+	bench_close(&repo, &session);
+}
+
+int main(int const argc, char const *const *const argv) {
+	return bench_main(argc, argv, bench);
+}
@@ -0,0 +1,147 @@
+// Copyright 2015 Ben Trask
+// MIT licensed (see LICENSE for details)
+
+#include "bench.h"
+
+#define FILES 256
+#define WORKERS 4
+
+// Stands in for the remote repo: contents we can hand to the sync
+// workers by URI, without storing them here first.
+typedef struct {
+	str_t URI[SLN_URI_MAX];
+	strarg_t type;
+	str_t buf[URI_MAX * 2];
+	size_t len;
+} remote_file;
+
+static remote_file remote_files[FILES];
+static remote_file remote_metas[FILES];
+static SLNSyncRef syncref = NULL;
+static size_t jobs = 0; // Downloads left for the workers.
+
+static int remote_add(SLNSessionRef const session, remote_file *const file, strarg_t const target, strarg_t const type) {
+	SLNSubmissionRef sub = NULL;
+	int rc = bench_submission(session, target, type, (byte_t const *)file->buf, file->len, &sub);
+	if(rc < 0) return rc;
+	strlcpy(file->URI, SLNSubmissionGetPrimaryURI(sub), sizeof(file->URI));
+	file->type = type;
+	SLNSubmissionFree(&sub);
+	return 0;
+}
+static int remote_init(SLNSessionRef const session) {
+	for(size_t i = 0; i < FILES; i++) {
+		remote_file *const file = &remote_files[i];
+		remote_file *const meta = &remote_metas[i];
+		file->len = snprintf(file->buf, sizeof(file->buf), "sync file %zu\n", i);
+		int rc = remote_add(session, file, NULL, "text/plain; charset=utf-8");
+		if(rc < 0) return rc;
+		meta->len = snprintf(meta->buf, sizeof(meta->buf),
+			"%s\n\n{\"title\": \"sync title %zu\"}", file->URI, i);
+		rc = remote_add(session, meta, file->URI, SLN_META_TYPE);
+		if(rc < 0) return rc;
+	}
+	return 0;
+}
+static remote_file const *remote_find(strarg_t const URI) {
+	for(size_t i = 0; i < FILES; i++) {
+		if(0 == strcmp(remote_files[i].URI, URI)) return &remote_files[i];
+		if(0 == strcmp(remote_metas[i].URI, URI)) return &remote_metas[i];
+	}
+	return NULL;
+}
+
+// Plays the part of SLNPull's download workers.
+static void worker(void *const arg) {
+	int rc = 0;
+	while(jobs > 0) {
+		jobs--;
+		SLNSubmissionRef sub = NULL;
+		rc = SLNSyncWorkAwait(syncref, &sub);
+		if(rc < 0) break;
+		remote_file const *const file = remote_find(SLNSubmissionGetKnownURI(sub));
+		if(!file) rc = UV_ENOENT;
+		rc = rc < 0 ? rc : SLNSubmissionSetType(sub, file->type);
+		rc = rc < 0 ? rc : SLNSubmissionWrite(sub, (byte_t const *)file->buf, file->len);
+		rc = rc < 0 ? rc : SLNSubmissionEnd(sub);
+		rc = rc < 0 ? rc : SLNSyncWorkDone(syncref, sub);
+		if(rc < 0) break;
+	}
+	if(rc < 0) bench_fail("sync/worker", rc);
+}
+// Even meta-files arrive before their targets, so they get stored as
+// dependencies of the target through the hint table.
+static void file_reader(void *const arg) {
+	int rc = 0;
+	for(size_t i = 0; i < FILES; i++) {
+		if(0 == i % 2) {
+			rc = SLNSyncIngestMetaURI(syncref, remote_metas[i].URI, remote_files[i].URI);
+			if(rc < 0) break;
+		}
+		rc = SLNSyncIngestFileURI(syncref, remote_files[i].URI);
+		if(rc < 0) break;
+	}
+	if(rc < 0) bench_fail("sync/file-reader", rc);
+}
+// Odd meta-files arrive after their targets, through the meta queue.
+static void meta_reader(void *const arg) {
+	int rc = 0;
+	for(size_t i = 1; i < FILES; i += 2) {
+		rc = SLNSyncIngestMetaURI(syncref, remote_metas[i].URI, remote_files[i].URI);
+		if(rc < 0) break;
+	}
+	if(rc < 0) bench_fail("sync/meta-reader", rc);
+}
+// Stores batches until `last` is recorded. Everything is stored in
+// order, so that means everything before it is stored too.
+static int store_until(bool const meta, strarg_t const last) {
+	str_t fileURI[SLN_URI_MAX];
+	str_t metaURI[SLN_URI_MAX];
+	for(;;) {
+		int rc = SLNSyncCopyLastSubmissionURIs(syncref, fileURI, metaURI);
+		if(rc < 0) return rc;
+		if(0 == strcmp(meta ? metaURI : fileURI, last)) return 0;
+		rc = SLNSyncStoreAwait(syncref, meta);
+		if(rc < 0) return rc;
+	}
+}
+
+static void bench(void *const arg) {
+	SLNRepoRef repo = NULL;
+	SLNSessionRef session = NULL;
+	int rc = bench_open(&repo, &session);
+	if(rc < 0) goto cleanup;
+	rc = remote_init(session);
+	if(rc < 0) goto cleanup;
+	rc = SLNSyncCreate(session, &syncref);
+	if(rc < 0) goto cleanup;
+
+	uint64_t const start = bench_now();
+	jobs = FILES * 2;
+	for(size_t i = 0; i < WORKERS; i++) {
+		async_spawn(STACK_DEFAULT, worker, NULL);
+	}
+	async_spawn(STACK_DEFAULT, file_reader, NULL);
+	rc = store_until(false, remote_files[FILES-1].URI);
+	if(rc < 0) goto cleanup;
+	async_spawn(STACK_DEFAULT, meta_reader, NULL);
+	rc = store_until(true, remote_metas[FILES-1].URI);
+	if(rc < 0) goto cleanup;
+	bench_report("sync/pull", FILES * 2, 0, bench_now() - start);
+
+	for(size_t i = 0; i < FILES; i++) {
+		rc = SLNSyncFileAvailable(syncref, remote_files[i].URI, NULL);
+		if(rc < 0) goto cleanup;
+		rc = SLNSyncFileAvailable(syncref, remote_metas[i].URI, NULL);
+		if(rc < 0) goto cleanup;
+	}
+
+cleanup:
+	if(rc < 0) bench_fail("sync", rc);
+	SLNSyncFree(&syncref);
+	bench_close(&repo, &session);
+}
+
+int main(int const argc, char const *const *const argv) {
+	return bench_main(argc, argv, bench);
+}
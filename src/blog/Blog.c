@@ -15,6 +15,7 @@
 #define RESULTS_MAX 10
 #define BUFFER_SIZE (1024 * 8)
 #define AUTH_FORM_MAX (1023+1)
+#define PAGE_SIZE_MAX (1024 * 256)
 
 
 static str_t *BlogCopyPreviewPath(BlogRef const blog, strarg_t const hash) {
@@ -75,35 +76,282 @@ static void gen_preview(BlogRef const blog, SLNSessionRef const session, strarg_
 	async_cond_broadcast(blog->pending_cond);
 	async_mutex_unlock(blog->pending_mutex);
 }
-static int send_preview(BlogRef const blog, HTTPConnectionRef const conn, SLNSessionRef const session, strarg_t const URI, strarg_t const path) {
+
+// Generates previews for new submissions ahead of time, so the first
+// visitor after an ingest doesn't have to wait for the conversions.
+// Each wakeup only looks at the newest PREGEN_MAX files, which bounds
+// the backlog during large bursts. Anything we skip is still generated
+// lazily by send_preview().
+static int pregen(BlogRef const blog, SLNSessionRef const session) {
+	SLNFilterRef filter = NULL;
+	SLNFilterPosition pos[1];
+	str_t *URIs[PREGEN_MAX];
+	int rc = SLNFilterCreate(session, SLNVisibleFilterType, &filter);
+	if(rc < 0) return rc;
+	SLNFilterPositionInit(pos, -1);
+	ssize_t const count = SLNFilterCopyURIs(filter, session, pos, -1, false, URIs, numberof(URIs));
+	SLNFilterPositionCleanup(pos);
+	SLNFilterFree(&filter);
+	if(count < 0) return count;
+
+	for(size_t i = 0; i < count; i++) {
+		str_t algo[SLN_ALGO_SIZE]; // SLN_INTERNAL_ALGO
+		str_t hash[SLN_HASH_SIZE];
+		SLNParseURI(URIs[i], algo, hash);
+		str_t *previewPath = BlogCopyPreviewPath(blog, hash);
+		if(previewPath && blog->pregen_run) {
+			uv_file const file = async_fs_open(previewPath, O_RDONLY, 0000);
+			if(file >= 0) async_fs_close(file);
+			if(UV_ENOENT == file) gen_preview(blog, session, URIs[i], previewPath);
+		}
+		FREE(&previewPath);
+		FREE(&URIs[i]);
+	}
+	assert_zeroed(URIs, count);
+	return 0;
+}
+static void pregen_worker(void *const arg) {
+	BlogRef const blog = arg;
+	SLNSessionCacheRef const cache = SLNRepoGetSessionCache(blog->repo);
+	SLNSessionRef session = NULL;
+	uint64_t latest = 0;
+	int rc = SLNSessionCreateInternal(cache, 0, NULL, NULL, 0, SLN_ROOT, NULL, &session);
+	while(rc >= 0 && blog->pregen_run) {
+		// BlogStop() cancels the wait, so the timeout can be long.
+		uint64_t const timeout = uv_now(async_loop)+(1000 * 30);
+		rc = SLNRepoSubmissionWait(blog->repo, &latest, timeout, NULL, blog);
+		if(UV_ETIMEDOUT == rc) { rc = 0; continue; }
+		if(UV_ECANCELED == rc) { rc = 0; continue; }
+		if(rc < 0) break;
+		rc = pregen(blog, session);
+		if(rc < 0) {
+			// Keep going, the lazy path will retry anyway.
+			alogf("Preview generation error: %s\n", sln_strerror(rc));
+			rc = 0;
+		}
+	}
+	if(rc < 0) alogf("Preview worker error: %s\n", sln_strerror(rc));
+	SLNSessionRelease(&session);
+
+	async_mutex_lock(blog->pending_mutex);
+	blog->pregen_active = false;
+	async_cond_broadcast(blog->pending_cond);
+	async_mutex_unlock(blog->pending_mutex);
+}
+
+// Rendered query pages, mostly for the front page. A page can only change
+// when a submission lands, so each one is tagged with the repo's latest
+// submission and dropped as soon as that moves on. Pages are keyed by user
+// and session mode, since both change what the page may show.
+struct blog_page {
+	unsigned refcount;
+	str_t *qs;
+	uint64_t userID;
+	SLNMode mode;
+	uint64_t latest;
+	uint64_t used;
+	uint16_t status;
+	char *body;
+	size_t len;
+};
+static void page_release(blog_page **const pageptr) {
+	blog_page *page = *pageptr;
+	if(!page) return;
+	*pageptr = NULL;
+	assert(page->refcount > 0);
+	if(--page->refcount) return;
+	FREE(&page->qs);
+	FREE(&page->body);
+	page->userID = 0;
+	page->mode = 0;
+	page->latest = 0;
+	page->used = 0;
+	page->status = 0;
+	page->len = 0;
+	assert_zeroed(page, 1);
+	FREE(&page);
+}
+static blog_page *page_lookup(BlogRef const blog, strarg_t const qs, uint64_t const userID, SLNMode const mode, uint64_t const latest) {
+	for(size_t i = 0; i < PAGE_CACHE_MAX; i++) {
+		blog_page *const page = blog->pages[i];
+		if(!page) continue;
+		if(latest != page->latest) {
+			page_release(&blog->pages[i]);
+			continue;
+		}
+		if(userID != page->userID) continue;
+		if(mode != page->mode) continue;
+		if(0 != strcmp(qs, page->qs)) continue;
+		page->used = ++blog->page_clock;
+		page->refcount++;
+		return page;
+	}
+	return NULL;
+}
+
+// Tees everything written to the connection into a buffer, until the page
+// gets too big or turns out not to be cacheable.
+typedef struct {
+	HTTPConnectionRef conn;
+	bool cache;
+	char *buf;
+	size_t len;
+	size_t size;
+} page_writer;
+static void page_writer_uncache(page_writer *const w) {
+	w->cache = false;
+	FREE(&w->buf);
+	w->len = 0;
+	w->size = 0;
+}
+static int page_bufferv(page_writer *const w, uv_buf_t parts[], unsigned int const count) {
+	for(unsigned int i = 0; w->cache && i < count; i++) {
+		size_t const need = w->len + parts[i].len;
+		if(need > PAGE_SIZE_MAX) {
+			page_writer_uncache(w);
+			break;
+		}
+		if(need > w->size) {
+			size_t const size = MAX(need, MAX((size_t)BUFFER_SIZE, w->size * 2));
+			char *const x = realloc(w->buf, size);
+			if(!x) {
+				page_writer_uncache(w);
+				break;
+			}
+			w->buf = x;
+			w->size = size;
+		}
+		memcpy(w->buf + w->len, parts[i].base, parts[i].len);
+		w->len = need;
+	}
+	return 0;
+}
+static int page_writev(page_writer *const w, uv_buf_t parts[], unsigned int const count) {
+	page_bufferv(w, parts, count);
+	return HTTPConnectionWriteChunkv(w->conn, parts, count);
+}
+// Only goes to the cache, for output that differs between the live page
+// and the cached copy.
+static int page_buffer_template(page_writer *const w, TemplateRef const t, TemplateArgCBs const *const cbs, void const *const actx) {
+	if(!w->cache) return 0;
+	return TemplateWrite(t, cbs, actx, (TemplateWritev)page_bufferv, w);
+}
+static int page_write_template(page_writer *const w, TemplateRef const t, TemplateArgCBs const *const cbs, void const *const actx) {
+	return TemplateWrite(t, cbs, actx, (TemplateWritev)page_writev, w);
+}
+static int page_write_file(page_writer *const w, strarg_t const path) {
+	if(!w->cache) return HTTPConnectionWriteChunkFile(w->conn, path);
+	uv_file const file = async_fs_open(path, O_RDONLY, 0000);
+	if(file < 0) return file;
+	char *buf = malloc(BUFFER_SIZE);
+	int rc = buf ? 0 : UV_ENOMEM;
+	while(rc >= 0) {
+		uv_buf_t const info = uv_buf_init(buf, BUFFER_SIZE);
+		ssize_t const len = rc = async_fs_readall_simple(file, &info);
+		if(0 == len) break;
+		if(rc < 0) break;
+		uv_buf_t parts[] = { uv_buf_init(buf, len) };
+		rc = page_writev(w, parts, numberof(parts));
+	}
+	FREE(&buf);
+	async_fs_close(file);
+	return rc;
+}
+static void page_store(BlogRef const blog, strarg_t const qs, uint64_t const userID, SLNMode const mode, uint64_t const latest, uint16_t const status, page_writer *const w) {
+	if(!w->cache) return;
+	// Don't bother if it's already out of date.
+	if(latest != SLNRepoSubmissionLatest(blog->repo)) return;
+
+	blog_page *page = calloc(1, sizeof(blog_page));
+	if(!page) return;
+	page->refcount = 1;
+	page->qs = strdup(qs);
+	if(!page->qs) {
+		page_release(&page);
+		return;
+	}
+	page->userID = userID;
+	page->mode = mode;
+	page->latest = latest;
+	page->status = status;
+	page->body = w->buf; w->buf = NULL;
+	page->len = w->len;
+	page_writer_uncache(w);
+
+	// Take an empty, stale or matching slot, or else the least recently used.
+	size_t slot = 0;
+	for(size_t i = 0; i < PAGE_CACHE_MAX; i++) {
+		blog_page *const x = blog->pages[i];
+		if(!x || latest != x->latest || (userID == x->userID && mode == x->mode && 0 == strcmp(qs, x->qs))) {
+			slot = i;
+			break;
+		}
+		if(x->used < blog->pages[slot]->used) slot = i;
+	}
+	page_release(&blog->pages[slot]);
+	page->used = ++blog->page_clock;
+	blog->pages[slot] = page;
+}
+
+static void write_query_headers(HTTPConnectionRef const conn, uint64_t const userID, uint16_t const status) {
+	if(200 == status) {
+		HTTPConnectionWriteResponse(conn, 200, "OK");
+	} else {
+		HTTPConnectionWriteResponse(conn, 404, "Not Found");
+	}
+	HTTPConnectionWriteHeader(conn, "Content-Type", "text/html; charset=utf-8");
+	if(0 == userID) {
+		HTTPConnectionWriteHeader(conn, "Cache-Control", "no-cache, public");
+	} else {
+		HTTPConnectionWriteHeader(conn, "Cache-Control", "no-cache, private");
+	}
+}
+static void send_page(HTTPConnectionRef const conn, uint64_t const userID, blog_page const *const page) {
+	write_query_headers(conn, userID, page->status);
+	HTTPConnectionWriteContentLength(conn, page->len);
+	HTTPConnectionBeginBody(conn);
+	uv_buf_t parts[] = { uv_buf_init(page->body, page->len) };
+	HTTPConnectionWritev(conn, parts, numberof(parts));
+	HTTPConnectionEnd(conn);
+}
+
+static int send_preview(BlogRef const blog, page_writer *const w, SLNSessionRef const session, strarg_t const URI, strarg_t const path) {
 	if(!path) return UV_EINVAL;
 
+	preview_vars vars[1] = {};
 	preview_state const state = {
 		.blog = blog,
 		.session = session,
 		.fileURI = URI,
+		.vars = vars,
 	};
-	int rc = TemplateWriteHTTPChunk(blog->entry_start, &preview_cbs, &state, conn);
-	if(rc < 0) return rc;
+	int rc = page_write_template(w, blog->entry_start, &preview_cbs, &state);
+	if(rc < 0) goto cleanup;
 
-	rc = HTTPConnectionWriteChunkFile(conn, path);
+	rc = page_write_file(w, path);
 	if(rc >= 0) {
-		rc = TemplateWriteHTTPChunk(blog->entry_end, &preview_cbs, &state, conn);
-		return rc;
+		rc = page_write_template(w, blog->entry_end, &preview_cbs, &state);
+		goto cleanup;
 	}
-	if(UV_ENOENT != rc) return rc;
+	if(UV_ENOENT != rc) goto cleanup;
 
 	gen_preview(blog, session, URI, path);
 
-	rc = HTTPConnectionWriteChunkFile(conn, path);
+	rc = page_write_file(w, path);
 	if(UV_ENOENT == rc) {
-		rc = TemplateWriteHTTPChunk(blog->empty, &preview_cbs, &state, conn);
+		// Don't cache the placeholder, the preview might show up later.
+		page_writer_uncache(w);
+		rc = page_write_template(w, blog->empty, &preview_cbs, &state);
 	}
-	if(rc < 0) return rc;
+	if(rc < 0) goto cleanup;
 
-	rc = TemplateWriteHTTPChunk(blog->entry_end, &preview_cbs, &state, conn);
-	if(rc < 0) return rc;
-	return 0;
+	rc = page_write_template(w, blog->entry_end, &preview_cbs, &state);
+	if(rc < 0) goto cleanup;
+	rc = 0;
+
+cleanup:
+	preview_vars_cleanup(vars);
+	return rc;
 }
 
 static int GET_query(BlogRef const blog, SLNSessionRef const session, HTTPConnectionRef const conn, HTTPMethod const method, strarg_t const URI, HTTPHeadersRef const headers) {
@@ -113,6 +361,19 @@ static int GET_query(BlogRef const blog, SLNSessionRef const session, HTTPConnec
 
 	if(HTTP_HEAD == method) return 501; // TODO
 
+	// SLNUserFilterParse would catch this, but cached pages skip it.
+	if(!SLNSessionHasPermission(session, SLN_RDONLY)) return 403;
+
+	uint64_t const userID = SLNSessionGetUserID(session);
+	SLNMode const mode = SLNSessionGetMode(session);
+	uint64_t const latest = SLNRepoSubmissionLatest(blog->repo);
+	blog_page *page = page_lookup(blog, qs ? qs : "", userID, mode, latest);
+	if(page) {
+		send_page(conn, userID, page);
+		page_release(&page);
+		return 0;
+	}
+
 	// TODO: This is the most complicated function in the whole program.
 	// It's unbearable.
 
@@ -243,41 +504,45 @@ static int GET_query(BlogRef const blog, SLNSessionRef const session, HTTPConnec
 		{"qs", qs_HTMLSafe},
 		{NULL, NULL},
 	};
-
-	if(count > 0) {
-		HTTPConnectionWriteResponse(conn, 200, "OK");
-	} else {
-		HTTPConnectionWriteResponse(conn, 404, "Not Found");
+	// The query time would be wrong on every cache hit, so leave it out.
+	TemplateStaticArg cached_args[numberof(args)];
+	memcpy(cached_args, args, sizeof(args));
+	for(size_t i = 0; cached_args[i].var; i++) {
+		if(0 == strcmp("querytime", cached_args[i].var)) cached_args[i].val = NULL;
 	}
-	HTTPConnectionWriteHeader(conn, "Content-Type", "text/html; charset=utf-8");
+
+	uint16_t const status = count > 0 ? 200 : 404;
+	write_query_headers(conn, userID, status);
 	HTTPConnectionWriteHeader(conn, "Transfer-Encoding", "chunked");
-	if(0 == SLNSessionGetUserID(session)) {
-		HTTPConnectionWriteHeader(conn, "Cache-Control", "no-cache, public");
-	} else {
-		HTTPConnectionWriteHeader(conn, "Cache-Control", "no-cache, private");
-	}
 	HTTPConnectionBeginBody(conn);
+
+	page_writer w[1] = {{ .conn = conn, .cache = true }};
 	TemplateWriteHTTPChunk(blog->header, &TemplateStaticCBs, args, conn);
+	page_buffer_template(w, blog->header, &TemplateStaticCBs, cached_args);
 
 	if(0 == count) {
-		TemplateWriteHTTPChunk(blog->noresults, &TemplateStaticCBs, args, conn);
+		page_write_template(w, blog->noresults, &TemplateStaticCBs, args);
 	}
 	for(size_t i = 0; i < count; i++) {
 		str_t algo[SLN_ALGO_SIZE]; // SLN_INTERNAL_ALGO
 		str_t hash[SLN_HASH_SIZE];
 		SLNParseURI(URIs[i], algo, hash);
 		str_t *previewPath = BlogCopyPreviewPath(blog, hash);
-		rc = send_preview(blog, conn, session, URIs[i], previewPath);
+		rc = send_preview(blog, w, session, URIs[i], previewPath);
 		FREE(&previewPath);
 		if(rc < 0) break;
 	}
+	if(rc < 0) page_writer_uncache(w);
 
 	// TODO: HACK
 	// Hide the pagination buttons when there are less than one full page of results.
 	if(count >= max || has_start) {
-		TemplateWriteHTTPChunk(blog->footer, &TemplateStaticCBs, args, conn);
+		page_write_template(w, blog->footer, &TemplateStaticCBs, args);
 	}
 
+	page_store(blog, qs ? qs : "", userID, mode, latest, status, w);
+	page_writer_uncache(w);
+
 	FREE(&reponame_HTMLSafe);
 	FREE(&querytime_HTMLSafe);
 	FREE(&account_HTMLSafe);
@@ -716,12 +981,35 @@ BlogRef BlogCreate(SLNRepoRef const repo) {
 	async_mutex_init(blog->pending_mutex, 0);
 	async_cond_init(blog->pending_cond, 0);
 
+	blog->pregen_run = true;
+	blog->pregen_active = true;
+	rc = async_spawn(STACK_DEFAULT, pregen_worker, blog);
+	if(rc < 0) {
+		// Not fatal, previews are still generated on demand.
+		alogf("Preview worker error: %s\n", sln_strerror(rc));
+		blog->pregen_run = false;
+		blog->pregen_active = false;
+	}
+
 	return blog;
 }
+void BlogStop(BlogRef const blog) {
+	if(!blog) return;
+	blog->pregen_run = false;
+	if(!blog->pregen_active) return;
+	SLNRepoSubmissionCancel(blog->repo, blog);
+	async_mutex_lock(blog->pending_mutex);
+	while(blog->pregen_active) {
+		async_cond_wait(blog->pending_cond, blog->pending_mutex);
+	}
+	async_mutex_unlock(blog->pending_mutex);
+}
 void BlogFree(BlogRef *const blogptr) {
 	BlogRef blog = *blogptr;
 	if(!blog) return;
 
+	BlogStop(blog);
+
 	blog->repo = NULL;
 
 	FREE(&blog->dir);
@@ -742,6 +1030,11 @@ void BlogFree(BlogRef *const blogptr) {
 	async_mutex_destroy(blog->pending_mutex);
 	async_cond_destroy(blog->pending_cond);
 
+	for(size_t i = 0; i < PAGE_CACHE_MAX; i++) {
+		page_release(&blog->pages[i]);
+	}
+	blog->page_clock = 0;
+
 	assert_zeroed(blog, 1);
 	FREE(blogptr); blog = NULL;
 }
@@ -11,6 +11,10 @@
 typedef struct Blog* BlogRef;
 
 #define PENDING_MAX 4
+#define PREGEN_MAX 16
+#define PAGE_CACHE_MAX 16
+
+typedef struct blog_page blog_page;
 
 struct Blog {
 	SLNRepoRef repo;
@@ -33,9 +37,16 @@ struct Blog {
 	async_mutex_t pending_mutex[1];
 	async_cond_t pending_cond[1];
 	strarg_t pending[PENDING_MAX];
+
+	bool pregen_run;
+	bool pregen_active;
+
+	blog_page *pages[PAGE_CACHE_MAX];
+	uint64_t page_clock;
 };
 
 BlogRef BlogCreate(SLNRepoRef const repo);
+void BlogStop(BlogRef const blog);
 void BlogFree(BlogRef *const blogptr);
 int BlogDispatch(BlogRef const blog, SLNSessionRef const session, HTTPConnectionRef const conn, HTTPMethod const method, strarg_t const URI, HTTPHeadersRef const headers);
 
@@ -51,11 +62,24 @@ int BlogGeneric(BlogRef const blog,
                 strarg_t const URI,
                 SLNFileInfo const *const src);
 
+// Metadata for one preview, loaded in a single transaction on first use
+// and shared by every template written with the same state.
+typedef struct {
+	bool loaded;
+	bool hasSize;
+	uint64_t fileSize;
+	size_t count;
+	size_t size;
+	str_t **fields; // Pairs of field, value.
+} preview_vars;
+void preview_vars_cleanup(preview_vars *const vars);
+
 // TODO: Get rid of this stuff, or refactor it.
 typedef struct {
 	BlogRef blog;
 	SLNSessionRef session;
 	strarg_t fileURI;
+	preview_vars *vars;
 } preview_state;
 extern TemplateArgCBs const preview_cbs;
 
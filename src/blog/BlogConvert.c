@@ -82,10 +82,12 @@ static int convert(BlogRef const blog,
 	SLNSubmissionWrite(meta, (byte_t const *)URI, strlen(URI));
 	SLNSubmissionWrite(meta, (byte_t const *)STR_LEN("\n\n"));
 
+	// The JSON is buffered by yajl and written to the meta-file after
+	// we leave the pool. SLNSubmissionWrite() spawns fibers and waits
+	// on them, which it can't do from a pool thread.
 	json = yajl_gen_alloc(NULL);
 	if(!json) rc = UV_ENOMEM;
 	if(rc < 0) goto cleanup;
-	yajl_gen_config(json, yajl_gen_print_callback, (void (*)())SLNSubmissionWrite, meta);
 	yajl_gen_config(json, yajl_gen_beautify, (int)true);
 
 	async_pool_enter(NULL);
@@ -95,6 +97,13 @@ static int convert(BlogRef const blog,
 	async_pool_leave(NULL);
 	if(rc < 0) goto cleanup;
 
+	unsigned char const *metabuf = NULL;
+	size_t metalen = 0;
+	if(yajl_gen_status_ok != yajl_gen_get_buf(json, &metabuf, &metalen)) rc = UV_ENOMEM;
+	if(rc < 0) goto cleanup;
+	rc = SLNSubmissionWrite(meta, (byte_t const *)metabuf, metalen);
+	if(rc < 0) goto cleanup;
+
 	rc = async_fs_fdatasync(html);
 	if(rc < 0) goto cleanup;
 
@@ -149,12 +158,15 @@ int BlogGeneric(BlogRef const blog,
 	if(rc < 0) goto cleanup;
 	html = rc;
 
+	preview_vars vars[1] = {};
 	preview_state const state = {
 		.blog = blog,
 		.session = session,
 		.fileURI = URI,
+		.vars = vars,
 	};
 	rc = TemplateWriteFile(blog->preview, &preview_cbs, &state, html);
+	preview_vars_cleanup(vars);
 	if(rc < 0) goto cleanup;
 
 	rc = async_fs_fdatasync(html);
@@ -172,9 +184,82 @@ cleanup:
 
 
 
-// TODO
+static int preview_add_field(void *const ctx, strarg_t const field, strarg_t const value) {
+	preview_vars *const vars = ctx;
+	// Meta-files are visited in order, so the first value wins.
+	for(size_t i = 0; i < vars->count; i++) {
+		if(0 == strcmp(vars->fields[i*2+0], field)) return 0;
+	}
+	if(vars->count >= vars->size) {
+		size_t const size = MAX(8, vars->size * 2);
+		str_t **x = reallocarray(vars->fields, size * 2, sizeof(str_t *));
+		if(!x) return UV_ENOMEM;
+		vars->fields = x; x = NULL;
+		vars->size = size;
+	}
+	str_t *const f = strdup(field);
+	str_t *const v = strdup(value);
+	if(!f || !v) {
+		free(f);
+		free(v);
+		return UV_ENOMEM;
+	}
+	vars->fields[vars->count*2+0] = f;
+	vars->fields[vars->count*2+1] = v;
+	vars->count++;
+	return 0;
+}
+static void preview_load(preview_state const *const state) {
+	preview_vars *const vars = state->vars;
+	if(vars->loaded) return;
+	vars->loaded = true;
+
+	KVS_env *db = NULL;
+	KVS_txn *txn = NULL;
+	SLNFileInfo info[1] = {};
+	int rc = SLNSessionDBOpen(state->session, SLN_RDONLY, &db);
+	if(rc < 0) goto cleanup;
+	rc = kvs_txn_begin(db, NULL, KVS_RDONLY, &txn);
+	if(rc < 0) goto cleanup;
+
+	// TODO: Really, we should already have the size from when
+	// we got the URI in the first place.
+	rc = SLNSessionGetFileInfoTxn(state->session, txn, state->fileURI, info);
+	if(rc >= 0) {
+		vars->hasSize = true;
+		vars->fileSize = info->size;
+	}
+	SLNFileInfoCleanup(info);
+
+	rc = SLNSessionGetFieldsForFile(state->session, txn, state->fileURI, preview_add_field, vars);
+
+cleanup:
+	kvs_txn_abort(txn); txn = NULL;
+	SLNSessionDBClose(state->session, &db);
+	// On failure we keep whatever was loaded and fall back to defaults.
+}
+static strarg_t preview_field(preview_state const *const state, strarg_t const var) {
+	preview_load(state);
+	preview_vars const *const vars = state->vars;
+	for(size_t i = 0; i < vars->count; i++) {
+		if(0 == strcmp(vars->fields[i*2+0], var)) return vars->fields[i*2+1];
+	}
+	return NULL;
+}
+void preview_vars_cleanup(preview_vars *const vars) {
+	if(!vars) return;
+	for(size_t i = 0; i < vars->count * 2; i++) FREE(&vars->fields[i]);
+	assert_zeroed(vars->fields, vars->count * 2);
+	FREE(&vars->fields);
+	vars->count = 0;
+	vars->size = 0;
+	vars->fileSize = 0;
+	vars->hasSize = false;
+	vars->loaded = false;
+	assert_zeroed(vars, 1);
+}
+
 static str_t *preview_metadata(preview_state const *const state, strarg_t const var) {
-	int rc;
 	strarg_t unsafe = NULL;
 	str_t buf[URI_MAX];
 	if(0 == strcmp(var, "rawURI")) {
@@ -212,12 +297,9 @@ static str_t *preview_metadata(preview_state const *const state, strarg_t const
 		unsafe = state->fileURI;
 	}
 	if(0 == strcmp(var, "fileSize")) {
-		// TODO: Really, we should already have this info from when
-		// we got the URI in the first place.
-		SLNFileInfo info[1];
-		rc = SLNSessionGetFileInfo(state->session, state->fileURI, info);
-		if(rc >= 0) {
-			double const size = info->size;
+		preview_load(state);
+		if(state->vars->hasSize) {
+			double const size = state->vars->fileSize;
 			double base = 1.0;
 			strarg_t const units[] = { "B", "KB", "MB", "GB", "TB" };
 			size_t i = 0;
@@ -230,24 +312,10 @@ static str_t *preview_metadata(preview_state const *const state, strarg_t const
 			unsafe = buf;
 			// P.S. Fuck scientific prefixes.
 		}
-		SLNFileInfoCleanup(info);
 	}
 	if(unsafe) return htmlenc(unsafe);
 
-	str_t value[1024 * 4];
-	// TODO: Load all vars for the template in one transaction.
-	KVS_env *db = NULL;
-	rc = SLNSessionDBOpen(state->session, SLN_RDONLY, &db);
-	if(rc >= 0) {
-		KVS_txn *txn = NULL;
-		rc = kvs_txn_begin(db, NULL, KVS_RDONLY, &txn);
-		if(rc >= 0) {
-			rc = SLNSessionGetValueForField(state->session, txn, state->fileURI, var, value, sizeof(value));
-			if(rc >= 0 && '\0' != value[0]) unsafe = value;
-			kvs_txn_abort(txn); txn = NULL;
-		}
-		SLNSessionDBClose(state->session, &db);
-	}
+	unsafe = preview_field(state, var);
 
 	if(!unsafe) {
 		if(0 == strcmp(var, "thumbnailURI")) unsafe = "/file.png";
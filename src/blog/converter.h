@@ -1,7 +1,9 @@
 // Copyright 2014-2015 Ben Trask
 // MIT licensed (see LICENSE for details)
 
+#include <pthread.h>
 #include <regex.h>
+#include <stdbool.h>
 #include <stdlib.h>
 #include <string.h>
 #include <strings.h>
@@ -45,6 +47,39 @@
 // Painstakingly ported to POSIX
 #define LINKIFY_RE "([a-z][a-z0-9_-]+:(/{1,3}|[a-z0-9%])|www[0-9]{0,3}[.]|[a-z0-9.-]+[.][a-z]{2,4}/)([^[:space:]()<>]+|\\(([^[:space:]()<>]+|(\\([^[:space:]()<>]+\\)))*\\))+(\\(([^[:space:]()<>]+|(\\([^[:space:]()<>]+\\)))*\\)|[^][[:space:]`!(){};:'\".,<>?«»“”‘’])"
 
+// Compiling LINKIFY_RE costs more than linkifying a typical post, so we
+// keep compiled copies around. Each thread gets its own, because glibc's
+// regexec() locks the pattern and a shared one would serialize the pool.
+// These are static in a header, so each converter that includes it has
+// its own key and copies.
+static pthread_once_t linkify_once = PTHREAD_ONCE_INIT;
+static pthread_key_t linkify_key;
+static bool linkify_ok = false;
+static void linkify_free(void *const re) {
+	regfree(re);
+	free(re);
+}
+static void linkify_init(void) {
+	linkify_ok = 0 == pthread_key_create(&linkify_key, linkify_free);
+}
+static regex_t const *linkify(void) {
+	pthread_once(&linkify_once, linkify_init);
+	if(!linkify_ok) return NULL;
+	regex_t *re = pthread_getspecific(linkify_key);
+	if(re) return re;
+	re = malloc(sizeof(*re));
+	if(!re) return NULL;
+	if(0 != regcomp(re, LINKIFY_RE, REG_ICASE | REG_EXTENDED)) {
+		free(re);
+		return NULL;
+	}
+	if(0 != pthread_setspecific(linkify_key, re)) {
+		linkify_free(re);
+		return NULL;
+	}
+	return re;
+}
+
 static int write_html(uv_file const file, char const *const buf, size_t const len) {
 	if(0 == len) return 0;
 	uv_buf_t x = uv_buf_init((char *)buf, len);
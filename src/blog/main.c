@@ -180,6 +180,7 @@ static void term(void *const unused) {
 	async_close((uv_handle_t *)sigint);
 
 	SLNRepoPullsStop(repo);
+	BlogStop(blog);
 	HTTPServerClose(server_raw);
 	HTTPServerClose(server_tls);
 
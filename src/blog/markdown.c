@@ -8,185 +8,243 @@
 
 // Ported to the JS version in markdown.js
 // The output should be identical between each version
-static void md_escape(cmark_iter *const iter) {
-	for(;;) {
-		cmark_event_type const event = cmark_iter_next(iter);
-		if(CMARK_EVENT_DONE == event) break;
-		if(CMARK_EVENT_ENTER != event) continue;
-		cmark_node *const node = cmark_iter_get_node(iter);
-		if(CMARK_NODE_HTML != cmark_node_get_type(node)) continue;
 
-		char const *const str = cmark_node_get_literal(node);
-		cmark_node *p = cmark_node_new(CMARK_NODE_PARAGRAPH);
-		cmark_node *text = cmark_node_new(CMARK_NODE_TEXT);
-		cmark_node_set_literal(text, str);
-		cmark_node_append_child(p, text);
-		cmark_node_insert_before(node, p);
-		cmark_node_free(node);
+// All of the rewrites below happen during a single walk of the tree.
+// Nodes inserted before the current one are never visited by the iterator,
+// so escaping and autolinking pass their new nodes straight on to the
+// steps that would otherwise have seen them. Link and embed URLs are
+// recorded as we go, before hash URIs get rewritten.
+
+struct md_urls {
+	char **items;
+	size_t count;
+	size_t size;
+};
+struct md_state {
+	regex_t const *linkify;
+	struct md_urls links[1];
+	struct md_urls embeds[1];
+};
+
+static int md_record(struct md_urls *const list, char const *const URL) {
+	if(!URL) return 0;
+	if(list->count+1 > list->size) {
+		size_t const size = list->size ? list->size * 2 : 16;
+		char **const x = realloc(list->items, size * sizeof(*x));
+		if(!x) return UV_ENOMEM;
+		list->items = x;
+		list->size = size;
 	}
+	list->items[list->count] = strdup(URL);
+	if(!list->items[list->count]) return UV_ENOMEM;
+	list->count++;
+	return 0;
+}
+static void md_write_urls(yajl_gen const json, struct md_urls *const list) {
+	for(size_t i = 0; i < list->count; i++) {
+		char const *const URL = list->items[i];
+		yajl_gen_string(json, (unsigned char const *)URL, strlen(URL));
+		yajl_gen_map_open(json);
+		yajl_gen_map_close(json);
+	}
+}
+static void md_urls_free(struct md_urls *const list) {
+	for(size_t i = 0; i < list->count; i++) {
+		free(list->items[i]); list->items[i] = NULL;
+	}
+	free(list->items); list->items = NULL;
+	list->count = 0;
+	list->size = 0;
 }
-static void md_escape_inline(cmark_iter *const iter) {
-	for(;;) {
-		cmark_event_type const event = cmark_iter_next(iter);
-		if(CMARK_EVENT_DONE == event) break;
-		if(CMARK_EVENT_ENTER != event) continue;
-		cmark_node *const node = cmark_iter_get_node(iter);
-		if(CMARK_NODE_INLINE_HTML != cmark_node_get_type(node)) continue;
 
-		char const *const str = cmark_node_get_literal(node);
+// HACK
+extern cmark_mem DEFAULT_MEM_ALLOCATOR;
+
+// Returns the last node inserted, or NULL if nothing changed.
+static cmark_node *md_convert_hash(cmark_node *const node) {
+	char const *const URI = cmark_node_get_url(node);
+	if(!URI) return NULL;
+	if(0 != strncasecmp(URI, STR_LEN("hash:"))) return NULL;
+
+	cmark_node *hashlink = cmark_node_new(CMARK_NODE_LINK);
+	cmark_node_set_url(hashlink, URI);
+	cmark_node_set_title(hashlink, HASH_INFO_MSG);
+
+	cmark_node *sup_open = cmark_node_new(CMARK_NODE_INLINE_HTML);
+	cmark_node_set_literal(sup_open, "<sup>[");
+	cmark_node *sup_close = cmark_node_new(CMARK_NODE_INLINE_HTML);
+	cmark_node_set_literal(sup_close, "]</sup>");
+	cmark_node *face = cmark_node_new(CMARK_NODE_TEXT);
+	cmark_node_set_literal(face, "#");
+	cmark_node_append_child(hashlink, face);
+
+	cmark_node_insert_after(node, sup_open);
+	cmark_node_insert_after(sup_open, hashlink);
+	cmark_node_insert_after(hashlink, sup_close);
+
+	char *escaped = QSEscape(URI, strlen(URI), true);
+	size_t const elen = strlen(escaped);
+	cmark_strbuf rel[1];
+	char const qpfx[] = "?q=";
+	cmark_strbuf_init(&DEFAULT_MEM_ALLOCATOR, rel, sizeof(qpfx)-1+elen);
+	cmark_strbuf_put(rel, (unsigned char const *)qpfx, sizeof(qpfx)-1);
+	cmark_strbuf_put(rel, (unsigned char const *)escaped, elen);
+	free(escaped); escaped = NULL;
+	cmark_node_set_url(node, cmark_strbuf_cstr(rel));
+	cmark_strbuf_free(rel);
+
+	return sup_close;
+}
+static int md_autolink(struct md_state *const state, cmark_node *const node) {
+	char const *const str = cmark_node_get_literal(node);
+	char const *pos = str;
+	regmatch_t match;
+	while(0 == regexec(state->linkify, pos, 1, &match, 0)) {
+		regoff_t const loc = match.rm_so;
+		regoff_t const len = match.rm_eo - match.rm_so;
+
+		char *a = strndup(pos, loc);
+		char *b = strndup(pos+loc, len);
+		assert(a);
+		assert(b);
+
 		cmark_node *text = cmark_node_new(CMARK_NODE_TEXT);
-		cmark_node_set_literal(text, str);
+		cmark_node_set_literal(text, a);
+		cmark_node *link = cmark_node_new(CMARK_NODE_LINK);
+		cmark_node_set_url(link, b);
+		cmark_node *face = cmark_node_new(CMARK_NODE_TEXT);
+		cmark_node_set_literal(face, b);
+		cmark_node_append_child(link, face);
 		cmark_node_insert_before(node, text);
-		cmark_node_free(node);
-	}
-}
-static void md_autolink(cmark_iter *const iter) {
-	regex_t linkify[1];
-	// <http://daringfireball.net/2010/07/improved_regex_for_matching_urls>
-	// Painstakingly ported to POSIX
-	int rc = regcomp(linkify, "([a-z][a-z0-9_-]+:(/{1,3}|[a-z0-9%])|www[0-9]{0,3}[.]|[a-z0-9.-]+[.][a-z]{2,4}/)([^[:space:]()<>]+|\\(([^[:space:]()<>]+|(\\([^[:space:]()<>]+\\)))*\\))+(\\(([^[:space:]()<>]+|(\\([^[:space:]()<>]+\\)))*\\)|[^][[:space:]`!(){};:'\".,<>?«»“”‘’])", REG_ICASE | REG_EXTENDED);
-	assert(0 == rc);
+		cmark_node_insert_before(node, link);
 
-	for(;;) {
-		cmark_event_type const event = cmark_iter_next(iter);
-		if(CMARK_EVENT_DONE == event) break;
-		if(CMARK_EVENT_ENTER != event) continue;
-		cmark_node *const node = cmark_iter_get_node(iter);
-		if(CMARK_NODE_TEXT != cmark_node_get_type(node)) continue;
-
-		char const *const str = cmark_node_get_literal(node);
-		char const *pos = str;
-		regmatch_t match;
-		while(0 == regexec(linkify, pos, 1, &match, 0)) {
-			regoff_t const loc = match.rm_so;
-			regoff_t const len = match.rm_eo - match.rm_so;
-
-			char *a = strndup(pos, loc);
-			char *b = strndup(pos+loc, len);
-			assert(a);
-			assert(b);
-
-			cmark_node *text = cmark_node_new(CMARK_NODE_TEXT);
-			cmark_node_set_literal(text, a);
-			cmark_node *link = cmark_node_new(CMARK_NODE_LINK);
-			cmark_node_set_url(link, b);
-			cmark_node *face = cmark_node_new(CMARK_NODE_TEXT);
-			cmark_node_set_literal(face, b);
-			cmark_node_append_child(link, face);
-			cmark_node_insert_before(node, text);
-			cmark_node_insert_before(node, link);
-
-			free(a); a = NULL;
-			free(b); b = NULL;
-
-			pos += loc+len;
-		}
+		free(a); a = NULL;
+		free(b); b = NULL;
 
-		if(str != pos) {
-			cmark_node *text = cmark_node_new(CMARK_NODE_TEXT);
-			cmark_node_set_literal(text, pos);
-			cmark_node_insert_before(node, text);
-			cmark_node_free(node);
-		}
+		int rc = md_record(state->links, cmark_node_get_url(link));
+		if(rc < 0) return rc;
+		md_convert_hash(link);
 
+		pos += loc+len;
 	}
-	regfree(linkify);
-}
-static void md_block_external_images(cmark_iter *const iter) {
-	for(;;) {
-		cmark_event_type const event = cmark_iter_next(iter);
-		if(CMARK_EVENT_DONE == event) break;
-		if(CMARK_EVENT_EXIT != event) continue;
-		cmark_node *const node = cmark_iter_get_node(iter);
-		if(CMARK_NODE_IMAGE != cmark_node_get_type(node)) continue;
-
-		char const *const URI = cmark_node_get_url(node);
-		if(URI) {
-			if(0 == strncasecmp(URI, STR_LEN("hash:"))) continue;
-			if(0 == strncasecmp(URI, STR_LEN("data:"))) continue;
-		}
 
-		cmark_node *link = cmark_node_new(CMARK_NODE_LINK);
+	if(str != pos) {
 		cmark_node *text = cmark_node_new(CMARK_NODE_TEXT);
-		cmark_node_set_url(link, URI);
-		for(;;) {
-			cmark_node *child = cmark_node_first_child(node);
-			if(!child) break;
-			cmark_node_append_child(link, child);
-		}
-		if(cmark_node_first_child(link)) {
-			cmark_node_set_literal(text, " (external image)");
-		} else {
-			cmark_node_set_literal(text, "(external image)");
-		}
-		cmark_node_append_child(link, text);
-
-		cmark_node_insert_before(node, link);
+		cmark_node_set_literal(text, pos);
+		cmark_node_insert_before(node, text);
 		cmark_node_free(node);
 	}
+	return 0;
+}
+static int md_escape(struct md_state *const state, cmark_node *const node) {
+	char const *const str = cmark_node_get_literal(node);
+	cmark_node *p = cmark_node_new(CMARK_NODE_PARAGRAPH);
+	cmark_node *text = cmark_node_new(CMARK_NODE_TEXT);
+	cmark_node_set_literal(text, str);
+	cmark_node_append_child(p, text);
+	cmark_node_insert_before(node, p);
+	cmark_node_free(node);
+	return md_autolink(state, text);
 }
+static int md_escape_inline(struct md_state *const state, cmark_node *const node) {
+	char const *const str = cmark_node_get_literal(node);
+	cmark_node *text = cmark_node_new(CMARK_NODE_TEXT);
+	cmark_node_set_literal(text, str);
+	cmark_node_insert_before(node, text);
+	cmark_node_free(node);
+	return md_autolink(state, text);
+}
+static bool md_block_external_image(cmark_node *const node) {
+	char const *const URI = cmark_node_get_url(node);
+	if(URI) {
+		if(0 == strncasecmp(URI, STR_LEN("hash:"))) return false;
+		if(0 == strncasecmp(URI, STR_LEN("data:"))) return false;
+	}
 
-// HACK
-extern cmark_mem DEFAULT_MEM_ALLOCATOR;
+	cmark_node *link = cmark_node_new(CMARK_NODE_LINK);
+	cmark_node *text = cmark_node_new(CMARK_NODE_TEXT);
+	cmark_node_set_url(link, URI);
+	for(;;) {
+		cmark_node *child = cmark_node_first_child(node);
+		if(!child) break;
+		cmark_node_append_child(link, child);
+	}
+	if(cmark_node_first_child(link)) {
+		cmark_node_set_literal(text, " (external image)");
+	} else {
+		cmark_node_set_literal(text, "(external image)");
+	}
+	cmark_node_append_child(link, text);
+
+	cmark_node_insert_before(node, link);
+	cmark_node_free(node);
+	return true;
+}
 
-static void md_convert_hashes(cmark_iter *const iter) {
+static int md_rewrite(struct md_state *const state, cmark_iter *const iter) {
+	int rc = 0;
 	for(;;) {
 		cmark_event_type const event = cmark_iter_next(iter);
 		if(CMARK_EVENT_DONE == event) break;
-		if(CMARK_EVENT_EXIT != event) continue;
 		cmark_node *const node = cmark_iter_get_node(iter);
 		cmark_node_type const type = cmark_node_get_type(node);
+		if(CMARK_EVENT_ENTER == event) switch(type) {
+			case CMARK_NODE_HTML:
+				rc = md_escape(state, node); break;
+			case CMARK_NODE_INLINE_HTML:
+				rc = md_escape_inline(state, node); break;
+			case CMARK_NODE_TEXT:
+				rc = md_autolink(state, node); break;
+			case CMARK_NODE_LINK:
+				rc = md_record(state->links, cmark_node_get_url(node)); break;
+			case CMARK_NODE_IMAGE:
+				rc = md_record(state->embeds, cmark_node_get_url(node)); break;
+			default: break;
+		}
+		if(rc < 0) return rc;
+		if(CMARK_EVENT_EXIT != event) continue;
 		if(CMARK_NODE_LINK != type && CMARK_NODE_IMAGE != type) continue;
+		if(CMARK_NODE_IMAGE == type && md_block_external_image(node)) continue;
 
-		char const *const URI = cmark_node_get_url(node);
-		if(!URI) continue;
-		if(0 != strncasecmp(URI, STR_LEN("hash:"))) continue;
-
-		cmark_node *hashlink = cmark_node_new(CMARK_NODE_LINK);
-		cmark_node_set_url(hashlink, URI);
-		cmark_node_set_title(hashlink, HASH_INFO_MSG);
-
-		cmark_node *sup_open = cmark_node_new(CMARK_NODE_INLINE_HTML);
-		cmark_node_set_literal(sup_open, "<sup>[");
-		cmark_node *sup_close = cmark_node_new(CMARK_NODE_INLINE_HTML);
-		cmark_node_set_literal(sup_close, "]</sup>");
-		cmark_node *face = cmark_node_new(CMARK_NODE_TEXT);
-		cmark_node_set_literal(face, "#");
-		cmark_node_append_child(hashlink, face);
-
-		cmark_node_insert_after(node, sup_open);
-		cmark_node_insert_after(sup_open, hashlink);
-		cmark_node_insert_after(hashlink, sup_close);
-
-		cmark_iter_reset(iter, sup_close, CMARK_EVENT_EXIT);
-
-		char *escaped = QSEscape(URI, strlen(URI), true);
-		size_t const elen = strlen(escaped);
-		cmark_strbuf rel[1];
-		char const qpfx[] = "?q=";
-		cmark_strbuf_init(&DEFAULT_MEM_ALLOCATOR, rel, sizeof(qpfx)-1+elen);
-		cmark_strbuf_put(rel, (unsigned char const *)qpfx, sizeof(qpfx)-1);
-		cmark_strbuf_put(rel, (unsigned char const *)escaped, elen);
-		free(escaped); escaped = NULL;
-		cmark_node_set_url(node, cmark_strbuf_cstr(rel));
-		cmark_strbuf_free(rel);
+		// Skip over the nodes we just added.
+		cmark_node *const last = md_convert_hash(node);
+		if(last) cmark_iter_reset(iter, last, CMARK_EVENT_EXIT);
 	}
+	return 0;
 }
 
-static void write_urls(yajl_gen const json, cmark_iter *const iter, cmark_node_type const type) {
+// Rendering the whole document at once needs a string as large as the
+// output, on top of the source and the tree. Instead we render one
+// top-level block at a time, freeing it as we go, and write the results
+// out in batches of up to WRITE_CHUNK bytes.
+#define WRITE_CHUNK (1024 * 64)
+static int md_write_html(uv_file const html, cmark_node *const doc, int const options) {
+	uv_buf_t bufs[32];
+	size_t count = 0;
+	size_t total = 0;
+	int rc = 0;
 	for(;;) {
-		cmark_event_type const event = cmark_iter_next(iter);
-		if(CMARK_EVENT_DONE == event) break;
-		if(CMARK_EVENT_ENTER != event) continue;
-		cmark_node *const node = cmark_iter_get_node(iter);
-		if(cmark_node_get_type(node) != type) continue;
-
-		char const *const URL = cmark_node_get_url(node);
-		if(!URL) continue;
-		yajl_gen_string(json, (unsigned char const *)URL, strlen(URL));
-		yajl_gen_map_open(json);
-		yajl_gen_map_close(json);
+		cmark_node *const block = cmark_node_first_child(doc);
+		if(!block) break;
+		char *const str = cmark_render_html(block, options);
+		cmark_node_free(block);
+		if(!str) rc = UV_ENOMEM;
+		if(rc < 0) break;
+
+		size_t const len = strlen(str);
+		bufs[count++] = uv_buf_init(str, len);
+		total += len;
+		if(count < numberof(bufs) && total < WRITE_CHUNK) continue;
+
+		rc = async_fs_writeall(html, bufs, count, -1);
+		for(size_t i = 0; i < count; i++) free(bufs[i].base);
+		count = 0;
+		total = 0;
+		if(rc < 0) break;
 	}
+	if(rc >= 0 && count) rc = async_fs_writeall(html, bufs, count, -1);
+	for(size_t i = 0; i < count; i++) free(bufs[i].base);
+	return rc;
 }
 
 
@@ -203,73 +261,42 @@ CONVERTER(markdown) {
 		CMARK_OPT_SMART |
 		0;
 
+	struct md_state state[1] = {};
+	state->linkify = linkify();
+	if(!state->linkify) return UV_ENOMEM;
+
 	cmark_node *node = cmark_parse_document(buf, size, options);
 	assert(node); // TODO
 
-	// TODO: We should be able to reset the iterator, but resetting to CMARK_EVENT_NONE doesn't work.
-	cmark_iter *iter = NULL;
-	iter = cmark_iter_new(node);
-	assert(iter);
-	md_escape(iter);
-	cmark_iter_free(iter); iter = NULL;
-
-	iter = cmark_iter_new(node);
+	cmark_iter *iter = cmark_iter_new(node);
 	assert(iter);
-	md_escape_inline(iter);
+	int rc = md_rewrite(state, iter);
 	cmark_iter_free(iter); iter = NULL;
+	if(rc < 0) goto cleanup;
 
-	iter = cmark_iter_new(node);
-	assert(iter);
-	md_autolink(iter);
-	cmark_iter_free(iter); iter = NULL;
-
-
-	// We want to do these after auto-linking
-	// but before resolving our hash URIs.
-	iter = cmark_iter_new(node);
-	assert(iter);
 	yajl_gen_string(json, (unsigned char const *)STR_LEN("link"));
 	yajl_gen_map_open(json);
-	write_urls(json, iter, CMARK_NODE_LINK);
+	md_write_urls(json, state->links);
 	yajl_gen_map_close(json);
-	cmark_iter_free(iter); iter = NULL;
 
-	iter = cmark_iter_new(node);
-	assert(iter);
 	yajl_gen_string(json, (unsigned char const *)STR_LEN("embed"));
 	yajl_gen_map_open(json);
-	write_urls(json, iter, CMARK_NODE_IMAGE);
+	md_write_urls(json, state->embeds);
 	yajl_gen_map_close(json);
-	cmark_iter_free(iter); iter = NULL;
-
-
-
-	iter = cmark_iter_new(node);
-	assert(iter);
-	md_block_external_images(iter);
-	cmark_iter_free(iter); iter = NULL;
-
-	iter = cmark_iter_new(node);
-	assert(iter);
-	md_convert_hashes(iter);
-	cmark_iter_free(iter); iter = NULL;
-
 
-	char *str = cmark_render_html(node, options);
-	cmark_node_free(node); node = NULL;
-	assert(str); // TODO
-	size_t const len = strlen(str);
-	assert(len); // TODO
 
-	uv_buf_t out = uv_buf_init(str, len);
-	int rc = async_fs_writeall(html, &out, 1, -1);
-	free(str); str = NULL;
-	if(rc < 0) return rc;
+	rc = md_write_html(html, node, options);
+	if(rc < 0) goto cleanup;
 
 	yajl_gen_string(json, (unsigned char const *)STR_LEN("fulltext"));
 	yajl_gen_string(json, (unsigned char const *)buf, size);
 
-	return 0;
+cleanup:
+	if(node) cmark_node_free(node);
+	node = NULL;
+	md_urls_free(state->links);
+	md_urls_free(state->embeds);
+	return rc;
 }
 
 /*int main(int const argc, char const *const argv[]) {
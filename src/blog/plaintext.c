@@ -15,16 +15,15 @@ CONVERTER(plaintext) {
 	yajl_gen_string(json, (unsigned char const *)STR_LEN("link"));
 	yajl_gen_map_open(json);
 
-	regex_t linkify[1];
-	int rc = regcomp(linkify, LINKIFY_RE, REG_ICASE | REG_EXTENDED);
-	if(0 != rc) return UV_ENOMEM;
+	regex_t const *const re = linkify();
+	if(!re) return UV_ENOMEM;
 
-	rc = write_html(html, STR_LEN("<pre>"));
+	int rc = write_html(html, STR_LEN("<pre>"));
 	if(rc < 0) goto cleanup;
 
 	char const *pos = buf;
 	regmatch_t match;
-	while(0 == regexec(linkify, pos, 1, &match, 0)) {
+	while(0 == regexec(re, pos, 1, &match, 0)) {
 		regoff_t const loc = match.rm_so;
 		regoff_t const len = match.rm_eo - match.rm_so;
 
@@ -50,7 +49,6 @@ CONVERTER(plaintext) {
 	yajl_gen_string(json, (unsigned char const *)buf, size);
 
 cleanup:
-	regfree(linkify);
 	return rc;
 }
 
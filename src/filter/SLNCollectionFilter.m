@@ -13,11 +13,23 @@ static int filtercmp(SLNFilter *const a, SLNFilter *const b, int const dir) {
 	if(afile < bfile) return -dir;
 	return 0;
 }
-static int filtercmp_fwd(SLNFilter *const *const a, SLNFilter *const *const b) {
-	return filtercmp(*a, *b, +1);
-}
-static int filtercmp_rev(SLNFilter *const *const a, SLNFilter *const *const b) {
-	return filtercmp(*a, *b, -1);
+
+// The sub-filters are kept as a binary min-heap (in the given direction)
+// so that filters[0] is always the current position and each step only
+// costs O(log n) instead of re-sorting the whole array.
+static void heap_down(SLNFilter **const filters, size_t const count, size_t i, int const dir) {
+	for(;;) {
+		size_t const l = i*2+1;
+		size_t const r = i*2+2;
+		size_t x = i;
+		if(l < count && filtercmp(filters[l], filters[x], dir) < 0) x = l;
+		if(r < count && filtercmp(filters[r], filters[x], dir) < 0) x = r;
+		if(x == i) return;
+		SLNFilter *const tmp = filters[i];
+		filters[i] = filters[x];
+		filters[x] = tmp;
+		i = x;
+	}
 }
 
 @implementation SLNCollectionFilter
@@ -91,21 +103,24 @@ static int filtercmp_rev(SLNFilter *const *const a, SLNFilter *const *const b) {
 		[self seek:dir :oldSortID :oldFileID];
 	}
 	[filters[0] step:dir];
+	heap_down(filters, count, 0, dir);
+	// Step every other sub-filter sitting on the same position.
+	// Bounded by count in case an exhausted filter doesn't move.
 	for(size_t i = 1; i < count; i++) {
 		uint64_t curSortID, curFileID;
-		[filters[i] current:dir :&curSortID :&curFileID];
+		[filters[0] current:dir :&curSortID :&curFileID];
 		if(curSortID != oldSortID || curFileID != oldFileID) break;
-		[filters[i] step:dir];
+		[filters[0] step:dir];
+		heap_down(filters, count, 0, dir);
 	}
-	[self sort:dir];
+	sort = dir;
 }
 
 - (void)sort:(int const)dir {
 	assert(0 != dir);
-	int (*cmp)();
-	if(dir > 0) cmp = filtercmp_fwd;
-	if(dir < 0) cmp = filtercmp_rev;
-	qsort(filters, count, sizeof(filters[0]), cmp);
+	for(size_t i = count/2; i-- > 0;) {
+		heap_down(filters, count, i, dir);
+	}
 	sort = dir;
 }
 @end
@@ -131,6 +146,27 @@ static int filtercmp_rev(SLNFilter *const *const a, SLNFilter *const *const b) {
 	if(depth) fprintf(file, ")");
 }
 
+- (void)current:(int const)dir :(uint64_t *const)sortID :(uint64_t *const)fileID {
+	// A file only matches once every sub-filter has reached it, so
+	// each one must have an entry at or before the match. Going
+	// backward, once any sub-filter runs dry we can stop instead of
+	// walking the rest of the denser ones.
+	// We can't skip anything going forward, or jump the others to a
+	// candidate from the rarest one: the sub-filters list the same
+	// file at different sort IDs, so their positions never line up.
+	// Sub-filters that don't list what they match (negations, or
+	// collections of them) are exempt.
+	if(dir < 0 && 0 != sort) for(size_t i = 0; i < count; i++) {
+		if(![filters[i] listsMatches]) continue;
+		uint64_t x;
+		[filters[i] current:dir :NULL :&x];
+		if(valid(x)) continue;
+		if(sortID) *sortID = invalid(dir);
+		if(fileID) *fileID = invalid(dir);
+		return;
+	}
+	[super current:dir :sortID :fileID];
+}
 - (SLNAgeRange)fullAge:(uint64_t const)fileID {
 	SLNAgeRange age = { 0, UINT64_MAX };
 	for(size_t i = 0; i < count; i++) {
@@ -151,6 +187,30 @@ static int filtercmp_rev(SLNFilter *const *const a, SLNFilter *const *const b) {
 	if(hit) return sortID;
 	return 0;
 }
+- (bool)mightMatch:(KVS_txn *const)txn :(uint64_t const)after :(uint64_t const)latest {
+	// New results are positioned at some sub-filter's new entry.
+	// Negations never have entries, so they drop out.
+	for(size_t i = 0; i < count; i++) {
+		if([filters[i] mightMatch:txn :after :latest]) return true;
+	}
+	return false;
+}
+- (bool)listsMatches {
+	// Every match is in each sub-filter, so one that lists is enough.
+	for(size_t i = 0; i < count; i++) {
+		if([filters[i] listsMatches]) return true;
+	}
+	return false;
+}
+- (uint64_t)estimate:(int const)dir :(uint64_t const)sortID :(uint64_t const)fileID :(uint64_t const)max {
+	// Can't match more than the smallest sub-filter.
+	uint64_t n = max;
+	for(size_t i = 0; i < count; i++) {
+		uint64_t const x = [filters[i] estimate:dir :sortID :fileID :n];
+		if(x < n) n = x;
+	}
+	return n;
+}
 @end
 
 @implementation SLNUnionFilter
@@ -191,5 +251,24 @@ static int filtercmp_rev(SLNFilter *const *const a, SLNFilter *const *const b) {
 	if(hit) return sortID;
 	return UINT64_MAX;
 }
+- (bool)mightMatch:(KVS_txn *const)txn :(uint64_t const)after :(uint64_t const)latest {
+	for(size_t i = 0; i < count; i++) {
+		if([filters[i] mightMatch:txn :after :latest]) return true;
+	}
+	return false;
+}
+- (bool)listsMatches {
+	for(size_t i = 0; i < count; i++) {
+		if(![filters[i] listsMatches]) return false;
+	}
+	return true;
+}
+- (uint64_t)estimate:(int const)dir :(uint64_t const)sortID :(uint64_t const)fileID :(uint64_t const)max {
+	uint64_t n = 0;
+	for(size_t i = 0; i < count && n < max; i++) {
+		n += [filters[i] estimate:dir :sortID :fileID :max-n];
+	}
+	return n;
+}
 @end
 
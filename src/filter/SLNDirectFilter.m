@@ -101,6 +101,21 @@
 - (uint64_t)fastAge:(uint64_t const)fileID :(uint64_t const)sortID {
 	return [self fullAge:fileID].min;
 }
+- (bool)mightMatch:(KVS_txn *const)txn :(uint64_t const)after :(uint64_t const)latest {
+	KVS_cursor *cursor = NULL;
+	int rc = kvs_txn_cursor(txn, &cursor);
+	if(rc < 0) return true;
+	KVS_range range[1];
+	KVS_val key[1];
+	SLNURIAndFileIDRange1(range, txn, URI);
+	SLNURIAndFileIDKeyPack(key, txn, URI, after+1);
+	rc = kvs_cursor_seekr(cursor, range, key, NULL, +1);
+	if(rc < 0) return KVS_NOTFOUND != rc;
+	strarg_t u;
+	uint64_t x;
+	SLNURIAndFileIDKeyUnpack(key, txn, &u, &x);
+	return x <= latest;
+}
 @end
 
 @implementation SLNTargetURIFilter
@@ -195,6 +210,131 @@
 - (uint64_t)fastAge:(uint64_t const)fileID :(uint64_t const)sortID {
 	return [self fullAge:fileID].min;
 }
+- (bool)mightMatch:(KVS_txn *const)txn :(uint64_t const)after :(uint64_t const)latest {
+	KVS_cursor *cursor = NULL;
+	int rc = kvs_txn_cursor(txn, &cursor);
+	if(rc < 0) return true;
+	KVS_range range[1];
+	KVS_val key[1];
+	SLNTargetURIAndMetaFileIDRange1(range, txn, targetURI);
+	SLNTargetURIAndMetaFileIDKeyPack(key, txn, targetURI, after+1);
+	rc = kvs_cursor_seekr(cursor, range, key, NULL, +1);
+	if(rc < 0) return KVS_NOTFOUND != rc;
+	strarg_t u;
+	uint64_t x;
+	SLNTargetURIAndMetaFileIDKeyUnpack(key, txn, &u, &x);
+	return x <= latest;
+}
+@end
+
+@implementation SLNFileTypeFilter
+- (void)free {
+	curtxn = NULL;
+	FREE(&type);
+	kvs_cursor_close(files); files = NULL;
+	kvs_cursor_close(age); age = NULL;
+	[super free];
+}
+
+- (SLNFilterType)type {
+	return SLNFileTypeFilterType;
+}
+- (strarg_t)stringArg:(size_t const)i {
+	if(0 == i) return type;
+	return NULL;
+}
+- (int)addStringArg:(strarg_t const)str :(size_t const)len {
+	if(!type) {
+		str_t *const tmp = strndup(str, len);
+		if(!tmp) return KVS_ENOMEM;
+		type = SLNFileTypeNormalize(tmp);
+		free(tmp);
+		if(!type) return KVS_ENOMEM;
+		return 0;
+	}
+	return KVS_EINVAL;
+}
+- (void)printSexp:(FILE *const)file :(size_t const)depth {
+	indent(file, depth);
+	fprintf(file, "(type \"%s\")\n", type);
+}
+- (void)printUser:(FILE *const)file :(size_t const)depth {
+	fprintf(file, "filetype=%s", type);
+}
+
+- (int)prepare:(KVS_txn *const)txn {
+	assert(!curtxn);
+	int rc = [super prepare:txn];
+	if(rc < 0) return rc;
+	kvs_cursor_open(txn, &files); // SLNFileIDByType
+	kvs_cursor_open(txn, &age); // SLNFileIDByType
+	curtxn = txn;
+	return 0;
+}
+- (void)reset {
+	kvs_cursor_close(files); files = NULL;
+	kvs_cursor_close(age); age = NULL;
+	curtxn = NULL;
+	[super reset];
+}
+- (void)seek:(int const)dir :(uint64_t const)sortID :(uint64_t const)fileID {
+	uint64_t x = sortID;
+	if(valid(x) && dir > 0 && fileID > sortID) x++;
+	if(valid(x) && dir < 0 && fileID < sortID) x--;
+
+	KVS_range range[1];
+	KVS_val key[1];
+	SLNFileIDByTypeRange1(range, curtxn, type);
+	SLNFileIDByTypeKeyPack(key, curtxn, type, x);
+	int rc = kvs_cursor_seekr(files, range, key, NULL, dir);
+	kvs_assertf(rc >= 0 || KVS_NOTFOUND == rc, "Database error %s", sln_strerror(rc));
+}
+- (void)current:(int const)dir :(uint64_t *const)sortID :(uint64_t *const)fileID {
+	KVS_val key[1];
+	int rc = kvs_cursor_current(files, key, NULL);
+	if(rc >= 0) {
+		strarg_t t;
+		uint64_t x;
+		SLNFileIDByTypeKeyUnpack(key, curtxn, &t, &x);
+		if(sortID) *sortID = x;
+		if(fileID) *fileID = x;
+	} else {
+		if(sortID) *sortID = invalid(dir);
+		if(fileID) *fileID = invalid(dir);
+	}
+}
+- (void)step:(int const)dir {
+	KVS_range range[1];
+	SLNFileIDByTypeRange1(range, curtxn, type);
+	int rc = kvs_cursor_nextr(files, range, NULL, NULL, dir);
+	kvs_assertf(rc >= 0 || KVS_NOTFOUND == rc, "Database error %s", sln_strerror(rc));
+}
+- (SLNAgeRange)fullAge:(uint64_t const)fileID {
+	KVS_val key[1];
+	SLNFileIDByTypeKeyPack(key, curtxn, type, fileID);
+	int rc = kvs_cursor_seek(age, key, NULL, 0);
+	if(KVS_NOTFOUND == rc) return (SLNAgeRange){UINT64_MAX, UINT64_MAX};
+	kvs_assertf(rc >= 0, "Database error %s", sln_strerror(rc));
+	return (SLNAgeRange){fileID, UINT64_MAX};
+}
+- (uint64_t)fastAge:(uint64_t const)fileID :(uint64_t const)sortID {
+	return [self fullAge:fileID].min;
+}
+- (bool)mightMatch:(KVS_txn *const)txn :(uint64_t const)after :(uint64_t const)latest {
+	KVS_cursor *cursor = NULL;
+	int rc = kvs_txn_cursor(txn, &cursor);
+	if(rc < 0) return true;
+	KVS_range range[1];
+	KVS_val key[1];
+	SLNFileIDByTypeRange1(range, txn, type);
+	SLNFileIDByTypeKeyPack(key, txn, type, after+1);
+	rc = kvs_cursor_seekr(cursor, range, key, NULL, +1);
+	if(rc < 0) return KVS_NOTFOUND != rc;
+	strarg_t t;
+	uint64_t x;
+	SLNFileIDByTypeKeyUnpack(key, txn, &t, &x);
+	return x <= latest;
+}
 @end
 
 @implementation SLNAllFilter
@@ -39,6 +39,19 @@
 - (void)step:(int const)dir;
 - (SLNAgeRange)fullAge:(uint64_t const)fileID;
 - (uint64_t)fastAge:(uint64_t const)fileID :(uint64_t const)sortID;
+
+// Raw index entries from the given position onward, up to max. No age
+// checks, so duplicates and stale entries are included, as is the
+// starting entry itself. Filters that hold their matches in an array
+// count from the array; the rest walk their cursors, so the cost is
+// linear in max.
+- (uint64_t)estimate:(int const)dir :(uint64_t const)sortID :(uint64_t const)fileID :(uint64_t const)max;
+// Whether anything sorted in (after, latest] could match, without
+// having to -prepare:. Only false if we're sure.
+- (bool)mightMatch:(KVS_txn *const)txn :(uint64_t const)after :(uint64_t const)latest;
+// Whether we step through every file we match, so that once we run dry
+// there can't be any more matches. Negations don't.
+- (bool)listsMatches;
 @end
 
 @interface SLNIndirectFilter : SLNFilter
@@ -71,17 +84,20 @@
 
 struct token {
 	str_t *str;
+	uint64_t pos; // Relative to the start of the term.
 };
 @interface SLNFulltextFilter : SLNIndirectFilter
 {
 	str_t *term;
+	bool quoted; // Match as a phrase.
 	struct token *tokens;
 	size_t count;
 	size_t asize;
 	KVS_cursor *metafiles;
-	KVS_cursor *phrase; // TODO
+	KVS_cursor *phrase;
 	KVS_cursor *match;
 }
+- (bool)matchPhrase:(uint64_t const)metaFileID;
 @end
 
 @interface SLNMetadataFilter : SLNIndirectFilter
@@ -91,6 +107,35 @@ struct token {
 	KVS_cursor *metafiles;
 	KVS_cursor *match;
 }
+- (uint64_t)table; // Which field/value index to read.
+@end
+// Field and value are stored folded, and matched against
+// SLNFoldedFieldValueAndMetaFileID.
+@interface SLNFoldedMetadataFilter : SLNMetadataFilter
+@end
+
+// SLNMetadataRangeFilter.m
+#define RANGE_MERGE_MAX 32 // Past this many distinct values we sort instead.
+#define RANGE_CHECK_MAX 16 // New meta-files -mightMatch::: checks one by one.
+@interface SLNMetadataRangeFilter : SLNIndirectFilter
+{
+	str_t *field;
+	str_t *low; // Inclusive.
+	str_t *high; // Exclusive, empty for no upper bound.
+	str_t *values[RANGE_MERGE_MAX]; // Distinct values, one cursor each.
+	KVS_cursor *cursors[RANGE_MERGE_MAX];
+	uint64_t ids[RANGE_MERGE_MAX]; // Current meta-file ID per cursor.
+	size_t nvalues;
+	uint64_t *metaFileIDs; // Sorted, when there are too many values.
+	size_t count;
+	size_t cur;
+	KVS_cursor *match;
+}
+- (bool)inRange:(strarg_t const)value;
+- (void)clear;
+- (int)collect:(KVS_txn *const)txn;
+@end
+@interface SLNMetadataPrefixFilter : SLNMetadataRangeFilter
 @end
 
 // SLNCollectionFilter.m
@@ -156,6 +201,14 @@ struct token {
 	KVS_cursor *age;
 }
 @end
+@interface SLNFileTypeFilter : SLNFilter
+{
+	KVS_txn *curtxn;
+	str_t *type;
+	KVS_cursor *files;
+	KVS_cursor *age;
+}
+@end
 @interface SLNAllFilter : SLNFilter
 {
 	KVS_cursor *files;
@@ -170,6 +223,21 @@ struct token {
 }
 @end
 
+// SLNLinkedFromFilter.m
+struct link {
+	uint64_t sortID; // Earliest meta-file with the link.
+	uint64_t fileID; // Linked file.
+};
+@interface SLNLinkedFromFilter : SLNFilter
+{
+	str_t *URI;
+	struct link *links; // Sorted by sortID, fileID.
+	struct link *byfile; // Sorted by fileID, for -fullAge:.
+	size_t count;
+	size_t cur;
+}
+@end
+
 
 static bool valid(uint64_t const x) {
 	return 0 != x && UINT64_MAX != x;
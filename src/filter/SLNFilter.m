@@ -33,6 +33,23 @@
 	return 0;
 }
 - (void)reset {}
+- (uint64_t)estimate:(int const)dir :(uint64_t const)sortID :(uint64_t const)fileID :(uint64_t const)max {
+	uint64_t n = 0;
+	[self seek:dir :sortID :fileID];
+	for(; n < max; n++) {
+		uint64_t s;
+		[self current:dir :&s :NULL];
+		if(!valid(s)) break;
+		[self step:dir];
+	}
+	return n;
+}
+- (bool)mightMatch:(KVS_txn *const)txn :(uint64_t const)after :(uint64_t const)latest {
+	return true;
+}
+- (bool)listsMatches {
+	return true;
+}
 @end
 
 int SLNFilterCreate(SLNSessionRef const session, SLNFilterType const type, SLNFilterRef *const out) {
@@ -52,12 +69,20 @@ SLNFilterRef SLNFilterCreateInternal(SLNFilterType const type) {
 			return (SLNFilterRef)[[SLNFulltextFilter alloc] init];
 		case SLNMetadataFilterType:
 			return (SLNFilterRef)[[SLNMetadataFilter alloc] init];
+		case SLNFoldedMetadataFilterType:
+			return (SLNFilterRef)[[SLNFoldedMetadataFilter alloc] init];
+		case SLNMetadataPrefixFilterType:
+			return (SLNFilterRef)[[SLNMetadataPrefixFilter alloc] init];
+		case SLNMetadataRangeFilterType:
+			return (SLNFilterRef)[[SLNMetadataRangeFilter alloc] init];
 		case SLNIntersectionFilterType:
 			return (SLNFilterRef)[[SLNIntersectionFilter alloc] init];
 		case SLNUnionFilterType:
 			return (SLNFilterRef)[[SLNUnionFilter alloc] init];
 		case SLNNegationFilterType:
 			return (SLNFilterRef)[[SLNNegationFilter alloc] init];
+		case SLNFileTypeFilterType:
+			return (SLNFilterRef)[[SLNFileTypeFilter alloc] init];
 		case SLNURIFilterType:
 			return (SLNFilterRef)[[SLNURIFilter alloc] init];
 		case SLNTargetURIFilterType:
@@ -66,6 +91,8 @@ SLNFilterRef SLNFilterCreateInternal(SLNFilterType const type) {
 			return (SLNFilterRef)[[SLNMetaFileFilter alloc] init];
 		case SLNLinksToFilterType:
 			return (SLNFilterRef)[[SLNLinksToFilter alloc] init];
+		case SLNLinkedFromFilterType:
+			return (SLNFilterRef)[[SLNLinkedFromFilter alloc] init];
 		default:
 			assert(!"Filter type"); return NULL;
 	}
@@ -130,4 +157,13 @@ uint64_t SLNFilterFastAge(SLNFilterRef const filter, uint64_t const fileID, uint
 	assert(filter);
 	return [(SLNFilter *)filter fastAge:fileID :sortID];
 }
+uint64_t SLNFilterEstimate(SLNFilterRef const filter, int const dir, uint64_t const sortID, uint64_t const fileID, uint64_t const max) {
+	assert(filter);
+	return [(SLNFilter *)filter estimate:dir :sortID :fileID :max];
+}
+bool SLNFilterMightMatch(SLNFilterRef const filter, KVS_txn *const txn, uint64_t const after, uint64_t const latest) {
+	assert(filter);
+	if(latest <= after) return false;
+	return [(SLNFilter *)filter mightMatch:txn :after :latest];
+}
 
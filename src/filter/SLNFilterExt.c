@@ -88,10 +88,12 @@ void SLNFilterPositionCleanup(SLNFilterPosition *const pos) {
 	assert_zeroed(pos, 1);
 }
 
-int SLNFilterSeekToPosition(SLNFilterRef const filter, SLNFilterPosition const *const pos, KVS_txn *const txn) {
+// Turns a start URI into the sort position it has under this filter.
+// Positions without a URI are passed through as-is.
+static int position_resolve(SLNFilterRef const filter, SLNFilterPosition const *const pos, KVS_txn *const txn, uint64_t *const sortID, uint64_t *const fileID) {
 	if(!pos->URI) {
-		SLNFilterSeek(filter, pos->dir, pos->sortID, pos->fileID);
-		if(valid(pos->fileID)) SLNFilterStep(filter, pos->dir);
+		*sortID = pos->sortID;
+		*fileID = pos->fileID;
 		return 0;
 	}
 
@@ -115,16 +117,22 @@ int SLNFilterSeekToPosition(SLNFilterRef const filter, SLNFilterPosition const *
 	if(KVS_NOTFOUND != rc) return rc;
 
 	strarg_t u;
-	uint64_t fileID;
-	SLNURIAndFileIDKeyUnpack(key, txn, &u, &fileID);
+	uint64_t f;
+	SLNURIAndFileIDKeyUnpack(key, txn, &u, &f);
 	assert(0 == strcmp(pos->URI, u));
 
-	SLNAgeRange const ages = SLNFilterFullAge(filter, fileID);
+	SLNAgeRange const ages = SLNFilterFullAge(filter, f);
 	if(!valid(ages.min) || ages.min > ages.max) return KVS_NOTFOUND;
-	uint64_t const sortID = ages.min;
-
+	*sortID = ages.min;
+	*fileID = f;
+	return 0;
+}
+int SLNFilterSeekToPosition(SLNFilterRef const filter, SLNFilterPosition const *const pos, KVS_txn *const txn) {
+	uint64_t sortID, fileID;
+	int rc = position_resolve(filter, pos, txn, &sortID, &fileID);
+	if(rc < 0) return rc;
 	SLNFilterSeek(filter, pos->dir, sortID, fileID);
-	SLNFilterStep(filter, pos->dir); // Start just before/after the URI.
+	if(valid(fileID)) SLNFilterStep(filter, pos->dir); // Start just before/after the URI.
 	// TODO: Stepping is almost assuredly wrong if the URI doesn't match
 	// the filter. We should check if our seek was a direct hit, and
 	// only step if it was.
@@ -227,6 +235,74 @@ cleanup:
 
 	return rc;
 }
+// Same walk as SLNFilterCopyURIs, minus the FileByID lookup and URI
+// formatting, all in one txn.
+int SLNFilterCountURIs(SLNFilterRef const filter, SLNSessionRef const session, SLNFilterPosition *const pos, uint64_t const max, uint64_t *const out) {
+	assert(out);
+	if(!SLNSessionHasPermission(session, SLN_RDONLY)) return KVS_EACCES;
+	if(0 == pos->dir) return KVS_EINVAL;
+
+	KVS_env *db = NULL;
+	KVS_txn *txn = NULL;
+	uint64_t n = 0;
+	int rc = 0;
+
+	rc = SLNSessionDBOpen(session, SLN_RDONLY, &db);
+	if(rc < 0) goto cleanup;
+	rc = kvs_txn_begin(db, NULL, KVS_RDONLY, &txn);
+	if(rc < 0) goto cleanup;
+
+	rc = SLNFilterPrepare(filter, txn);
+	if(rc < 0) goto cleanup;
+	rc = SLNFilterSeekToPosition(filter, pos, txn);
+	if(rc < 0) goto cleanup;
+
+	for(; n < max; n++) {
+		rc = SLNFilterGetPosition(filter, pos, txn);
+		if(KVS_NOTFOUND == rc) {
+			rc = 0;
+			break;
+		}
+		if(rc < 0) goto cleanup;
+		SLNFilterStep(filter, pos->dir);
+	}
+	*out = n;
+
+cleanup:
+	SLNFilterReset(filter);
+	kvs_txn_abort(txn); txn = NULL;
+	SLNSessionDBClose(session, &db);
+	return rc;
+}
+// Upper bound on the matches after pos, from the raw index entries of
+// each filter, without age checks. See -estimate:::: for the costs.
+int SLNFilterEstimateURIs(SLNFilterRef const filter, SLNSessionRef const session, SLNFilterPosition const *const pos, uint64_t const max, uint64_t *const out) {
+	assert(out);
+	if(!SLNSessionHasPermission(session, SLN_RDONLY)) return KVS_EACCES;
+	if(0 == pos->dir) return KVS_EINVAL;
+
+	KVS_env *db = NULL;
+	KVS_txn *txn = NULL;
+	int rc = 0;
+
+	rc = SLNSessionDBOpen(session, SLN_RDONLY, &db);
+	if(rc < 0) goto cleanup;
+	rc = kvs_txn_begin(db, NULL, KVS_RDONLY, &txn);
+	if(rc < 0) goto cleanup;
+
+	rc = SLNFilterPrepare(filter, txn);
+	if(rc < 0) goto cleanup;
+	uint64_t sortID, fileID;
+	rc = position_resolve(filter, pos, txn, &sortID, &fileID);
+	if(rc < 0) goto cleanup;
+	*out = SLNFilterEstimate(filter, pos->dir, sortID, fileID, max);
+
+cleanup:
+	SLNFilterReset(filter);
+	kvs_txn_abort(txn); txn = NULL;
+	SLNSessionDBClose(session, &db);
+	return rc;
+}
 ssize_t SLNFilterWriteURIBatch(SLNFilterRef const filter, SLNSessionRef const session, SLNFilterPosition *const pos, bool const meta, uint64_t const max, SLNFilterWriteCB const writecb, void *ctx) {
 	str_t *URIs[BATCH_SIZE];
 	ssize_t const count = SLNFilterCopyURIs(filter, session, pos, pos->dir, meta, URIs, MIN(max, BATCH_SIZE));
@@ -242,41 +318,120 @@ ssize_t SLNFilterWriteURIBatch(SLNFilterRef const filter, SLNSessionRef const se
 	if(rc < 0) return rc;
 	return count;
 }
-int SLNFilterWriteURIs(SLNFilterRef const filter, SLNSessionRef const session, SLNFilterPosition *const pos, bool const meta, uint64_t const max, bool const wait, SLNFilterWriteCB const writecb, SLNFilterFlushCB const flushcb, void *ctx) {
-	uint64_t remaining = max;
+
+// Past the first batch, results are copied a page at a time and then
+// written out BATCH_SIZE at a time. Each page is its own read txn, with
+// its own prepare and seek from the saved position. We don't keep one
+// txn open while results are flowing: it would have to stay open across
+// writes to the client, and a slow client must never hold up a map
+// resize, since that blocks every other DB user in the meantime.
+// Pages start at STREAM_MIN and double up to STREAM_MAX, so a long
+// stream pays for a prepare (e.g. a range filter collecting and sorting
+// its whole range) every STREAM_MAX results rather than every STREAM_MIN.
+// Since no txn outlives one copy, it runs on the shared pool like any
+// other query rather than on a thread of its own.
+#define STREAM_MIN (BATCH_SIZE * 20)
+#define STREAM_MAX (BATCH_SIZE * 20 * 8)
+static ssize_t write_stream(SLNFilterRef const filter, SLNSessionRef const session, SLNFilterPosition *const pos, bool const meta, uint64_t const max, str_t **const URIs, size_t const page, SLNFilterWriteCB const writecb, void *ctx) {
+	ssize_t const count = SLNFilterCopyURIs(filter, session, pos, pos->dir, meta, URIs, MIN(max, page));
+	if(count <= 0) return count;
+	int rc = 0;
+	uv_buf_t parts[BATCH_SIZE*2];
+	for(size_t i = 0; i < count && rc >= 0; i += BATCH_SIZE) {
+		size_t const n = MIN((size_t)count - i, BATCH_SIZE);
+		for(size_t j = 0; j < n; j++) {
+			parts[j*2+0] = uv_buf_init((char *)URIs[i+j], strlen(URIs[i+j]));
+			parts[j*2+1] = UV_BUF_STATIC("\r\n");
+		}
+		rc = writecb(ctx, parts, n*2);
+	}
+	for(size_t i = 0; i < count; i++) FREE(&URIs[i]);
+	assert_zeroed(URIs, count);
+	if(rc < 0) return rc;
+	return count;
+}
+
+// Writes until the filter runs dry or we hit `remaining`.
+// Returns 1 if there might be more, 0 if we ran dry.
+static int write_all(SLNFilterRef const filter, SLNSessionRef const session, SLNFilterPosition *const pos, bool const meta, uint64_t *const remaining, SLNFilterWriteCB const writecb, void *ctx) {
+	// Most queries fit in one batch, so don't bother with a bigger
+	// buffer unless there's more to come.
+	ssize_t count = SLNFilterWriteURIBatch(filter, session, pos, meta, *remaining, writecb, ctx);
+	if(count < 0) return count;
+	*remaining -= count;
+	if(!*remaining) return 1;
+	if(count < BATCH_SIZE) return 0;
+
+	size_t size = STREAM_MIN;
+	str_t **URIs = calloc(size, sizeof(*URIs));
+	if(!URIs) return KVS_ENOMEM;
+	int rc = 0;
 	for(;;) {
-		ssize_t const count = SLNFilterWriteURIBatch(filter, session, pos, meta, remaining, writecb, ctx);
-		if(count < 0) return count;
-		remaining -= count;
-		if(!remaining) return 0;
-		if(!count) break;
+		count = write_stream(filter, session, pos, meta, *remaining, URIs, size, writecb, ctx);
+		if(count < 0) {
+			rc = count;
+			break;
+		}
+		*remaining -= count;
+		if(!*remaining) {
+			rc = 1;
+			break;
+		}
+		if((size_t)count < size) {
+			rc = 0;
+			break;
+		}
+		if(size < STREAM_MAX) {
+			// Not reallocarray, the old contents don't matter.
+			str_t **const x = calloc(size * 2, sizeof(*URIs));
+			if(x) {
+				FREE(&URIs);
+				URIs = x;
+				size *= 2;
+			}
+		}
 	}
+	FREE(&URIs);
+	return rc;
+}
+// Run by the committing fiber, in its txn, so that we only wake up when
+// the new submissions might be ours.
+static bool might_match(void *const ctx, KVS_txn *const txn, uint64_t const after, uint64_t const latest) {
+	return SLNFilterMightMatch((SLNFilterRef)ctx, txn, after, latest);
+}
+int SLNFilterWriteURIs(SLNFilterRef const filter, SLNSessionRef const session, SLNFilterPosition *const pos, bool const meta, uint64_t const max, bool const wait, SLNFilterWriteCB const writecb, SLNFilterFlushCB const flushcb, void *ctx) {
+	uint64_t remaining = max;
+	int rc = write_all(filter, session, pos, meta, &remaining, writecb, ctx);
+	if(rc < 0) return rc;
+	if(!remaining) return 0;
 
 	if(!wait || pos->dir < 0) return 0;
 
 	SLNRepoRef const repo = SLNSessionGetRepo(session);
 	for(;;) {
-		int rc = flushcb ? flushcb(ctx) : 0;
+		rc = flushcb ? flushcb(ctx) : 0;
 		if(rc < 0) return rc;
 
 		uint64_t latest = pos->sortID;
 		uint64_t const timeout = uv_now(async_loop)+(1000 * 30);
-		rc = SLNRepoSubmissionWait(repo, &latest, timeout);
+		rc = SLNRepoSubmissionWait(repo, &latest, timeout, might_match, filter);
 		if(UV_ETIMEDOUT == rc) {
+			// Everything committed meanwhile failed might_match.
+			if(pos->sortID < latest) {
+				pos->sortID = latest;
+				pos->fileID = 0;
+			}
 			uv_buf_t const parts[] = { UV_BUF_STATIC("\r\n") };
 			rc = writecb(ctx, parts, numberof(parts));
 			if(rc < 0) break;
 			continue;
 		}
-		assert(rc >= 0); // TODO: Handle cancellation?
-
-		for(;;) {
-			ssize_t const count = SLNFilterWriteURIBatch(filter, session, pos, meta, remaining, writecb, ctx);
-			if(count < 0) return count;
-			remaining -= count;
-			if(!remaining) return 0;
-			if(count < BATCH_SIZE) break;
-		}
+		if(rc < 0) break; // Canceled for shutdown.
+
+		// Every page opens its own txn, so this one can see the new files.
+		rc = write_all(filter, session, pos, meta, &remaining, writecb, ctx);
+		if(rc < 0) return rc;
+		if(!remaining) return 0;
 
 		// This is how far we scanned, even if we didn't find anything.
 		if(pos->sortID < latest) {
@@ -215,14 +215,17 @@
 @implementation SLNFulltextFilter
 - (void)free {
 	FREE(&term);
+	quoted = false;
 	for(size_t i = 0; i < count; ++i) {
 		FREE(&tokens[i].str);
+		tokens[i].pos = 0;
 	}
 	assert_zeroed(tokens, count);
 	FREE(&tokens);
 	count = 0;
 	asize = 0;
 	kvs_cursor_close(metafiles); metafiles = NULL;
+	kvs_cursor_close(phrase); phrase = NULL;
 	kvs_cursor_close(match); match = NULL;
 	[super free];
 }
@@ -239,7 +242,15 @@
 	if(0 == len) return KVS_EINVAL;
 	if(term) return KVS_EINVAL;
 	if(count) return KVS_EINVAL;
-	term = strndup(str, len);
+	// A term wrapped in quotes is a phrase, otherwise we just
+	// require all of the tokens somewhere in the meta-file.
+	if(len >= 2 && ('"' == str[0] || '\'' == str[0]) && str[0] == str[len-1]) {
+		quoted = true;
+		term = strndup(str+1, len-2);
+	} else {
+		term = strndup(str, len);
+	}
+	if(!term) return KVS_ENOMEM;
 
 	// TODO: libstemmer?
 	sqlite3_tokenizer_module const *fts = NULL;
@@ -253,8 +264,9 @@
 	for(;;) {
 		strarg_t token;
 		int tlen;
-		int ignored1, ignored2, ignored3;
-		rc = fts->xNext(tcur, &token, &tlen, &ignored1, &ignored2, &ignored3);
+		int tpos;
+		int ignored1, ignored2;
+		rc = fts->xNext(tcur, &token, &tlen, &ignored1, &ignored2, &tpos);
 		if(SQLITE_OK != rc) break;
 		if(count+1 > asize) {
 			asize = MAX(8, asize*2);
@@ -262,6 +274,7 @@
 			assert(tokens); // TODO
 		}
 		tokens[count].str = strndup(token, tlen);
+		tokens[count].pos = tpos;
 		assert(tokens[count].str); // TODO
 		count++;
 	}
@@ -273,10 +286,11 @@
 }
 - (void)printSexp:(FILE *const)file :(size_t const)depth {
 	indent(file, depth);
-	fprintf(file, "(fulltext %s)\n", term);
+	if(quoted) fprintf(file, "(fulltext \"%s\")\n", term);
+	else fprintf(file, "(fulltext %s)\n", term);
 }
 - (void)printUser:(FILE *const)file :(size_t const)depth {
-	bool const quo = needs_quotes(term);
+	bool const quo = quoted || needs_quotes(term);
 	if(quo) fprintf(file, "\"");
 	fprintf(file, "%s", term);
 	if(quo) fprintf(file, "\"");
@@ -286,22 +300,27 @@
 	int rc = [super prepare:txn];
 	if(rc < 0) return rc;
 	kvs_cursor_open(txn, &metafiles);
+	kvs_cursor_open(txn, &phrase);
 	kvs_cursor_open(txn, &match);
 	return 0;
 }
 - (void)reset {
 	kvs_cursor_close(metafiles); metafiles = NULL;
+	kvs_cursor_close(phrase); phrase = NULL;
 	kvs_cursor_close(match); match = NULL;
 	[super reset];
 }
 
-- (uint64_t)seekMeta:(int const)dir :(uint64_t const)sortID {
+// We walk the first token's meta-files and check the rest with -match:.
+// Each meta-file can have the token at several positions, so we always
+// seek past the whole meta-file rather than stepping.
+- (uint64_t)seekTerm:(int const)dir :(uint64_t const)sortID {
 	assert(count);
 	KVS_range range[1];
 	SLNTermMetaFileIDAndPositionRange1(range, curtxn, tokens[0].str);
 	KVS_val sortID_key[1];
-	SLNTermMetaFileIDAndPositionKeyPack(sortID_key, curtxn, tokens[0].str, sortID, 0);
-	// TODO: In order to handle seeking backwards over document with several matching positions, we need to use sortID+1... But sortID might be UINT64_MAX, so be careful.
+	uint64_t const pos = dir > 0 ? 0 : UINT64_MAX;
+	SLNTermMetaFileIDAndPositionKeyPack(sortID_key, curtxn, tokens[0].str, sortID, pos);
 	int rc = kvs_cursor_seekr(metafiles, range, sortID_key, NULL, dir);
 	if(rc < 0) return invalid(dir);
 	strarg_t token;
@@ -310,6 +329,14 @@
 	assert(0 == strcmp(tokens[0].str, token));
 	return actualSortID;
 }
+- (uint64_t)seekMeta:(int const)dir :(uint64_t const)sortID {
+	uint64_t x = [self seekTerm:dir :sortID];
+	if(1 == count) return x;
+	while(valid(x) && ![self match:x]) {
+		x = [self seekTerm:dir :x+dir];
+	}
+	return x;
+}
 - (uint64_t)currentMeta:(int const)dir {
 	assert(count);
 	KVS_val sortID_key[1];
@@ -322,30 +349,90 @@
 	return sortID;
 }
 - (uint64_t)stepMeta:(int const)dir {
-	assert(count);
-	KVS_range range[1];
-	SLNTermMetaFileIDAndPositionRange1(range, curtxn, tokens[0].str);
-	KVS_val sortID_key[1];
-	int rc = kvs_cursor_nextr(metafiles, range, sortID_key, NULL, dir);
-	if(rc < 0) return invalid(dir);
-	strarg_t token;
-	uint64_t sortID, position;
-	SLNTermMetaFileIDAndPositionKeyUnpack(sortID_key, curtxn, &token, &sortID, &position);
-	assert(0 == strcmp(tokens[0].str, token));
-	return sortID;
+	uint64_t const x = [self currentMeta:dir];
+	if(!valid(x)) return x;
+	return [self seekMeta:dir :x+dir];
 }
 - (bool)match:(uint64_t const)metaFileID {
 	assert(count);
+	if(quoted && count > 1) return [self matchPhrase:metaFileID];
+	for(size_t i = 0; i < count; i++) {
+		KVS_range range[1];
+		SLNTermMetaFileIDAndPositionRange2(range, curtxn, tokens[i].str, metaFileID);
+		int rc = kvs_cursor_firstr(match, range, NULL, NULL, +1);
+		if(KVS_NOTFOUND == rc) return false;
+		assertf(rc >= 0, "Database error %s", sln_strerror(rc));
+	}
+	return true;
+}
+- (bool)matchPhrase:(uint64_t const)metaFileID {
 	KVS_range range[1];
 	SLNTermMetaFileIDAndPositionRange2(range, curtxn, tokens[0].str, metaFileID);
-	KVS_val sortID_key[1];
-	int rc = kvs_cursor_firstr(match, range, sortID_key, NULL, +1);
-	if(rc >= 0) return true;
-	if(KVS_NOTFOUND == rc) return false;
-	assertf(0, "Database error %s", sln_strerror(rc));
+	KVS_val key[1];
+	int rc = kvs_cursor_firstr(phrase, range, key, NULL, +1);
+	for(; rc >= 0; rc = kvs_cursor_nextr(phrase, range, key, NULL, +1)) {
+		strarg_t token;
+		uint64_t m, position;
+		SLNTermMetaFileIDAndPositionKeyUnpack(key, curtxn, &token, &m, &position);
+		assert(metaFileID == m);
+		if(position < tokens[0].pos) continue;
+		uint64_t const start = position - tokens[0].pos;
+		size_t i = 1;
+		for(; i < count; i++) {
+			KVS_val next[1];
+			SLNTermMetaFileIDAndPositionKeyPack(next, curtxn, tokens[i].str, metaFileID, start+tokens[i].pos);
+			rc = kvs_cursor_seek(match, next, NULL, 0);
+			if(KVS_NOTFOUND == rc) break;
+			assertf(rc >= 0, "Database error %s", sln_strerror(rc));
+		}
+		if(i >= count) return true;
+	}
+	assertf(KVS_NOTFOUND == rc, "Database error %s", sln_strerror(rc));
+	return false;
+}
+- (bool)mightMatch:(KVS_txn *const)txn :(uint64_t const)after :(uint64_t const)latest {
+	// Every token is required, so checking the first is enough.
+	if(!count) return true;
+	KVS_cursor *cursor = NULL;
+	int rc = kvs_txn_cursor(txn, &cursor);
+	if(rc < 0) return true;
+	KVS_range range[1];
+	SLNTermMetaFileIDAndPositionRange1(range, txn, tokens[0].str);
+	KVS_val key[1];
+	SLNTermMetaFileIDAndPositionKeyPack(key, txn, tokens[0].str, after+1, 0);
+	rc = kvs_cursor_seekr(cursor, range, key, NULL, +1);
+	if(rc < 0) return KVS_NOTFOUND != rc;
+	strarg_t token;
+	uint64_t sortID, position;
+	SLNTermMetaFileIDAndPositionKeyUnpack(key, txn, &token, &sortID, &position);
+	return sortID <= latest;
 }
 @end
 
+// The plain and folded metadata tables have the same layout, so the
+// folded filter only needs to say which one it reads.
+#define MetadataKeyPack(val, txn, table, field, value, metaFileID) \
+	KVS_VAL_STORAGE(val, KVS_VARINT_MAX * 2 + KVS_INLINE_MAX * 2); \
+	kvs_bind_uint64((val), (table)); \
+	kvs_bind_string((val), field, (txn)); \
+	kvs_bind_string((val), value, (txn)); \
+	kvs_bind_uint64((val), (metaFileID)); \
+	KVS_VAL_STORAGE_VERIFY(val);
+#define MetadataRange2(range, txn, table, field, value) \
+	KVS_RANGE_STORAGE(range, KVS_VARINT_MAX * 1 + KVS_INLINE_MAX * 2); \
+	kvs_bind_uint64((range)->min, (table)); \
+	kvs_bind_string((range)->min, (field), (txn)); \
+	kvs_bind_string((range)->min, (value), (txn)); \
+	kvs_range_genmax((range)); \
+	KVS_RANGE_STORAGE_VERIFY(range);
+static void MetadataKeyUnpack(KVS_val *const val, KVS_txn *const txn, uint64_t const expected, strarg_t *const field, strarg_t *const value, uint64_t *const metaFileID) {
+	uint64_t const table = kvs_read_uint64(val);
+	assert(expected == table);
+	*field = kvs_read_string(val, txn);
+	*value = kvs_read_string(val, txn);
+	*metaFileID = kvs_read_uint64(val);
+}
+
 @implementation SLNMetadataFilter
 - (void)free {
 	FREE(&field);
@@ -358,6 +445,9 @@
 - (SLNFilterType)type {
 	return SLNMetadataFilterType;
 }
+- (uint64_t)table {
+	return SLNFieldValueAndMetaFileID;
+}
 - (strarg_t)stringArg:(size_t const)i {
 	switch(i) {
 		case 0: return field;
@@ -410,14 +500,14 @@
 
 - (uint64_t)seekMeta:(int const)dir :(uint64_t const)sortID {
 	KVS_range range[1];
-	SLNFieldValueAndMetaFileIDRange2(range, curtxn, field, value);
+	MetadataRange2(range, curtxn, [self table], field, value);
 	KVS_val metadata_key[1];
-	SLNFieldValueAndMetaFileIDKeyPack(metadata_key, curtxn, field, value, sortID);
+	MetadataKeyPack(metadata_key, curtxn, [self table], field, value, sortID);
 	int rc = kvs_cursor_seekr(metafiles, range, metadata_key, NULL, dir);
 	if(rc < 0) return invalid(dir);
 	strarg_t f, v;
 	uint64_t actualSortID;
-	SLNFieldValueAndMetaFileIDKeyUnpack(metadata_key, curtxn, &f, &v, &actualSortID);
+	MetadataKeyUnpack(metadata_key, curtxn, [self table], &f, &v, &actualSortID);
 	return actualSortID;
 }
 - (uint64_t)currentMeta:(int const)dir {
@@ -426,27 +516,78 @@
 	if(rc < 0) return invalid(dir);
 	strarg_t f, v;
 	uint64_t sortID;
-	SLNFieldValueAndMetaFileIDKeyUnpack(metadata_key, curtxn, &f, &v, &sortID);
+	MetadataKeyUnpack(metadata_key, curtxn, [self table], &f, &v, &sortID);
 	return sortID;
 }
 - (uint64_t)stepMeta:(int const)dir {
 	KVS_range range[1];
-	SLNFieldValueAndMetaFileIDRange2(range, curtxn, field, value);
+	MetadataRange2(range, curtxn, [self table], field, value);
 	KVS_val metadata_key[1];
 	int rc = kvs_cursor_nextr(metafiles, range, metadata_key, NULL, dir);
 	if(rc < 0) return invalid(dir);
 	strarg_t f, v;
 	uint64_t sortID;
-	SLNFieldValueAndMetaFileIDKeyUnpack(metadata_key, curtxn, &f, &v, &sortID);
+	MetadataKeyUnpack(metadata_key, curtxn, [self table], &f, &v, &sortID);
 	return sortID;
 }
 - (bool)match:(uint64_t const)metaFileID {
 	KVS_val metadata_key[1];
-	SLNFieldValueAndMetaFileIDKeyPack(metadata_key, curtxn, field, value, metaFileID);
+	MetadataKeyPack(metadata_key, curtxn, [self table], field, value, metaFileID);
 	int rc = kvs_cursor_seek(match, metadata_key, NULL, 0);
 	if(rc >= 0) return true;
 	if(KVS_NOTFOUND == rc) return false;
 	assertf(0, "Database error %s", sln_strerror(rc));
 }
+- (bool)mightMatch:(KVS_txn *const)txn :(uint64_t const)after :(uint64_t const)latest {
+	KVS_cursor *cursor = NULL;
+	int rc = kvs_txn_cursor(txn, &cursor);
+	if(rc < 0) return true;
+	KVS_range range[1];
+	MetadataRange2(range, txn, [self table], field, value);
+	KVS_val metadata_key[1];
+	MetadataKeyPack(metadata_key, txn, [self table], field, value, after+1);
+	rc = kvs_cursor_seekr(cursor, range, metadata_key, NULL, +1);
+	if(rc < 0) return KVS_NOTFOUND != rc;
+	strarg_t f, v;
+	uint64_t sortID;
+	MetadataKeyUnpack(metadata_key, txn, [self table], &f, &v, &sortID);
+	return sortID <= latest;
+}
 @end
 
+@implementation SLNFoldedMetadataFilter
+- (SLNFilterType)type {
+	return SLNFoldedMetadataFilterType;
+}
+- (uint64_t)table {
+	return SLNFoldedFieldValueAndMetaFileID;
+}
+- (int)addStringArg:(strarg_t const)str :(size_t const)len {
+	if(!field) {
+		field = SLNStringFold(str, len);
+		if(!field) return KVS_ENOMEM;
+		return 0;
+	}
+	if(!value) {
+		value = SLNStringFold(str, len);
+		if(!value) return KVS_ENOMEM;
+		return 0;
+	}
+	return KVS_EINVAL;
+}
+- (void)printSexp:(FILE *const)file :(size_t const)depth {
+	indent(file, depth);
+	fprintf(file, "(folded-metadata \"%s\" \"%s\")\n", field, value);
+}
+- (void)printUser:(FILE *const)file :(size_t const)depth {
+	bool const fq = needs_quotes(field);
+	if(fq) fprintf(file, "\"");
+	fprintf(file, "%s", field);
+	if(fq) fprintf(file, "\"");
+	fprintf(file, "~=");
+	bool const vq = needs_quotes(value);
+	if(vq) fprintf(file, "\"");
+	fprintf(file, "%s", value);
+	if(vq) fprintf(file, "\"");
+}
+@end
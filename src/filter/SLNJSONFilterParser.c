@@ -61,7 +61,11 @@ SLNFilterType SLNFilterTypeFromString(strarg_t const type, size_t const len) {
 	if(substr("union", type, len)) return SLNUnionFilterType;
 	if(substr("fulltext", type, len)) return SLNFulltextFilterType;
 	if(substr("metadata", type, len)) return SLNMetadataFilterType;
-//	if(substr("linked-from", type, len)) return SLNLinkedFromFilterType;
+	if(substr("folded-metadata", type, len)) return SLNFoldedMetadataFilterType;
+	if(substr("metadata-prefix", type, len)) return SLNMetadataPrefixFilterType;
+	if(substr("metadata-range", type, len)) return SLNMetadataRangeFilterType;
+	if(substr("type", type, len)) return SLNFileTypeFilterType;
+	if(substr("linked-from", type, len)) return SLNLinkedFromFilterType;
 	return SLNFilterTypeInvalid;
 }
 
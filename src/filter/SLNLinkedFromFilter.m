@@ -0,0 +1,239 @@
+// Copyright 2014-2015 Ben Trask
+// MIT licensed (see LICENSE for details)
+
+#include "SLNFilter.h"
+
+// Unlike SLNLinksToFilter, the result set here is small and bounded by
+// the number of links in one file's meta-files, so we just collect it
+// during -prepare: and walk the array.
+
+static int link_cmp_file(void const *const a, void const *const b) {
+	struct link const *const x = a, *const y = b;
+	if(x->fileID != y->fileID) return x->fileID < y->fileID ? -1 : 1;
+	if(x->sortID != y->sortID) return x->sortID < y->sortID ? -1 : 1;
+	return 0;
+}
+static int link_cmp_sort(void const *const a, void const *const b) {
+	struct link const *const x = a, *const y = b;
+	if(x->sortID != y->sortID) return x->sortID < y->sortID ? -1 : 1;
+	if(x->fileID != y->fileID) return x->fileID < y->fileID ? -1 : 1;
+	return 0;
+}
+
+@implementation SLNLinkedFromFilter
+- (void)free {
+	FREE(&URI);
+	FREE(&links);
+	FREE(&byfile);
+	count = 0;
+	cur = 0;
+	[super free];
+}
+
+- (SLNFilterType)type {
+	return SLNLinkedFromFilterType;
+}
+- (strarg_t)stringArg:(size_t const)i {
+	if(0 == i) return URI;
+	return NULL;
+}
+- (int)addStringArg:(strarg_t const)str :(size_t const)len {
+	if(!URI) {
+		URI = strndup(str, len);
+		if(!URI) return KVS_ENOMEM;
+		return 0;
+	}
+	return KVS_EINVAL;
+}
+- (void)printSexp:(FILE *const)file :(size_t const)depth {
+	indent(file, depth);
+	fprintf(file, "(linked-from \"%s\")\n", URI);
+}
+- (void)printUser:(FILE *const)file :(size_t const)depth {
+	fprintf(file, "linked-from=%s", URI);
+}
+
+- (int)addLinks:(KVS_txn *const)txn :(uint64_t const)metaFileID :(KVS_cursor *const)values :(KVS_cursor *const)files :(size_t *const)size {
+	KVS_range range[1];
+	KVS_val key[1];
+	SLNMetaFileIDFieldAndValueRange2(range, txn, metaFileID, "link");
+	int rc = kvs_cursor_firstr(values, range, key, NULL, +1);
+	for(; rc >= 0; rc = kvs_cursor_nextr(values, range, key, NULL, +1)) {
+		uint64_t m;
+		strarg_t f, target;
+		SLNMetaFileIDFieldAndValueKeyUnpack(key, txn, &m, &f, &target);
+		assert(metaFileID == m);
+
+		KVS_range targets[1];
+		KVS_val file[1];
+		SLNURIAndFileIDRange1(targets, txn, target);
+		rc = kvs_cursor_firstr(files, targets, file, NULL, +1);
+		for(; rc >= 0; rc = kvs_cursor_nextr(files, targets, file, NULL, +1)) {
+			strarg_t u;
+			uint64_t fileID;
+			SLNURIAndFileIDKeyUnpack(file, txn, &u, &fileID);
+			if(count+1 > *size) {
+				*size = MAX(16, *size * 2);
+				struct link *const x = reallocarray(links, *size, sizeof(*links));
+				if(!x) return KVS_ENOMEM;
+				links = x;
+			}
+			links[count++] = (struct link){ metaFileID, fileID };
+		}
+		if(KVS_NOTFOUND != rc) return rc;
+	}
+	if(KVS_NOTFOUND != rc) return rc;
+	return 0;
+}
+- (int)prepare:(KVS_txn *const)txn {
+	if(!URI) return KVS_EINVAL;
+	int rc = [super prepare:txn];
+	if(rc < 0) return rc;
+
+	FREE(&links);
+	FREE(&byfile);
+	count = 0;
+	cur = 0;
+
+	KVS_cursor *metafiles = NULL;
+	KVS_cursor *values = NULL;
+	KVS_cursor *files = NULL;
+	str_t **alts = NULL;
+	size_t size = 0;
+
+	rc = SLNFilterCopyURISynonyms(txn, URI, &alts);
+	if(rc < 0) goto cleanup;
+	rc = kvs_cursor_open(txn, &metafiles); // SLNTargetURIAndMetaFileID
+	rc = rc < 0 ? rc : kvs_cursor_open(txn, &values); // SLNMetaFileIDFieldAndValue
+	rc = rc < 0 ? rc : kvs_cursor_open(txn, &files); // SLNURIAndFileID
+	if(rc < 0) goto cleanup;
+
+	for(size_t i = 0; alts[i]; i++) {
+		KVS_range range[1];
+		KVS_val key[1];
+		SLNTargetURIAndMetaFileIDRange1(range, txn, alts[i]);
+		rc = kvs_cursor_firstr(metafiles, range, key, NULL, +1);
+		for(; rc >= 0; rc = kvs_cursor_nextr(metafiles, range, key, NULL, +1)) {
+			strarg_t u;
+			uint64_t metaFileID;
+			SLNTargetURIAndMetaFileIDKeyUnpack(key, txn, &u, &metaFileID);
+			rc = [self addLinks:txn :metaFileID :values :files :&size];
+			if(rc < 0) goto cleanup;
+		}
+		if(KVS_NOTFOUND != rc) goto cleanup;
+		rc = 0;
+	}
+
+	// Each file is reported once, at the earliest meta-file linking to it.
+	qsort(links, count, sizeof(*links), link_cmp_file);
+	size_t n = 0;
+	for(size_t i = 0; i < count; i++) {
+		if(n && links[n-1].fileID == links[i].fileID) continue;
+		links[n++] = links[i];
+	}
+	count = n;
+	if(count) {
+		byfile = reallocarray(NULL, count, sizeof(*byfile));
+		if(!byfile) rc = KVS_ENOMEM;
+		if(rc < 0) goto cleanup;
+		memcpy(byfile, links, sizeof(*byfile) * count);
+	}
+	qsort(links, count, sizeof(*links), link_cmp_sort);
+
+cleanup:
+	kvs_cursor_close(metafiles); metafiles = NULL;
+	kvs_cursor_close(values); values = NULL;
+	kvs_cursor_close(files); files = NULL;
+	if(alts) for(size_t i = 0; alts[i]; i++) FREE(&alts[i]);
+	FREE(&alts);
+	return rc;
+}
+- (void)reset {
+	FREE(&links);
+	FREE(&byfile);
+	count = 0;
+	cur = 0;
+	[super reset];
+}
+
+- (void)seek:(int const)dir :(uint64_t const)sortID :(uint64_t const)fileID {
+	struct link const target = { sortID, fileID };
+	size_t lo = 0, hi = count;
+	while(lo < hi) {
+		size_t const mid = lo + (hi - lo) / 2;
+		if(link_cmp_sort(&links[mid], &target) < 0) lo = mid+1;
+		else hi = mid;
+	}
+	// lo is now the first entry >= target.
+	if(dir > 0) cur = lo;
+	else if(lo < count && 0 == link_cmp_sort(&links[lo], &target)) cur = lo;
+	else if(dir < 0 && lo > 0) cur = lo-1;
+	else cur = count;
+}
+- (void)current:(int const)dir :(uint64_t *const)sortID :(uint64_t *const)fileID {
+	if(cur < count) {
+		if(sortID) *sortID = links[cur].sortID;
+		if(fileID) *fileID = links[cur].fileID;
+	} else {
+		if(sortID) *sortID = invalid(dir);
+		if(fileID) *fileID = invalid(dir);
+	}
+}
+- (void)step:(int const)dir {
+	if(cur >= count) return;
+	if(dir > 0) cur++;
+	else if(dir < 0 && cur > 0) cur--;
+	else cur = count;
+}
+- (SLNAgeRange)fullAge:(uint64_t const)fileID {
+	struct link const target = { 0, fileID };
+	size_t lo = 0, hi = count;
+	while(lo < hi) {
+		size_t const mid = lo + (hi - lo) / 2;
+		if(link_cmp_file(&byfile[mid], &target) < 0) lo = mid+1;
+		else hi = mid;
+	}
+	if(lo >= count || byfile[lo].fileID != fileID) {
+		return (SLNAgeRange){UINT64_MAX, UINT64_MAX};
+	}
+	return (SLNAgeRange){byfile[lo].sortID, UINT64_MAX};
+}
+- (uint64_t)fastAge:(uint64_t const)fileID :(uint64_t const)sortID {
+	return [self fullAge:fileID].min;
+}
+- (bool)mightMatch:(KVS_txn *const)txn :(uint64_t const)after :(uint64_t const)latest {
+	// Our links only come from meta-files for the URI or its synonyms,
+	// so one seek each for a new one is enough.
+	if(!URI) return true;
+	str_t **alts = NULL;
+	int rc = SLNFilterCopyURISynonyms(txn, URI, &alts);
+	if(rc < 0) return true;
+	KVS_cursor *cursor = NULL;
+	rc = kvs_txn_cursor(txn, &cursor);
+	bool match = rc < 0;
+	for(size_t i = 0; !match && alts[i]; i++) {
+		KVS_range range[1];
+		KVS_val key[1];
+		SLNTargetURIAndMetaFileIDRange1(range, txn, alts[i]);
+		SLNTargetURIAndMetaFileIDKeyPack(key, txn, alts[i], after+1);
+		rc = kvs_cursor_seekr(cursor, range, key, NULL, +1);
+		if(rc < 0) {
+			match = KVS_NOTFOUND != rc;
+			continue;
+		}
+		strarg_t u;
+		uint64_t metaFileID;
+		SLNTargetURIAndMetaFileIDKeyUnpack(key, txn, &u, &metaFileID);
+		match = metaFileID <= latest;
+	}
+	for(size_t i = 0; alts[i]; i++) FREE(&alts[i]);
+	FREE(&alts);
+	return match;
+}
+- (uint64_t)estimate:(int const)dir :(uint64_t const)sortID :(uint64_t const)fileID :(uint64_t const)max {
+	[self seek:dir :sortID :fileID];
+	if(cur >= count) return 0;
+	return MIN(dir > 0 ? count-cur : cur+1, max);
+}
+@end
+
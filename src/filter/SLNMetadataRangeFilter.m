@@ -0,0 +1,332 @@
+// Copyright 2014-2015 Ben Trask
+// MIT licensed (see LICENSE for details)
+
+#include "SLNFilter.h"
+
+// SLNFieldValueAndMetaFileID is sorted by field, then value, then
+// meta-file ID, so the meta-file IDs for a range of values don't come out
+// in order. When the range has only a few distinct values, we keep one
+// cursor per value and merge them by meta-file ID, which costs nothing up
+// front. Past RANGE_MERGE_MAX values (e.g. dates, which are mostly
+// unique) that many cursors would be slower than walking the range once
+// per transaction and sorting the IDs, so we do that instead. Either way,
+// -match: checks the meta-file's own values with a single seek.
+
+static int id_cmp(void const *const a, void const *const b) {
+	uint64_t const x = *(uint64_t const *)a, y = *(uint64_t const *)b;
+	if(x != y) return x < y ? -1 : 1;
+	return 0;
+}
+
+@implementation SLNMetadataRangeFilter
+- (void)free {
+	[self clear];
+	FREE(&field);
+	FREE(&low);
+	FREE(&high);
+	[super free];
+}
+- (void)clear {
+	for(size_t i = 0; i < nvalues; i++) {
+		kvs_cursor_close(cursors[i]); cursors[i] = NULL;
+		FREE(&values[i]);
+		ids[i] = 0;
+	}
+	nvalues = 0;
+	FREE(&metaFileIDs);
+	count = 0;
+	cur = 0;
+	kvs_cursor_close(match); match = NULL;
+}
+
+- (SLNFilterType)type {
+	return SLNMetadataRangeFilterType;
+}
+- (strarg_t)stringArg:(size_t const)i {
+	switch(i) {
+		case 0: return field;
+		case 1: return low;
+		case 2: return high;
+		default: return NULL;
+	}
+}
+- (int)addStringArg:(strarg_t const)str :(size_t const)len {
+	if(!field) {
+		field = strndup(str, len);
+		if(!field) return KVS_ENOMEM;
+		return 0;
+	}
+	if(!low) {
+		low = strndup(str, len);
+		if(!low) return KVS_ENOMEM;
+		return 0;
+	}
+	if(!high) {
+		high = strndup(str, len);
+		if(!high) return KVS_ENOMEM;
+		return 0;
+	}
+	return KVS_EINVAL;
+}
+- (void)printSexp:(FILE *const)file :(size_t const)depth {
+	indent(file, depth);
+	fprintf(file, "(metadata-range \"%s\" \"%s\" \"%s\")\n", field, low, high ? high : "");
+}
+- (void)printUser:(FILE *const)file :(size_t const)depth {
+	bool const fq = needs_quotes(field);
+	if(fq) fprintf(file, "\"");
+	fprintf(file, "%s", field);
+	if(fq) fprintf(file, "\"");
+	fprintf(file, "..=");
+	// Bounds are quoted separately so that they can contain "..".
+	strarg_t const h = high ? high : "";
+	bool const vq =
+		needs_quotes(low) || strstr(low, "..") ||
+		needs_quotes(h) || strstr(h, "..");
+	if(vq) fprintf(file, "\"%s\"..\"%s\"", low, h);
+	else fprintf(file, "%s..%s", low, h);
+}
+- (bool)inRange:(strarg_t const)value {
+	if(!high || '\0' == high[0]) return true;
+	return strcmp(value, high) < 0;
+}
+
+- (int)prepare:(KVS_txn *const)txn {
+	int rc = [super prepare:txn];
+	if(rc < 0) return rc;
+	if(!field || !low) return KVS_EINVAL;
+	[self clear];
+
+	rc = kvs_cursor_open(txn, &match); // SLNMetaFileIDFieldAndValue
+	if(rc < 0) return rc;
+
+	// Jump from each value to the next, so this is at most
+	// RANGE_MERGE_MAX+1 seeks no matter how many meta-files there are.
+	KVS_cursor *cursor = NULL;
+	rc = kvs_cursor_open(txn, &cursor); // SLNFieldValueAndMetaFileID
+	if(rc < 0) return rc;
+	KVS_range range[1];
+	KVS_val key[1];
+	SLNFieldValueAndMetaFileIDRange1(range, txn, field);
+	SLNFieldValueAndMetaFileIDKeyPack(key, txn, field, low, 0);
+	bool many = false;
+	rc = kvs_cursor_seekr(cursor, range, key, NULL, +1);
+	while(rc >= 0) {
+		KVS_val x[1];
+		rc = kvs_cursor_current(cursor, x, NULL);
+		if(rc < 0) break;
+		strarg_t f, v;
+		uint64_t metaFileID;
+		SLNFieldValueAndMetaFileIDKeyUnpack(x, txn, &f, &v, &metaFileID);
+		if(![self inRange:v]) break;
+		if(nvalues >= RANGE_MERGE_MAX) { many = true; break; }
+		values[nvalues] = strdup(v);
+		if(!values[nvalues]) { rc = KVS_ENOMEM; break; }
+		KVS_val next[1];
+		SLNFieldValueAndMetaFileIDKeyPack(next, txn, field, values[nvalues], UINT64_MAX);
+		nvalues++;
+		rc = kvs_cursor_seekr(cursor, range, next, NULL, +1);
+	}
+	kvs_cursor_close(cursor); cursor = NULL;
+	if(rc < 0 && KVS_NOTFOUND != rc) return rc;
+
+	if(many) {
+		for(size_t i = 0; i < nvalues; i++) FREE(&values[i]);
+		nvalues = 0;
+		return [self collect:txn];
+	}
+	for(size_t i = 0; i < nvalues; i++) {
+		rc = kvs_cursor_open(txn, &cursors[i]); // SLNFieldValueAndMetaFileID
+		if(rc < 0) return rc;
+	}
+	return 0;
+}
+- (int)collect:(KVS_txn *const)txn {
+	KVS_cursor *cursor = NULL;
+	size_t size = 0;
+	int rc = kvs_cursor_open(txn, &cursor); // SLNFieldValueAndMetaFileID
+	if(rc < 0) return rc;
+
+	KVS_range range[1];
+	KVS_val key[1];
+	SLNFieldValueAndMetaFileIDRange1(range, txn, field);
+	SLNFieldValueAndMetaFileIDKeyPack(key, txn, field, low, 0);
+	rc = kvs_cursor_seekr(cursor, range, key, NULL, +1);
+	for(; rc >= 0; rc = kvs_cursor_nextr(cursor, range, key, NULL, +1)) {
+		strarg_t f, v;
+		uint64_t metaFileID;
+		SLNFieldValueAndMetaFileIDKeyUnpack(key, txn, &f, &v, &metaFileID);
+		if(![self inRange:v]) break;
+		if(count+1 > size) {
+			size = MAX(16, size * 2);
+			uint64_t *const x = reallocarray(metaFileIDs, size, sizeof(*metaFileIDs));
+			if(!x) { rc = KVS_ENOMEM; break; }
+			metaFileIDs = x;
+		}
+		metaFileIDs[count++] = metaFileID;
+	}
+	kvs_cursor_close(cursor); cursor = NULL;
+	if(rc < 0 && KVS_NOTFOUND != rc) return rc;
+
+	qsort(metaFileIDs, count, sizeof(*metaFileIDs), id_cmp);
+	size_t n = 0;
+	for(size_t i = 0; i < count; i++) {
+		if(n && metaFileIDs[n-1] == metaFileIDs[i]) continue;
+		metaFileIDs[n++] = metaFileIDs[i];
+	}
+	count = n;
+	return 0;
+}
+- (void)reset {
+	[self clear];
+	[super reset];
+}
+
+- (uint64_t)seekMeta:(int const)dir :(uint64_t const)sortID {
+	if(nvalues) {
+		for(size_t i = 0; i < nvalues; i++) {
+			KVS_range range[1];
+			SLNFieldValueAndMetaFileIDRange2(range, curtxn, field, values[i]);
+			KVS_val key[1];
+			SLNFieldValueAndMetaFileIDKeyPack(key, curtxn, field, values[i], sortID);
+			int rc = kvs_cursor_seekr(cursors[i], range, key, NULL, dir);
+			ids[i] = invalid(dir);
+			if(rc < 0) continue;
+			strarg_t f, v;
+			SLNFieldValueAndMetaFileIDKeyUnpack(key, curtxn, &f, &v, &ids[i]);
+		}
+		return [self currentMeta:dir];
+	}
+	size_t lo = 0, hi = count;
+	while(lo < hi) {
+		size_t const mid = lo + (hi - lo) / 2;
+		if(metaFileIDs[mid] < sortID) lo = mid+1;
+		else hi = mid;
+	}
+	if(dir > 0) cur = lo;
+	else if(lo < count && sortID == metaFileIDs[lo]) cur = lo;
+	else if(dir < 0 && lo > 0) cur = lo-1;
+	else cur = count;
+	return [self currentMeta:dir];
+}
+- (uint64_t)currentMeta:(int const)dir {
+	if(nvalues) {
+		uint64_t x = invalid(dir);
+		for(size_t i = 0; i < nvalues; i++) {
+			if(dir > 0 ? ids[i] < x : ids[i] > x) x = ids[i];
+		}
+		return x;
+	}
+	if(cur >= count) return invalid(dir);
+	return metaFileIDs[cur];
+}
+- (uint64_t)stepMeta:(int const)dir {
+	if(nvalues) {
+		uint64_t const x = [self currentMeta:dir];
+		if(!valid(x)) return x;
+		// Step every cursor that's on this meta-file, so a meta-file
+		// with several values in range only comes out once.
+		for(size_t i = 0; i < nvalues; i++) {
+			if(x != ids[i]) continue;
+			KVS_range range[1];
+			SLNFieldValueAndMetaFileIDRange2(range, curtxn, field, values[i]);
+			KVS_val key[1];
+			int rc = kvs_cursor_nextr(cursors[i], range, key, NULL, dir);
+			ids[i] = invalid(dir);
+			if(rc < 0) continue;
+			strarg_t f, v;
+			SLNFieldValueAndMetaFileIDKeyUnpack(key, curtxn, &f, &v, &ids[i]);
+		}
+		return [self currentMeta:dir];
+	}
+	if(cur >= count) return invalid(dir);
+	if(dir > 0) cur++;
+	else if(dir < 0 && cur > 0) cur--;
+	else cur = count;
+	return [self currentMeta:dir];
+}
+- (bool)match:(uint64_t const)metaFileID {
+	// The first value at or after low is the only one we need to check.
+	KVS_range range[1];
+	SLNMetaFileIDFieldAndValueRange2(range, curtxn, metaFileID, field);
+	KVS_val key[1];
+	SLNMetaFileIDFieldAndValueKeyPack(key, curtxn, metaFileID, field, low);
+	int rc = kvs_cursor_seekr(match, range, key, NULL, +1);
+	if(KVS_NOTFOUND == rc) return false;
+	if(rc < 0) assertf(0, "Database error %s", sln_strerror(rc));
+	uint64_t m;
+	strarg_t f, v;
+	SLNMetaFileIDFieldAndValueKeyUnpack(key, curtxn, &m, &f, &v);
+	return [self inRange:v];
+}
+- (bool)mightMatch:(KVS_txn *const)txn :(uint64_t const)after :(uint64_t const)latest {
+	// Same seek as -match: for each new meta-file. After a big commit
+	// it's cheaper to just look.
+	if(!field || !low) return true;
+	KVS_cursor *cursor = NULL;
+	int rc = kvs_txn_cursor(txn, &cursor);
+	if(rc < 0) return true;
+	KVS_range metafiles[1];
+	SLNMetaFileByIDRange0(metafiles, txn);
+	uint64_t next = after+1;
+	for(size_t i = 0; i < RANGE_CHECK_MAX; i++) {
+		KVS_val key[1];
+		SLNMetaFileByIDKeyPack(key, txn, next);
+		rc = kvs_cursor_seekr(cursor, metafiles, key, NULL, +1);
+		if(rc < 0) return KVS_NOTFOUND != rc;
+		uint64_t metaFileID;
+		SLNMetaFileByIDKeyUnpack(key, txn, &metaFileID);
+		if(metaFileID > latest) return false;
+
+		KVS_range range[1];
+		SLNMetaFileIDFieldAndValueRange2(range, txn, metaFileID, field);
+		KVS_val value[1];
+		SLNMetaFileIDFieldAndValueKeyPack(value, txn, metaFileID, field, low);
+		rc = kvs_cursor_seekr(cursor, range, value, NULL, +1);
+		if(rc < 0 && KVS_NOTFOUND != rc) return true;
+		if(rc >= 0) {
+			uint64_t m;
+			strarg_t f, v;
+			SLNMetaFileIDFieldAndValueKeyUnpack(value, txn, &m, &f, &v);
+			if([self inRange:v]) return true;
+		}
+		next = metaFileID+1;
+	}
+	return true;
+}
+- (uint64_t)estimate:(int const)dir :(uint64_t const)sortID :(uint64_t const)fileID :(uint64_t const)max {
+	if(nvalues) return [super estimate:dir :sortID :fileID :max];
+	[self seekMeta:dir :sortID];
+	if(cur >= count) return 0;
+	return MIN(dir > 0 ? count-cur : cur+1, max);
+}
+@end
+
+@implementation SLNMetadataPrefixFilter
+- (SLNFilterType)type {
+	return SLNMetadataPrefixFilterType;
+}
+- (int)addStringArg:(strarg_t const)str :(size_t const)len {
+	if(low) return KVS_EINVAL;
+	return [super addStringArg:str :len];
+}
+- (void)printSexp:(FILE *const)file :(size_t const)depth {
+	indent(file, depth);
+	fprintf(file, "(metadata-prefix \"%s\" \"%s\")\n", field, low);
+}
+- (void)printUser:(FILE *const)file :(size_t const)depth {
+	bool const fq = needs_quotes(field);
+	if(fq) fprintf(file, "\"");
+	fprintf(file, "%s", field);
+	if(fq) fprintf(file, "\"");
+	fprintf(file, "^=");
+	bool const vq = needs_quotes(low);
+	if(vq) fprintf(file, "\"");
+	fprintf(file, "%s", low);
+	if(vq) fprintf(file, "\"");
+}
+- (bool)inRange:(strarg_t const)value {
+	return 0 == strncmp(value, low, strlen(low));
+}
+@end
+
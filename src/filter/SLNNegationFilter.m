@@ -67,5 +67,14 @@
 	if(sortID == age) return UINT64_MAX;
 	return sortID;
 }
+- (uint64_t)estimate:(int const)dir :(uint64_t const)sortID :(uint64_t const)fileID :(uint64_t const)max {
+	return max; // We don't list what we match.
+}
+- (bool)mightMatch:(KVS_txn *const)txn :(uint64_t const)after :(uint64_t const)latest {
+	return false; // New files can only be removed.
+}
+- (bool)listsMatches {
+	return false;
+}
 @end
 
@@ -95,7 +95,12 @@ static SLNFilterRef parse_term(sstring *const query) {
 	if(0 == s_casecmp(*term, S_STATIC("or"))) return NULL;
 	if(0 == s_casecmp(*term, S_STATIC("and"))) return NULL;
 	SLNFilterRef filter = createfilter(SLNFulltextFilterType);
-	int rc = SLNFilterAddStringArg(filter, term->str, term->len);
+	// Keep the quotes (if any) so that the filter does a phrase search.
+	sstring const raw = { query->str, q->str - query->str };
+	bool const quoted = raw.len >= 2 && raw.str[0] == raw.str[raw.len-1] && term->str != raw.str;
+	int rc = quoted ?
+		SLNFilterAddStringArg(filter, raw.str, raw.len) :
+		SLNFilterAddStringArg(filter, term->str, term->len);
 	if(rc < 0) {
 		SLNFilterFree(&filter);
 		return NULL;
@@ -103,17 +108,75 @@ static SLNFilterRef parse_term(sstring *const query) {
 	*query = *q;
 	return filter;
 }
+static SLNFilterRef parse_range(sstring *const query, sstring *const q, sstring const *const f) {
+	sstring low, high;
+	char const x = s_peek(q);
+	sstring const v = read_term(q);
+	if(('"' == x || '\'' == x) && '.' == s_peek(q)) {
+		// Separately quoted bounds.
+		low = v;
+		if('.' != s_pop(q)) return NULL;
+		if('.' != s_pop(q)) return NULL;
+		high = read_term(q);
+	} else {
+		// Split at the first "..", quoted together or not.
+		size_t i = 0;
+		for(; i+1 < v.len; i++) if('.' == v.str[i] && '.' == v.str[i+1]) break;
+		if(i+1 >= v.len) return NULL;
+		low = (sstring){ v.str, i };
+		high = (sstring){ v.str+i+2, v.len-i-2 };
+	}
+	SLNFilterRef const filter = createfilter(SLNMetadataRangeFilterType);
+	SLNFilterAddStringArg(filter, f->str, f->len);
+	SLNFilterAddStringArg(filter, low.str, low.len);
+	SLNFilterAddStringArg(filter, high.str, high.len);
+	*query = *q;
+	return filter;
+}
 static SLNFilterRef parse_attr(sstring *const query) {
 	sstring q[1] = { *query };
-	sstring const f[1] = { read_term(q) };
+	sstring f[1] = { read_term(q) };
 	if(!f->len) return NULL;
+	// field~=value matches case-insensitively.
+	// field^=prefix matches values starting with prefix.
+	// field..=low..high matches low <= value < high.
+	// Bounds containing ".." can be quoted: field..="a..b".."c".
+	char op = '=';
+	if('~' == s_peek(q) || '^' == s_peek(q)) {
+		op = s_pop(q);
+	} else if('.' == s_peek(q)) {
+		s_pop(q);
+		if('.' != s_pop(q)) return NULL;
+		op = '.';
+	} else if(f->len > 2 && '.' == f->str[f->len-1] && '.' == f->str[f->len-2]) {
+		f->len -= 2;
+		op = '.';
+	} else if(f->len > 1 && ('~' == f->str[f->len-1] || '^' == f->str[f->len-1])) {
+		op = f->str[f->len-1];
+		f->len--;
+	}
 	if('=' != s_pop(q)) return NULL;
+	if('.' == op) return parse_range(query, q, f);
 	sstring const v[1] = { read_term(q) };
 	if(!v->len) return NULL;
 	SLNFilterRef filter = NULL;
-	if(0 == s_casecmp(*f, S_STATIC("target"))) {
+	if('~' == op) {
+		filter = createfilter(SLNFoldedMetadataFilterType);
+		SLNFilterAddStringArg(filter, f->str, f->len);
+		SLNFilterAddStringArg(filter, v->str, v->len);
+	} else if('^' == op) {
+		filter = createfilter(SLNMetadataPrefixFilterType);
+		SLNFilterAddStringArg(filter, f->str, f->len);
+		SLNFilterAddStringArg(filter, v->str, v->len);
+	} else if(0 == s_casecmp(*f, S_STATIC("target"))) {
 		filter = createfilter(SLNTargetURIFilterType);
 		SLNFilterAddStringArg(filter, v->str, v->len);
+	} else if(0 == s_casecmp(*f, S_STATIC("linked-from"))) {
+		filter = createfilter(SLNLinkedFromFilterType);
+		SLNFilterAddStringArg(filter, v->str, v->len);
+	} else if(0 == s_casecmp(*f, S_STATIC("filetype"))) {
+		filter = createfilter(SLNFileTypeFilterType);
+		SLNFilterAddStringArg(filter, v->str, v->len);
 	} else {
 		filter = createfilter(SLNMetadataFilterType);
 		SLNFilterAddStringArg(filter, f->str, f->len);